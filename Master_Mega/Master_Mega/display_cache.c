@@ -0,0 +1,122 @@
+/*
+ * display_cache.c
+ *
+ * Created: 19/10/2026 19:12:47
+ * Author : Group 07
+ *
+ * The state machine redraws the whole screen on every state change. Most of the time one of
+ * the rows, or all of the screen, is already on the LCD, so only the differences are sent.
+ * A row that has to become empty is sent without text, "3>" clears the first row. "4" is only
+ * sent when the Uno may show anything or both rows have to become empty.
+ */
+
+#include <string.h>
+#include "display_cache.h"
+#include "fmt.h"
+
+static char g_wanted[DISPLAY_ROWS][DISPLAY_ROW_SIZE];
+static char g_shown[DISPLAY_ROWS][DISPLAY_ROW_SIZE];
+static bool g_valid = false; // g_shown is what the Uno shows
+static bool g_buzzer_valid = false;
+static bool g_buzzer_on = false;
+
+static uint16_t g_asked = 0;
+static uint16_t g_sent = 0;
+
+// Row commands of the Uno
+static const char g_row_command[DISPLAY_ROWS] = { '3', '5' };
+
+void
+display_cache_invalidate(void)
+{
+	g_valid = false;
+	g_buzzer_valid = false;
+}
+
+bool
+display_cache_command(const char *command)
+{
+	uint8_t row;
+	
+	if (command[0] == '4' && command[1] == '\0')
+	{
+		g_wanted[0][0] = '\0';
+		g_wanted[1][0] = '\0';
+		g_asked++;
+		return true;
+	}
+	
+	for (row = 0; row < DISPLAY_ROWS; row++)
+	{
+		if (command[0] == g_row_command[row] && command[1] == '>')
+		{
+			strncpy(g_wanted[row], &command[2], DISPLAY_ROW_SIZE - 1);
+			g_wanted[row][DISPLAY_ROW_SIZE - 1] = '\0';
+			g_asked++;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+display_cache_buzzer(bool on)
+{
+	if (g_buzzer_valid && g_buzzer_on == on)
+	{
+		return false;
+	}
+	g_buzzer_valid = true;
+	g_buzzer_on = on;
+	return true;
+}
+
+bool
+display_cache_flush(spi_transaction_t *transaction)
+{
+	char command[DISPLAY_ROW_SIZE + 2];
+	bool clear = !g_valid;
+	uint8_t row;
+	
+	// One command empties both rows
+	if (g_wanted[0][0] == '\0' && g_wanted[1][0] == '\0' && (g_shown[0][0] != '\0' || g_shown[1][0] != '\0'))
+	{
+		clear = true;
+	}
+	
+	if (clear)
+	{
+		if (!spi_transaction_add(transaction, "4"))
+		{
+			return false;
+		}
+		g_shown[0][0] = '\0';
+		g_shown[1][0] = '\0';
+		g_valid = true;
+		g_sent++;
+	}
+	
+	for (row = 0; row < DISPLAY_ROWS; row++)
+	{
+		if (strcmp(g_wanted[row], g_shown[row]) == 0)
+		{
+			continue;
+		}
+		command[0] = g_row_command[row];
+		command[1] = '>';
+		strcpy(&command[2], g_wanted[row]);
+		if (!spi_transaction_add(transaction, command))
+		{
+			return false;
+		}
+		strcpy(g_shown[row], g_wanted[row]);
+		g_sent++;
+	}
+	return true;
+}
+
+void
+display_cache_print_stats(void)
+{
+	fmt_print("Screen commands asked: %u, sent: %u\n\r", g_asked, g_sent);
+}
@@ -0,0 +1,42 @@
+/*
+ * display_cache.h
+ *
+ * Created: 19/10/2026 19:12:47
+ * Author : Group 07
+ */
+
+
+#ifndef DISPLAY_CACHE_H_
+#define DISPLAY_CACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spi_bus.h"
+
+#define DISPLAY_ROWS 2
+#define DISPLAY_ROW_SIZE 40 // Rows longer than the LCD are scrolled by the Uno, so they are kept whole
+
+/*
+Model of what the LCD of the Uno shows. The screen commands ("4", "3>text", "5>text") only
+change the wanted screen, display_cache_flush() then sends the rows that differ from the shown one.
+*/
+
+// The Uno may show anything, e.g. after it was reset or a frame was lost. The next flush sends all of it.
+void display_cache_invalidate(void);
+
+// Applies a screen command to the wanted screen, returns false if it is not a screen command
+bool display_cache_command(const char *command);
+
+// Remembers the state of the buzzers, returns false if they are in that state already
+bool display_cache_buzzer(bool on);
+
+/*
+Adds the commands that turn the shown screen into the wanted one to the transaction.
+Returns false if they did not all fit, the rest is added by the next call.
+*/
+bool display_cache_flush(spi_transaction_t *transaction);
+
+// Prints how many screen commands were asked for and how many had to be sent
+void display_cache_print_stats(void);
+
+#endif /* DISPLAY_CACHE_H_ */
@@ -0,0 +1,90 @@
+/*
+ * event_queue.c
+ *
+ * Created: 19/10/2026 09:12:40
+ * Author : Group 07
+ *
+ * Queue of events from the interrupts to the main loop.
+ * The interrupts only move the head and the main loop only moves the tail.
+ * Both indexes are single bytes, so reading them cannot tear and no locking is needed.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "event_queue.h"
+
+static uint8_t g_event_type[EVENT_QUEUE_SIZE];
+static uint8_t g_event_arg[EVENT_QUEUE_SIZE];
+
+// Free running indexes, masked when used. head - tail is the number of events waiting.
+static volatile uint8_t g_head = 0;
+static volatile uint8_t g_tail = 0;
+
+static uint8_t g_high_water = 0;
+static uint16_t g_overflows = 0;
+
+bool
+event_post(uint8_t type, uint8_t arg)
+{
+	uint8_t head = g_head;
+	uint8_t used = head - g_tail;
+
+	if (used >= EVENT_QUEUE_SIZE)
+	{
+		g_overflows++;
+		return false;
+	}
+
+	g_event_type[head & (EVENT_QUEUE_SIZE - 1)] = type;
+	g_event_arg[head & (EVENT_QUEUE_SIZE - 1)] = arg;
+	// Publishing the event only after it has been written
+	g_head = head + 1;
+
+	if (used + 1 > g_high_water)
+	{
+		g_high_water = used + 1;
+	}
+	return true;
+}
+
+bool
+event_get(event_t *event)
+{
+	uint8_t tail = g_tail;
+
+	if (tail == g_head)
+	{
+		return false;
+	}
+
+	event->type = g_event_type[tail & (EVENT_QUEUE_SIZE - 1)];
+	event->arg = g_event_arg[tail & (EVENT_QUEUE_SIZE - 1)];
+	// Freeing the slot only after it has been read
+	g_tail = tail + 1;
+	return true;
+}
+
+bool
+event_queue_empty(void)
+{
+	return g_tail == g_head;
+}
+
+uint8_t
+event_queue_high_water(void)
+{
+	return g_high_water;
+}
+
+uint16_t
+event_queue_overflows(void)
+{
+	uint16_t overflows;
+	uint8_t sreg = SREG;
+	
+	// The counter is written by the interrupts, reading both bytes at once
+	cli();
+	overflows = g_overflows;
+	SREG = sreg;
+	return overflows;
+}
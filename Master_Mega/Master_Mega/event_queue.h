@@ -0,0 +1,51 @@
+/*
+ * event_queue.h
+ *
+ * Created: 19/10/2026 09:12:40
+ * Author : Group 07
+ */
+
+
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EVENT_QUEUE_SIZE 16 // Has to be a power of two, at most 128
+
+/*Event types, the meaning of the argument is given for each*/
+#define EVENT_MOTION 1 // Motion sensor triggered, arg: not used
+#define EVENT_TICK 2 // One second passed on the alarm timer, arg: not used
+#define EVENT_KEY 3 // Key pressed, arg: ASCII of the key
+#define EVENT_TIMEOUT 5 // Timeout of the current state ran out, arg: id given when it was set
+#define EVENT_SERIAL_LINE 6 // A line from the host is complete, arg: not used
+
+typedef struct
+{
+	uint8_t type;
+	uint8_t arg;
+} event_t;
+
+/*
+Adds an event to the end of the queue.
+Has to be called with interrupts disabled, as they are inside an ISR.
+Returns false and counts an overflow if the queue is full.
+*/
+bool event_post(uint8_t type, uint8_t arg);
+
+/*
+Takes the oldest event from the queue. Only called from the main loop.
+Returns false if the queue is empty.
+*/
+bool event_get(event_t *event);
+
+bool event_queue_empty(void);
+
+// The most events that have been waiting in the queue at the same time
+uint8_t event_queue_high_water(void);
+
+// Number of events dropped because the queue was full
+uint16_t event_queue_overflows(void);
+
+#endif /* EVENT_QUEUE_H_ */
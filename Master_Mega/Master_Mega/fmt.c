@@ -0,0 +1,220 @@
+/*
+ * fmt.c
+ *
+ * Created: 19/10/2026 22:14:51
+ * Author : Group 07
+ *
+ * Streams the formatted text one character at a time to stdout or to a buffer, nothing is
+ * collected first. Numbers are turned into digits by utoa() and ultoa() of avr-libc, written
+ * in assembler, so vfprintf and vfscanf are not linked at all.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fmt.h"
+
+#define FLAG_LEFT 0x01
+#define FLAG_ZERO 0x02
+#define FLAG_LONG 0x04
+#define FLAG_PROGMEM 0x08 // The string of %S
+
+// Where the characters go, stdout if g_out is NULL. Only used from the main loop.
+static char *g_out;
+static uint8_t g_room; // Space left in g_out, one place is kept for the terminating zero
+static uint8_t g_count;
+
+static void
+put(char c)
+{
+	if (g_out == NULL)
+	{
+		putchar(c);
+	}
+	else if (g_room > 1)
+	{
+		*g_out++ = c;
+		g_room--;
+	}
+	g_count++;
+}
+
+static void
+put_padding(uint8_t count, char fill)
+{
+	while (count-- != 0)
+	{
+		put(fill);
+	}
+}
+
+// Writes a string in RAM or PROGMEM padded to the width
+static void
+put_field(const char *text, uint8_t flags, uint8_t width, char fill)
+{
+	uint8_t length = (flags & FLAG_PROGMEM) ? strlen_P(text) : strlen(text);
+	uint8_t padding = (width > length) ? width - length : 0;
+	char c;
+	
+	if (!(flags & FLAG_LEFT))
+	{
+		// A zero padded negative number keeps its sign first
+		if (fill == '0' && text[0] == '-')
+		{
+			put(*text++);
+		}
+		put_padding(padding, fill);
+	}
+	while ((c = (flags & FLAG_PROGMEM) ? pgm_read_byte(text) : *text) != '\0')
+	{
+		put(c);
+		text++;
+	}
+	if (flags & FLAG_LEFT)
+	{
+		put_padding(padding, ' ');
+	}
+}
+
+static void
+stream(const char *format, va_list args)
+{
+	char digits[12]; // "-2147483648" and the terminating zero
+	char c;
+	uint8_t flags, width;
+	
+	while ((c = pgm_read_byte(format++)) != '\0')
+	{
+		if (c != '%')
+		{
+			put(c);
+			continue;
+		}
+		
+		flags = 0;
+		width = 0;
+		c = pgm_read_byte(format++);
+		if (c == '-')
+		{
+			flags |= FLAG_LEFT;
+			c = pgm_read_byte(format++);
+		}
+		if (c == '0')
+		{
+			flags |= FLAG_ZERO;
+			c = pgm_read_byte(format++);
+		}
+		while (c >= '0' && c <= '9')
+		{
+			width = width * 10 + (c - '0');
+			c = pgm_read_byte(format++);
+		}
+		if (c == 'l')
+		{
+			flags |= FLAG_LONG;
+			c = pgm_read_byte(format++);
+		}
+		
+		switch (c)
+		{
+			case 'u':
+			case 'x':
+			case 'X':
+				if (flags & FLAG_LONG)
+				{
+					ultoa(va_arg(args, uint32_t), digits, (c == 'u') ? 10 : 16);
+				}
+				else
+				{
+					utoa(va_arg(args, unsigned int), digits, (c == 'u') ? 10 : 16);
+				}
+				if (c == 'X')
+				{
+					strupr(digits);
+				}
+				break;
+			
+			case 'd':
+				if (flags & FLAG_LONG)
+				{
+					ltoa(va_arg(args, int32_t), digits, 10);
+				}
+				else
+				{
+					itoa(va_arg(args, int), digits, 10);
+				}
+				break;
+			
+			case 'c':
+				digits[0] = (char)va_arg(args, int);
+				digits[1] = '\0';
+				break;
+			
+			case 's':
+			case 'S':
+				put_field(va_arg(args, const char *), flags | ((c == 'S') ? FLAG_PROGMEM : 0), width, ' ');
+				continue;
+			
+			case '\0':
+				// A '%' at the end of the format
+				return;
+			
+			default:
+				// "%%" and anything not known are written as they are
+				put(c);
+				continue;
+		}
+		put_field(digits, flags & FLAG_LEFT, width, (flags & FLAG_ZERO) ? '0' : ' ');
+	}
+}
+
+void
+fmt_printf_P(const char *format_P, ...)
+{
+	va_list args;
+	
+	g_out = NULL;
+	va_start(args, format_P);
+	stream(format_P, args);
+	va_end(args);
+}
+
+uint8_t
+fmt_snprintf_P(char *buffer, uint8_t size, const char *format_P, ...)
+{
+	va_list args;
+	
+	if (size == 0)
+	{
+		return 0;
+	}
+	g_out = buffer;
+	g_room = size;
+	g_count = 0;
+	va_start(args, format_P);
+	stream(format_P, args);
+	va_end(args);
+	*g_out = '\0';
+	g_out = NULL;
+	return (g_count < size) ? g_count : size - 1;
+}
+
+const char *
+fmt_parse_u16(const char *text, uint16_t *value)
+{
+	uint16_t result = 0;
+	const char *start = text;
+	
+	while (*text >= '0' && *text <= '9')
+	{
+		result = result * 10 + (*text - '0');
+		text++;
+	}
+	if (text != start)
+	{
+		*value = result;
+	}
+	return text;
+}
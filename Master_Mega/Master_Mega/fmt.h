@@ -0,0 +1,46 @@
+/*
+ * fmt.h
+ *
+ * Created: 19/10/2026 22:14:51
+ * Author : Group 07
+ */
+
+
+#ifndef FMT_H_
+#define FMT_H_
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/*
+Small formatter instead of printf, the same copy is in both projects.
+Conversions: %u %d %x %X %c %s %S (string in PROGMEM) and %%, an 'l' before u, d or x for 32 bits.
+A '-' (left aligned) or '0' (zero padded) and a width can come before them, e.g. "%-9S" or "%08lX".
+Only the digits of the value are made, with utoa()/ultoa(), there is no general conversion engine.
+*/
+
+/*
+fmt_print() and fmt_sprint() keep the format in flash and have it checked by the compiler like
+printf. The format has to be a string literal. %S cannot be checked, it is used with fmt_printf_P().
+*/
+#define fmt_print(format, ...) \
+	do { if (0) fmt_check(format, ##__VA_ARGS__); fmt_printf_P(PSTR(format), ##__VA_ARGS__); } while (0)
+#define fmt_sprint(buffer, size, format, ...) \
+	do { if (0) fmt_check(format, ##__VA_ARGS__); fmt_snprintf_P(buffer, size, PSTR(format), ##__VA_ARGS__); } while (0)
+
+// Never called, only gives the compiler the format to check
+void fmt_check(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Writes to stdout, the format is in PROGMEM
+void fmt_printf_P(const char *format, ...);
+
+// Writes at most size - 1 characters and the terminating zero, returns the characters written
+uint8_t fmt_snprintf_P(char *buffer, uint8_t size, const char *format, ...);
+
+/*
+Reads an unsigned decimal number at text, returns where the digits ended.
+*value is left as it is if there are no digits, the return value is then text.
+*/
+const char *fmt_parse_u16(const char *text, uint16_t *value);
+
+#endif /* FMT_H_ */
@@ -37,6 +37,8 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
                              Revision History
  ****************************************************************************************************
 15.0: Initial version 
+15.1: Periodic matrix scan with vertical counter debouncing of all keys
+15.2: Timeouts for all the wait functions
  ***************************************************************************************************/
 
 
@@ -72,6 +74,7 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
  ****************************************************************************************************/
 
 
+#include <avr/interrupt.h>
 #include "keypad.h"
 #include "delay.h"
 
@@ -81,7 +84,34 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
 /***************************************************************************************************
                            local function prototypes
  ***************************************************************************************************/
-static uint8_t keypad_ScanKey();
+static uint16_t keypad_ScanMatrix();
+static uint16_t keypad_FetchEdges(volatile uint16_t *ptr_edges_u16);
+/**************************************************************************************************/
+
+
+
+
+/***************************************************************************************************
+                             Debouncer state
+ ***************************************************************************************************
+ Bit n of each variable belongs to key n = (Row * 4) + Col.
+ The two counter bits of all 16 keys are kept in two words (vertical counter), so all keys are
+ debounced in parallel with a handful of logic operations per tick.
+ A key changes its debounced state after it was sampled in the new state on 4 consecutive ticks.
+ ***************************************************************************************************/
+static uint16_t v_keyCount0_u16 = 0xFFFF, v_keyCount1_u16 = 0xFFFF;  // Vertical counter, all ones: no change seen
+static volatile uint16_t v_keyState_u16;           // Debounced state, 1: key held down
+static volatile uint16_t v_keyPressEdges_u16;      // Keys pressed since last fetch
+static volatile uint16_t v_keyReleaseEdges_u16;    // Keys released since last fetch
+static uint16_t v_keypadTimeouts_u16 = 0;           // Waits that ended without the key event
+
+static const uint8_t A_KeyMap_U8[C_KeypadKeys_U8] =
+{
+	'1', '4', '7', '*',    // ROW0 (scan code 0xEx)
+	'2', '5', '8', '0',    // ROW1 (scan code 0xDx)
+	'3', '6', '9', '#',    // ROW2 (scan code 0xBx)
+	'A', 'B', 'C', 'D'     // ROW3 (scan code 0x7x)
+};
 /**************************************************************************************************/
 
 
@@ -107,65 +137,162 @@ void KEYPAD_Init()
 
 
 /***************************************************************************************************
-                   void KEYPAD_WaitForKeyRelease()
+                   void KEYPAD_ScanTick()
  ***************************************************************************************************
  * I/P Arguments:none
+ * Return value : none
 
- * Return value	: none
-
- * description  : This function waits till the previous key is released.
+ * description  : Samples the whole matrix and runs the vertical counter debouncer.
+                  Has to be called every C_KeypadScanTickMs_U8 ms, normally from a timer interrupt.
+                  Press and release edges are collected until they are fetched.
  ***************************************************************************************************/
-void KEYPAD_WaitForKeyRelease()
+void KEYPAD_ScanTick()
 {
-	uint8_t key;
-	do
-	{
-		do
-		{
-			M_ROW=0x0F;           // Pull the ROW lines to low and Column lines high.
-			key=M_COL & 0x0F;     // Read the Columns, to check the key press
-		}while(key!=0x0F);
+	uint16_t var_changed_u16;
 
-		DELAY_ms(1);
+	var_changed_u16 = v_keyState_u16 ^ keypad_ScanMatrix();   // Keys differing from the debounced state
 
-		M_ROW=0x0F;           // Pull the ROW lines to low and Column lines high.
-		key=M_COL & 0x0F;     // Read the Columns, to check the key press
-	}while(key!=0x0F);   // Wait till the Key is released,
-	                     // If no Key is pressed, Column lines will be High(0x0F)
+	v_keyCount0_u16 = ~(v_keyCount0_u16 & var_changed_u16);                     // Count down, reset unchanged keys
+	v_keyCount1_u16 = v_keyCount0_u16 ^ (v_keyCount1_u16 & var_changed_u16);
+	var_changed_u16 &= v_keyCount0_u16 & v_keyCount1_u16;                        // Keys whose counter rolled over
+
+	v_keyState_u16 ^= var_changed_u16;
+	v_keyPressEdges_u16 |= v_keyState_u16 & var_changed_u16;
+	v_keyReleaseEdges_u16 |= ~v_keyState_u16 & var_changed_u16;
+}
+
+
+
+
+/***************************************************************************************************
+                   uint16_t KEYPAD_GetPressEdges()
+ ***************************************************************************************************
+ * I/P Arguments:none
+
+ * Return value	: uint16_t--> Bitmap of the keys pressed since the last call, bit n = key n
+
+ * description  : Fetches and clears the debounced press edges.
+ ***************************************************************************************************/
+uint16_t KEYPAD_GetPressEdges()
+{
+	return keypad_FetchEdges(&v_keyPressEdges_u16);
 }
 
 
 
 
+/***************************************************************************************************
+                   uint16_t KEYPAD_GetReleaseEdges()
+ ***************************************************************************************************
+ * I/P Arguments:none
+
+ * Return value	: uint16_t--> Bitmap of the keys released since the last call, bit n = key n
+
+ * description  : Fetches and clears the debounced release edges.
+ ***************************************************************************************************/
+uint16_t KEYPAD_GetReleaseEdges()
+{
+	return keypad_FetchEdges(&v_keyReleaseEdges_u16);
+}
+
+
+
 
 /***************************************************************************************************
-                   void KEYPAD_WaitForKeyPress()
+                   uint16_t KEYPAD_GetKeyState()
  ***************************************************************************************************
  * I/P Arguments:none
 
- * Return value	: none
+ * Return value	: uint16_t--> Bitmap of the keys held down after debouncing, bit n = key n
+ ***************************************************************************************************/
+uint16_t KEYPAD_GetKeyState()
+{
+	uint16_t var_keyState_u16;
+	uint8_t var_sreg_u8 = SREG;
 
- * description  : This function waits till a new key is pressed.
-                  The new Key pressed can be decoded by the function KEYPAD_GetKey.
+	cli();
+	var_keyState_u16 = v_keyState_u16;
+	SREG = var_sreg_u8;
+	return var_keyState_u16;
+}
+
+
+
+
+/***************************************************************************************************
+                   uint8_t KEYPAD_KeyToAscii(uint8_t var_keyIndex_u8)
+ ***************************************************************************************************
+ * I/P Arguments: uint8_t--> Key number 0-15, as used in the bitmaps
+
+ * Return value	: uint8_t--> ASCII value of the Key, 'z' for an invalid number
  ***************************************************************************************************/
-void KEYPAD_WaitForKeyPress()
+uint8_t KEYPAD_KeyToAscii(uint8_t var_keyIndex_u8)
 {
-	uint8_t var_keyPress_u8;
-	do
+	if(var_keyIndex_u8 >= C_KeypadKeys_U8)
+		return 'z';
+	return A_KeyMap_U8[var_keyIndex_u8];
+}
+
+
+
+
+/***************************************************************************************************
+                   uint8_t KEYPAD_WaitForKeyRelease(uint16_t var_timeoutMs_u16)
+ ***************************************************************************************************
+ * I/P Arguments: uint16_t-->Time in ms to wait at most
+
+ * Return value	: uint8_t--> C_KeypadOk_U8 or C_KeypadTimeout_U8
+
+ * description  : This function waits till all keys are released (debounced).
+                  The wait is counted in polls of C_KeypadPollUs_U8 so it ends even if the scan
+                  tick has stopped.
+ ***************************************************************************************************/
+uint8_t KEYPAD_WaitForKeyRelease(uint16_t var_timeoutMs_u16)
+{
+	uint32_t var_polls_u32 = (uint32_t)var_timeoutMs_u16 * (1000 / C_KeypadPollUs_U8);
+
+	while(KEYPAD_GetKeyState() != 0)
 	{
-		do
+		// The debouncer is updated by KEYPAD_ScanTick()
+		if(var_polls_u32-- == 0)
 		{
-			M_ROW=0x0F;		  // Pull the ROW lines to low and Column lines high.
-			var_keyPress_u8=M_COL & 0x0F;	  // Read the Columns, to check the key press
-		}while(var_keyPress_u8==0x0F); // Wait till the Key is pressed,
-		// if a Key is pressed the corresponding Column line go low
+			v_keypadTimeouts_u16++;
+			return C_KeypadTimeout_U8;
+		}
+		DELAY_us(C_KeypadPollUs_U8);
+	}
+	return C_KeypadOk_U8;
+}
+
+
+
 
-		DELAY_ms(1);		  // Wait for some time(debounce Time);
 
-		M_ROW=0x0F;		  // After debounce time, perform the above operation
-		var_keyPress_u8=M_COL & 0x0F;	  // to ensure the Key press.
+/***************************************************************************************************
+                   uint8_t KEYPAD_WaitForKeyPress(uint16_t var_timeoutMs_u16)
+ ***************************************************************************************************
+ * I/P Arguments: uint16_t-->Time in ms to wait at most
+
+ * Return value	: uint8_t--> C_KeypadOk_U8 or C_KeypadTimeout_U8
 
-	}while(var_keyPress_u8==0x0F);
+ * description  : This function waits till a key is held down (debounced).
+                  The key can be decoded by the function KEYPAD_GetKey.
+ ***************************************************************************************************/
+uint8_t KEYPAD_WaitForKeyPress(uint16_t var_timeoutMs_u16)
+{
+	uint32_t var_polls_u32 = (uint32_t)var_timeoutMs_u16 * (1000 / C_KeypadPollUs_U8);
+
+	while(KEYPAD_GetKeyState() == 0)
+	{
+		// The debouncer is updated by KEYPAD_ScanTick()
+		if(var_polls_u32-- == 0)
+		{
+			v_keypadTimeouts_u16++;
+			return C_KeypadTimeout_U8;
+		}
+		DELAY_us(C_KeypadPollUs_U8);
+	}
+	return C_KeypadOk_U8;
 }
 
 
@@ -177,51 +304,62 @@ void KEYPAD_WaitForKeyPress()
 
 
 /***************************************************************************************************
-                   unsigned char KEYPAD_GetKey()
+                   uint8_t KEYPAD_GetKey(uint16_t var_timeoutMs_u16)
  ***************************************************************************************************
- * I/P Arguments:none
+ * I/P Arguments: uint16_t-->Time in ms to wait at most
 
- * Return value	: uint8_t--> ASCII value of the Key Pressed
+ * Return value	: uint8_t--> ASCII value of the Key Pressed, C_KeypadNoKey_U8 on timeout
 
- * description: This function waits till a key is pressed and returns its ASCII Value
-                It follows the following sequences to decode the key pressed:
-				1.Wait till the previous key is released..
-				2.Wait for the new key press.
-				3.Scan all the rows one at a time for the pressed key.
-				4.Decodes the key pressed depending on ROW-COL combination and returns its
-				  ASCII value.
+ * description: This function waits till a key press edge is reported by the debouncer and returns
+                its ASCII Value. Presses made while the caller was busy are returned in key order,
+                one per call.
  ***************************************************************************************************/
-uint8_t KEYPAD_GetKey()
+uint8_t KEYPAD_GetKey(uint16_t var_timeoutMs_u16)
 {
-	uint8_t var_keyPress_u8;
+	uint8_t var_keyIndex_u8, var_sreg_u8;
+	uint16_t var_keyMask_u16;
+	uint32_t var_polls_u32 = (uint32_t)var_timeoutMs_u16 * (1000 / C_KeypadPollUs_U8);
 
-	KEYPAD_WaitForKeyRelease();    // Wait for the previous key release
-	DELAY_ms(1);
-
-	KEYPAD_WaitForKeyPress();      // Wait for the new key press
-	var_keyPress_u8 = keypad_ScanKey();        // Scan for the key pressed.
+	while(1)
+	{
+		var_sreg_u8 = SREG;
+		cli();
+		var_keyMask_u16 = v_keyPressEdges_u16 & (~v_keyPressEdges_u16 + 1);  // Lowest pending key
+		v_keyPressEdges_u16 &= ~var_keyMask_u16;
+		SREG = var_sreg_u8;
+
+		if(var_keyMask_u16 != 0)
+			break;                       // New key press found
+		if(var_polls_u32-- == 0)
+		{
+			v_keypadTimeouts_u16++;
+			return C_KeypadNoKey_U8;
+		}
+		DELAY_us(C_KeypadPollUs_U8);
+	}
 
-	switch(var_keyPress_u8)                       // Decode the key
+	for(var_keyIndex_u8 = 0; (var_keyMask_u16 & 0x01) == 0; var_keyIndex_u8++)
 	{
-	case 0xe7: var_keyPress_u8='*'; break; 
-	case 0xeb: var_keyPress_u8='7'; break; 
-	case 0xed: var_keyPress_u8='4'; break; 
-	case 0xee: var_keyPress_u8='1'; break; 
-	case 0xd7: var_keyPress_u8='0'; break; 
-	case 0xdb: var_keyPress_u8='8'; break; 
-	case 0xdd: var_keyPress_u8='5'; break; 
-	case 0xde: var_keyPress_u8='2'; break; 
-	case 0xb7: var_keyPress_u8='#'; break; 
-	case 0xbb: var_keyPress_u8='9'; break; 
-	case 0xbd: var_keyPress_u8='6'; break; 
-	case 0xbe: var_keyPress_u8='3'; break; 
-	case 0x77: var_keyPress_u8='D'; break;  
-	case 0x7b: var_keyPress_u8='C'; break;  
-	case 0x7d: var_keyPress_u8='B'; break;  
-	case 0x7e: var_keyPress_u8='A'; break;  
-	default  : var_keyPress_u8='z'; break;
+		var_keyMask_u16 >>= 1;        // Find the key number from the bit position
 	}
-	return(var_keyPress_u8);                      // Return the key
+	return(A_KeyMap_U8[var_keyIndex_u8]);          // Return the key
+}
+
+
+
+
+/***************************************************************************************************
+                   uint16_t KEYPAD_GetTimeouts()
+ ***************************************************************************************************
+ * I/P Arguments:none
+
+ * Return value	: uint16_t--> Number of waits that ended without the key event
+
+ * description  : Counted by KEYPAD_WaitForKeyRelease, KEYPAD_WaitForKeyPress and KEYPAD_GetKey.
+ ***************************************************************************************************/
+uint16_t KEYPAD_GetTimeouts()
+{
+	return v_keypadTimeouts_u16;
 }
 
 
@@ -230,35 +368,56 @@ uint8_t KEYPAD_GetKey()
 
 
 /***************************************************************************************************
-                     static uint8_t keypad_ScanKey()
+                     static uint16_t keypad_ScanMatrix()
  ***************************************************************************************************
  * I/P Arguments:none
 
- * Return value	: uint8_t--> Scancode of the Key Pressed
+ * Return value	: uint16_t--> Raw state of all keys, bit n = key n, 1: pressed
 
- * description  : This function scans all the rows to decode the key pressed.
-        1.Each time a ROW line is pulled low to detect the KEY.
-        2.Column Lines are read to check the key press.
+ * description  : This function scans all the rows once.
+        1.Each time a ROW line is pulled low.
+        2.After a short settle time the Column lines are read.
         3.If any Key is pressed then corresponding Column Line goes low.
-
-        4.Return the ScanCode(Combination of ROW & COL) for decoding the key.
  ***************************************************************************************************/
-static uint8_t keypad_ScanKey()
+static uint16_t keypad_ScanMatrix()
 {
+	uint8_t var_keyScanCode_u8 = 0xEF, i;
+	uint16_t var_keys_u16 = 0;
 
-	uint8_t var_keyScanCode_u8 = 0xEF,i, var_keyPress_u8;
-
-	for(i=0;i<0x04;i++)                // Scan All the 4-Rows for key press
+	for(i=0;i<0x04;i++)                // Scan All the 4-Rows
 	{
-		M_ROW=var_keyScanCode_u8;        // Select 1-Row at a time for Scanning the Key
-		DELAY_ms(1);
-		var_keyPress_u8=M_COL & 0x0F;    // Read the Column, for key press
-
-		if(var_keyPress_u8!=0x0F)        // If the KEY press is detected for the selected
-			break;                     // ROW then stop Scanning,
+		M_ROW=var_keyScanCode_u8;        // Select 1-Row at a time
+		DELAY_us(C_RowSettleTimeUs_U8);
+		var_keys_u16 |= (uint16_t)(~M_COL & 0x0F) << (i * 4);   // Pressed keys pull the Column low
 
 		var_keyScanCode_u8=((var_keyScanCode_u8<<1)+0x01); // Rotate the ScanKey to SCAN the remaining Rows
 	}
-	var_keyPress_u8 = var_keyPress_u8 + (var_keyScanCode_u8 & 0xf0); // Return the row and COL status to decode the key
-	return(var_keyPress_u8);
+	M_ROW=0x0F;                        // Pull all the ROW lines low again
+	return(var_keys_u16);
+}
+
+
+
+
+
+
+/***************************************************************************************************
+                     static uint16_t keypad_FetchEdges(volatile uint16_t *ptr_edges_u16)
+ ***************************************************************************************************
+ * I/P Arguments: volatile uint16_t *--> Edge bitmap written by KEYPAD_ScanTick()
+
+ * Return value	: uint16_t--> Edges collected since the last fetch
+
+ * description  : Reads and clears the bitmap with interrupts disabled, so no edge is lost.
+ ***************************************************************************************************/
+static uint16_t keypad_FetchEdges(volatile uint16_t *ptr_edges_u16)
+{
+	uint16_t var_edges_u16;
+	uint8_t var_sreg_u8 = SREG;
+
+	cli();
+	var_edges_u16 = *ptr_edges_u16;
+	*ptr_edges_u16 = 0;
+	SREG = var_sreg_u8;
+	return(var_edges_u16);
 }
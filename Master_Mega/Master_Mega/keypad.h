@@ -37,6 +37,8 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
                              Revision History
  ****************************************************************************************************
 15.0: Initial version 
+15.1: Periodic matrix scan with vertical counter debouncing of all keys
+15.2: Timeouts for all the wait functions
  ***************************************************************************************************/
 #ifndef _KEYPAD_H
 #define _KEYPAD_H
@@ -57,13 +59,42 @@ Errors and omissions should be reported to codelibraries@exploreembedded.com
 
 
 
+/***************************************************************************************************
+                                 Debouncer Configuration
+ ***************************************************************************************************/
+#define C_KeypadKeys_U8 16            //Number of keys in the matrix
+#define C_KeypadScanTickMs_U8 2       //Period in ms at which KEYPAD_ScanTick() has to be called
+#define C_RowSettleTimeUs_U8 2        //Time for the Column lines to settle after selecting a ROW
+#define C_KeypadPollUs_U8 100         //Time between polls of the wait functions
+/**************************************************************************************************/
+
+
+
+
+/***************************************************************************************************
+                                 Return values of the wait functions
+ ***************************************************************************************************/
+#define C_KeypadOk_U8 0
+#define C_KeypadTimeout_U8 1
+#define C_KeypadNoKey_U8 0            //Returned by KEYPAD_GetKey() if no key was pressed in time
+/**************************************************************************************************/
+
+
+
+
 /***************************************************************************************************
                              Function Prototypes
  ***************************************************************************************************/
 void KEYPAD_Init();
-void KEYPAD_WaitForKeyRelease();
-void KEYPAD_WaitForKeyPress();
-uint8_t KEYPAD_GetKey();
+uint8_t KEYPAD_WaitForKeyRelease(uint16_t var_timeoutMs_u16);
+uint8_t KEYPAD_WaitForKeyPress(uint16_t var_timeoutMs_u16);
+uint8_t KEYPAD_GetKey(uint16_t var_timeoutMs_u16);
+uint16_t KEYPAD_GetTimeouts();
+void KEYPAD_ScanTick();
+uint16_t KEYPAD_GetPressEdges();
+uint16_t KEYPAD_GetReleaseEdges();
+uint16_t KEYPAD_GetKeyState();
+uint8_t KEYPAD_KeyToAscii(uint8_t var_keyIndex_u8);
 /**************************************************************************************************/
 
 #endif
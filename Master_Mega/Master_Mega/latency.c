@@ -0,0 +1,194 @@
+/*
+ * latency.c
+ *
+ * Created: 20/10/2026 00:24:17
+ * Author : Group 07
+ *
+ * Log-bucketed latency histograms. A sample only costs finding its highest bit,
+ * the histograms never grow and are printed with the bounds of the buckets.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include "latency.h"
+#include "fmt.h"
+#include "timebase.h"
+
+static const char g_path_names[LATENCY_PATHS][16] PROGMEM =
+{
+	"Motion",
+	"Key",
+	"Verdict",
+	"Siren",
+};
+
+static volatile uint32_t g_start_us[LATENCY_PATHS];
+static volatile uint8_t g_started = 0; // Paths with a start that has not been stopped
+static uint8_t g_waiting_frame = 0;
+static uint16_t g_buckets[LATENCY_PATHS][LATENCY_BUCKETS];
+static uint32_t g_max_us[LATENCY_PATHS];
+
+void
+latency_start(uint8_t path)
+{
+	g_start_us[path] = micros();
+	g_started |= (1 << path);
+}
+
+void
+latency_move(uint8_t from, uint8_t to)
+{
+	uint8_t sreg = SREG;
+	
+	cli();
+	if (g_started & (1 << from))
+	{
+		g_start_us[to] = g_start_us[from];
+		g_started = (g_started & ~(1 << from)) | (1 << to);
+	}
+	SREG = sreg;
+}
+
+// Bucket of a time: 0 under 128 us, then one more for each doubling
+static uint8_t
+bucket_of(uint32_t us)
+{
+	uint32_t scaled = us / LATENCY_FIRST_US;
+	uint8_t bucket = 0;
+	
+	while (scaled > 1 && bucket < LATENCY_BUCKETS - 1)
+	{
+		scaled >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+void
+latency_stop(uint8_t path)
+{
+	uint32_t now = micros();
+	uint32_t start, us;
+	uint16_t *count;
+	uint8_t sreg = SREG;
+	
+	cli();
+	if (!(g_started & (1 << path)))
+	{
+		SREG = sreg;
+		return;
+	}
+	start = g_start_us[path];
+	g_started &= ~(1 << path);
+	SREG = sreg;
+	
+	us = now - start;
+	count = &g_buckets[path][bucket_of(us)];
+	if (*count < UINT16_MAX)
+	{
+		(*count)++;
+	}
+	if (us > g_max_us[path])
+	{
+		g_max_us[path] = us;
+	}
+}
+
+void
+latency_frame(uint8_t path)
+{
+	g_waiting_frame |= (1 << path);
+}
+
+void
+latency_frames_sent(void)
+{
+	for (uint8_t path = 0; g_waiting_frame != 0; path++)
+	{
+		if (g_waiting_frame & (1 << path))
+		{
+			latency_stop(path);
+			g_waiting_frame &= ~(1 << path);
+		}
+	}
+}
+
+// Lowest bucket bound that the given share (in %) of the samples stays under
+static uint32_t
+bound_of_share(uint8_t path, uint32_t samples, uint8_t percent)
+{
+	uint32_t wanted = (samples * percent + 99) / 100;
+	uint32_t seen = 0;
+	uint8_t bucket;
+	
+	for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++)
+	{
+		seen += g_buckets[path][bucket];
+		if (seen >= wanted)
+		{
+			break;
+		}
+	}
+	return (uint32_t)LATENCY_FIRST_US << (bucket + 1);
+}
+
+void
+latency_print(void)
+{
+	uint32_t samples;
+	
+	for (uint8_t path = 0; path < LATENCY_PATHS; path++)
+	{
+		samples = 0;
+		for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+		{
+			samples += g_buckets[path][bucket];
+		}
+		fmt_printf_P(PSTR("%-8S %lu samples"), g_path_names[path], samples);
+		if (samples == 0)
+		{
+			fmt_print("\n\r");
+			continue;
+		}
+		fmt_print(", 50%% under %lu us, 95%% under %lu us, max %lu us\n\r", bound_of_share(path, samples, 50),
+			bound_of_share(path, samples, 95), g_max_us[path]);
+		for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+		{
+			if (g_buckets[path][bucket] == 0)
+			{
+				continue;
+			}
+			wdt_reset();
+			if (bucket == LATENCY_BUCKETS - 1)
+			{
+				fmt_print("  %8lu us and more: %u\n\r", (uint32_t)LATENCY_FIRST_US << bucket, g_buckets[path][bucket]);
+			}
+			else
+			{
+				fmt_print("  %8lu - %8lu us: %u\n\r", (bucket == 0) ? 0 : (uint32_t)LATENCY_FIRST_US << bucket,
+					(uint32_t)LATENCY_FIRST_US << (bucket + 1), g_buckets[path][bucket]);
+			}
+		}
+	}
+}
+
+void
+latency_reset(void)
+{
+	uint8_t sreg = SREG;
+	
+	cli();
+	for (uint8_t path = 0; path < LATENCY_PATHS; path++)
+	{
+		for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+		{
+			g_buckets[path][bucket] = 0;
+		}
+		g_max_us[path] = 0;
+	}
+	g_started = 0;
+	g_waiting_frame = 0;
+	SREG = sreg;
+}
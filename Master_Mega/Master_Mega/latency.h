@@ -0,0 +1,49 @@
+/*
+ * latency.h
+ *
+ * Created: 20/10/2026 00:24:17
+ * Author : Group 07
+ */
+
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+/*
+Histograms of the time from something the user does to the frame that shows it on the panel.
+The interrupts start a path with the time of the input, the main loop stops it when the frame
+has gone out. A path started again before it was stopped counts from the latest start, the frame
+shows the latest input. Only the first LATENCY_BUCKETS doublings are kept, about 160 bytes in all.
+*/
+#define LATENCY_MOTION 0 // Zone tripped --> "Motion" frame
+#define LATENCY_KEY 1 // Key pressed --> stars frame
+#define LATENCY_VERDICT 2 // OK pressed --> "Correct password" or "Try again" frame
+#define LATENCY_SIREN 3 // Last second of the entry delay --> buzzer frame
+#define LATENCY_PATHS 4
+
+#define LATENCY_BUCKETS 16 // Bucket 0 is under 128 us, each one after it twice as wide, the last one has no end
+#define LATENCY_FIRST_US 64
+
+// Called from the interrupts, or with interrupts disabled
+void latency_start(uint8_t path);
+
+// The time started on one path goes on another, e.g. the key that was OK goes on to the verdict
+void latency_move(uint8_t from, uint8_t to);
+
+// Counts the time since the start of the path, if it was started
+void latency_stop(uint8_t path);
+
+// The path is stopped by the next latency_frames_sent(), called once its frame has been collected
+void latency_frame(uint8_t path);
+
+// Stops the paths waiting for their frame, called when the screen has gone out
+void latency_frames_sent(void);
+
+// Prints the histogram of each path
+void latency_print(void);
+
+void latency_reset(void);
+
+#endif /* LATENCY_H_ */
@@ -14,9 +14,8 @@
 #define CHAR_ARRAY_SIZE 40
 #define PASSWORD "1234"
 #define PIN_REQUIRED_LEN 10 // The length of max len for our user input
-#define MOTION_SENSOR_PIN PD0 //pin D21 (PD0) from Arduino Mega for sensor (Interrupt pin for sensor to wake Arduino from sleep)
 #define REARM_TIME 5
-#define TRIGGER_TIME 15
+#define WATCHDOG_TIMEOUT WDTO_2S // The long reports feed the watchdog per line, at 9600 baud they take several seconds
 
 
 /*Keypad button definitions*/
@@ -25,12 +24,28 @@
 #define POWER_OFF_CHAR 'B'
 #define REARM_CHAR 'A'
 
-/*Definitions to switch cases*/
+/*States of the alarm, the rows of g_states*/
 #define WAIT_MOVEMENT 0
 #define MOTION_DETECTED 1
 #define KEYPAD_INPUT 2
+#define ALARM_TRIGGERED 3
 #define DEACTIVATE_TIMER 4
 #define REARM 5
+#define DISARMED 6
+#define ARMING 7
+#define SHUTDOWN 8
+#define STATE_COUNT 9
+
+/*Events of the state machine, made from the events in the queue by to_fsm_event()*/
+#define EV_MOTION 0 // Zone with an entry delay
+#define EV_TICK 1
+#define EV_TIMEOUT 2
+#define EV_KEY_OK 3
+#define EV_KEY_REARM 4
+#define EV_KEY_POWER_OFF 5
+#define EV_KEY_OTHER 6 // Digits, letters C and D and backspace
+#define EV_MOTION_INSTANT 7 // Zone that triggers the alarm at once
+#define EV_NONE 0xFF // Nothing to dispatch
 
 
 #include <avr/io.h>
@@ -42,19 +57,57 @@
 #include <stdbool.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
 #include "keypad.h"
+#include "event_queue.h"
+#include "state_machine.h"
+#include "spin_timeout.h"
+#include "power_manager.h"
+#include "zones.h"
+#include "timebase.h"
+#include "spi_bus.h"
+#include "display_cache.h"
+#include "uart_rx.h"
+#include "fmt.h"
+#include "mem_monitor.h"
+#include "profiler.h"
+#include "latency.h"
 
 /* 
-The state of Mega, used in the switch case structure. 
-Is initialized as waiting for movement.
+The state of Mega is kept by the state machine, see g_states and g_transitions.
+Only the main loop uses these, the interrupts post events to the event queue instead.
 */
-volatile int g_state = REARM; 
-volatile int g_timer_counter = 0;
+int g_timer_counter = 0;
+uint8_t g_entry_delay = 0; // Seconds from the motion to the alarm
+uint8_t g_event_zone = ZONE_NONE; // The zone of the motion event being handled
+uint8_t g_alarm_zone = ZONE_NONE; // The zone shown on the LCD
+uint8_t g_countdown = 0; // Seconds left before rearming
+char g_key; // The key of the event being handled
+char g_user_input[CHAR_ARRAY_SIZE] = "\0"; // The user input from keypad is appended to this char array
 char memory_variable[sizeof(PASSWORD)];
 
+// Timeout of the current state, kept by the Timer0 interrupt
+volatile uint16_t g_timeout_ticks = 0;
+uint8_t g_timeout_id = 0;
+
+// Commands for the LCD waiting to be sent in one frame by send_screen()
+spi_transaction_t g_screen;
+
+// Bridge mode: the host writes to the LCD of the panel, see host_line()
+bool g_bridge = false;
+uint16_t g_bridge_lines = 0;
+
+// For the statistics printed by print_fsm_stats()
+uint32_t g_bus_us[STATE_COUNT]; // Time SS has been low in each state
+const char g_state_names[STATE_COUNT][12] PROGMEM =
+{
+	"Waiting", "Motion", "Password", "Triggered", "Correct", "Arm?", "Disarmed", "Arming", "Shutdown"
+};
+
 /* USART_... Functions are for 
 communicating between the Arduino and the computer through the USB.
-Can be used by printf();. */
+Can be used by fmt_print();. */
 
 static void
 USART_Init( uint16_t ubrr)
@@ -66,79 +119,192 @@ USART_Init( uint16_t ubrr)
 	UCSR0B = (1<<RXEN0)|(1<<TXEN0);
 	/* Set frame format: 8data, 2stop bit */
 	UCSR0C = (1<<USBS0)|(3<<UCSZ00);
-
+	
 }
 
-static void
-USART_Transmit( unsigned char data, FILE *stream )
+// Waits until the transmit buffer is empty, returns SPIN_TIMEOUT if it did not get empty in time
+static uint8_t
+USART_Wait_Empty()
 {
-	/* Wait for empty transmit buffer */
+	uint16_t polls = SPIN_LIMIT_UART_US;
+	
 	while ( !( UCSR0A & (1<<UDRE0)) )
 	{
-		;// Doing nothing at all
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_UART);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
 	}
-	/* Put data into buffer, sends the data */
-	UDR0 = data;
+	return SPIN_OK;
+}
+
+static void
+USART_Transmit( unsigned char data, FILE *stream )
+{
+	/* Sends the data, it is dropped if the transmit buffer never gets empty. XON/XOFF to the host share the buffer. */
+	uart_tx_put(data);
 }
 
 static char
 USART_Receive( FILE *stream)
 {
 	/* Wait for empty transmit buffer */
-	while ( !( UCSR0A & (1<<UDRE0)) )
-	{
-		;// Doing nothing at all
-	}
+	USART_Wait_Empty();
 	/* Get and return received data from buffer */
 	return UDR0;
 }
 
+// Sends the commands in one frame, the time it takes is counted for the current state
+uint8_t
+send_frame(spi_transaction_t *frame)
+{
+	uint32_t bus_us = spi_bus_transfer_us();
+	uint8_t status;
+	
+	fmt_print("Command sent: %s\n\r", frame->commands);
+	
+	fsm_count_work();
+	status = spi_transaction_send(frame);
+	g_bus_us[fsm_state()] += spi_bus_transfer_us() - bus_us;
+	return status;
+}
+
+/*
+Sends the changes to the LCD of the Uno as one frame, nothing if the screen is already shown.
+Called after each event, so everything a transition shows changes the screen at once.
+*/
+uint8_t
+send_screen()
+{
+	bool done;
+	bool redrawn = false;
+	
+	do
+	{
+		// In bridge mode the LCD belongs to the host, the wanted screen is kept for later
+		done = g_bridge || display_cache_flush(&g_screen);
+		if (!spi_transaction_empty(&g_screen) && send_frame(&g_screen) != SPIN_OK)
+		{
+			// The Uno dropped the frame, it is not known what it shows now
+			display_cache_invalidate();
+			return SPIN_TIMEOUT;
+		}
+		if (spi_bus_slave_reset(SPI_DEVICE_PANEL) && !redrawn)
+		{
+			// The Uno has started again with an empty screen, all of it is sent again
+			display_cache_invalidate();
+			redrawn = true;
+			done = false;
+		}
+	} while (!done);
+	latency_frames_sent();
+	return SPIN_OK;
+}
+
 /*
-This function sends the command in the char array to the slave Uno to be executed using SPI.
+This function adds the command in the char array to the screen update of the Uno, see send_screen().
+Screen commands only change the model of the screen, the others are sent as they are.
+If the frame is full the screen collected so far is sent first.
 */
 void
 send_command_to_slave(char *command)
 {
-	char spi_data_to_send[CHAR_ARRAY_SIZE];
-	
-	strcpy(spi_data_to_send, command);
-	
-	printf("Command sent: %s\n\r", spi_data_to_send);
-	
-	PORTB &= ~(1 << PB0); // SS low --> enables slave device
+	if (display_cache_command(command))
+	{
+		return;
+	}
+	if (!spi_transaction_add(&g_screen, command))
+	{
+		send_screen();
+		spi_transaction_add(&g_screen, command);
+	}
+}
+
+/*
+Sends the command to a slave on the SPI bus at once, in a frame of its own.
+device is a row of the device table in spi_bus.h or SPI_BROADCAST for all of them.
+The screen collected before it is sent first so the Uno gets the commands in order.
+*/
+uint8_t
+send_command_to_device(uint8_t device, char *command)
+{
+	spi_transaction_t frame;
 	
-	//Sending the data to the slave
-	for (int8_t i = 0; i < CHAR_ARRAY_SIZE; i++)
+	send_screen();
+	spi_transaction_begin(&frame, device);
+	spi_transaction_add(&frame, command);
+	return send_frame(&frame);
+}
+
+// Turns the buzzers of all the slaves on or off, if they are not already
+void
+set_buzzers(bool on)
+{
+	if (!display_cache_buzzer(on))
+	{
+		return;
+	}
+	if (send_command_to_device(SPI_BROADCAST, on ? "1" : "2") != SPIN_OK)
+	{
+		display_cache_invalidate();
+		return;
+	}
+	if (on)
 	{
-		// Sending one byte at a time
-		SPDR = spi_data_to_send[i];
-		// Delays are added to prevent things happening too fast
-		_delay_us(10);
-		// Checking SPI status register if the transmit is complete
-		while (!(SPSR & (1 << SPIF))) {;}
-		_delay_us(10);
+		latency_stop(LATENCY_SIREN);
+	}
+}
+
+// Gives the LCD back to the state machine, the screen it wants is sent with the next send_screen()
+void
+bridge_end()
+{
+	if (g_bridge)
+	{
+		g_bridge = false;
+		display_cache_invalidate();
+		fmt_print("Bridge off\n\r");
 	}
-	PORTB |= (1 << PB0); // SS high --> disable slave device
 }
 
 FILE uart_output = FDEV_SETUP_STREAM(USART_Transmit, NULL, _FDEV_SETUP_WRITE);
 FILE uart_input = FDEV_SETUP_STREAM(NULL, USART_Receive, _FDEV_SETUP_READ);
 
+// Waits for the previous EEPROM write to end, returns SPIN_TIMEOUT if it did not end in time
+uint8_t
+eeprom_wait()
+{
+	uint16_t polls = SPIN_LIMIT_EEPROM_US;
+	
+	while(EECR & (1 << 1))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_EEPROM);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+	return SPIN_OK;
+}
 
 /*
-Compares the user input after OK is pressed to the stored password.
-If the passwords match the state is switched.
+Reads the stored password from EEPROM and compares it to the user input.
+The user input is cleared in both cases. If EEPROM cannot be read the password is not accepted.
 */
-void
+bool
 comparePassword(char *user_input)
 {
 	int compare_result;
 	//Receiving password from EEPROM
 	for (uint16_t address_index = 0; address_index < sizeof(memory_variable); address_index++)
 	{
-		while(EECR & (1 << 1))
+		if (eeprom_wait() != SPIN_OK)
 		{
-			/* wait for the previous write operation to end */
+			user_input[0] = '\0';
+			return false;
 		}
 		
 		EEAR  = address_index;
@@ -149,30 +315,10 @@ comparePassword(char *user_input)
 	
 	compare_result = strcmp(memory_variable, user_input);
 	
-	if(compare_result)
-	{
-		printf("Wrong password");
-		// Notify the user
-		send_command_to_slave("4");
-		send_command_to_slave("3>Try again:");
-		// Clearing the user input
-		user_input[0] = '\0';
-	}else
-	{
-		printf("Passwords match!\n\r");
-		//If password is correct, it stops the timer
-		// Disable timer (disable overflow comparison)
-		TIMSK3 &= ~(1<<TOIE3);
-		g_timer_counter = 0;
-		
-		send_command_to_slave("4");
-		send_command_to_slave("3>Correct password");
-		_delay_ms(100);
-		
-		// Clearing the user input
-		user_input[0] = '\0';
-		g_state = DEACTIVATE_TIMER;
-	}
+	// Clearing the user input
+	user_input[0] = '\0';
+	
+	return compare_result == 0;
 }
 
 // Appends a character to a character array
@@ -210,114 +356,673 @@ removeLastChar(char *user_input, int *user_input_len)
 	user_input[*user_input_len-1] = '\0';
 }
 
-// Reads the pressed key and appends it to the user input
+/*
+Posts EVENT_TIMEOUT after ms milliseconds, replacing the timeout set earlier.
+A timeout that is already in the queue is ignored since it has an older id.
+*/
 void
-getPassword(char *user_input){
+set_timeout(uint16_t ms)
+{
+	uint8_t sreg = SREG;
 	
-	char key_pressed;
-	int user_input_len;
+	cli();
+	g_timeout_id++;
+	g_timeout_ticks = ms / C_KeypadScanTickMs_U8;
+	SREG = sreg;
+}
+
+void
+cancel_timeout()
+{
+	set_timeout(0);
+}
+
+// Initializes and starts the 1s timer
+void start_timer()
+{
+	// Timer3 is powered only while the alarm is counting
+	power_timer3(true);
+	//Timer interrupt initialization
+	TCCR3B = 0; // Resetting it
+	TCCR3A = 0; // Normal operation mode for timer
+	TCNT3 = 0;
+	// // Where to calculate from. Source: https://oscarliang.com/arduino-timer-and-interrupt-tutorial/
+	TCNT3 = 3036; //65535 - (16 000 000/256);
+	TCCR3B |= power_timer_cs_62k5(); //set the pre-scalar as 256 (64 when the clock is slowed down)
+	//Starting the Timer (enable overflow comparison)
+	TIMSK3 |= (1<<TOIE3);
+}
+
+void stop_timer()
+{
+	// Disable timer (disable overflow comparison)
+	TIMSK3 &= ~(1<<TOIE3);
+	TCCR3B = 0;
+	power_timer3(false);
+	g_timer_counter = 0; // Resetting the seconds
+}
+
+/*##########################################  Entry and exit actions  ##########################################*/
+
+// Shows as many stars on the second row as there are characters in the user input
+void
+show_stars()
+{
+	int user_input_len = strlen(g_user_input);
 	/* This char array is used to store the string to be displayed on LCD's second row.
 	It will be appended with *. 
 	So it shows the user if they have pressed the key and how many characters they have inputted so far.*/
 	char stars_to_print_command[CHAR_ARRAY_SIZE] = "5>";
 	
-	// If there was user input left before alarm triggered, printing it to the user
-	user_input_len = strlen(user_input);
 	createUserInputString(stars_to_print_command, &user_input_len);
 	send_command_to_slave(stars_to_print_command);
-	_delay_ms(100);
-	
-	printf("Type password: ");
-	KEYPAD_Init();
-	key_pressed = KEYPAD_GetKey();
-	printf("%c\n\r", key_pressed);
+	latency_frame(LATENCY_KEY);
+}
+
+void
+enter_wait_movement()
+{
+	// Motion seen while disarmed is not wanted
+	zones_clear();
+	send_command_to_slave("4");
+	send_command_to_slave("3>I'm Waiting!!!");
+}
+
+void
+enter_motion_detected()
+{
+	char command_to_send[CHAR_ARRAY_SIZE];
 	
+	fmt_print("Motion Detected in zone %u\n\r", g_alarm_zone + 1);
+	send_command_to_slave("4");
+	strcpy(command_to_send, "3>Motion: ");
+	strcat_P(command_to_send, zone_name(g_alarm_zone));
+	send_command_to_slave(command_to_send);
+	latency_frame(LATENCY_MOTION);
+	fmt_sprint(command_to_send, sizeof(command_to_send), "5>Give pin in %us", g_entry_delay);
+	send_command_to_slave(command_to_send);
+	start_timer();
+	// Showing the message for 2s to the user
+	set_timeout(2000);
+}
+
+void
+enter_keypad_input()
+{
+	send_command_to_slave("4");
+	send_command_to_slave("3>Enter Password:");
+	// If there was user input left before alarm triggered, printing it to the user
+	show_stars();
+}
+
+void
+enter_alarm_triggered()
+{
+	char command_to_send[CHAR_ARRAY_SIZE] = "3>Alarm! ";
 	
+	stop_timer();
+	// The alarm is shown whatever the host was showing
+	bridge_end();
+	// Turning the buzzers on, the sirens too
+	set_buzzers(true);
+	// Informing the user which zone tripped
+	send_command_to_slave("4");
+	strcat_P(command_to_send, zone_name(g_alarm_zone));
+	send_command_to_slave(command_to_send);
+	set_timeout(5000);
+}
+
+void
+enter_deactivate_timer()
+{
+	fmt_print("Passwords match!\n\r");
+	//If password is correct, it stops the timer
+	stop_timer();
+	// Disabling the buzzers if they have been triggered
+	set_buzzers(false);
+	send_command_to_slave("4");
+	send_command_to_slave("3>Correct password");
+	latency_frame(LATENCY_VERDICT);
+	set_timeout(4000);
+}
+
+void
+enter_disarmed()
+{
+	send_command_to_slave("4");
+	send_command_to_slave("3>Alarm disarmed");
+	set_timeout(5000);
+}
+
+/*
+Prints how long each state has been active and how often each transition has been taken.
+About 2000 characters, more than the watchdog timeout at 9600 baud, so it is fed per line.
+*/
+void
+print_fsm_stats()
+{
+	uint32_t now = millis();
 	
-	if (key_pressed == OK_CHAR)
-	{
-		comparePassword(user_input);
-	} 
-	// Checks if backspace is pressed and that from empty string a character cannot be deleted.
-	else if ( (key_pressed == BACKSPACE_CHAR) && (user_input_len > 0) )
+	fmt_print("State            awake ms  entries  frames  bus us/entry  est. uA\n\r");
+	for (uint8_t state = 0; state < STATE_COUNT; state++)
 	{
-		removeLastChar(user_input, &user_input_len);
-		// Refreshing the LCD screen with correct amount of stars
-		user_input_len = strlen(user_input);
-		createUserInputString(stars_to_print_command, &user_input_len);
-		send_command_to_slave(stars_to_print_command);
-		_delay_ms(100);
-	} 
-	/* Appending to the user input only if the length of the password is not exceeded 
-	and that the backspace button is not considered part of the password.*/
-	else if ( (user_input_len <= PIN_REQUIRED_LEN) && (key_pressed != BACKSPACE_CHAR) )
+		uint16_t entries = fsm_entries(state);
+		
+		wdt_reset();
+		fmt_printf_P(PSTR("%-16S %8lu %8u %7u %13lu %8u\n\r"), g_state_names[state], fsm_time_in_state(state, now),
+			entries, fsm_work(state), entries ? g_bus_us[state] / entries : 0, power_estimated_ua(state));
+	}
+	for (uint8_t row = 0; row < fsm_transition_count(); row++)
 	{
-		appendCharToCharArray(user_input, key_pressed);
-		printf("Current user input: %s\n\r", user_input);
-		// Refreshing the LCD screen with correct amount of stars
-		user_input_len = strlen(user_input);
-		createUserInputString(stars_to_print_command, &user_input_len);
-		send_command_to_slave(stars_to_print_command);
-		_delay_ms(100);
+		if (fsm_transition_hits(row) != 0)
+		{
+			wdt_reset();
+			fmt_print("Transition %u taken %u times\n\r", row, fsm_transition_hits(row));
+		}
 	}
+	fmt_print("Events without a transition: %u\n\r", fsm_unhandled_events());
+	fmt_print("Frames per disarm: %u\n\r", fsm_entries(DEACTIVATE_TIMER) ? (fsm_work(MOTION_DETECTED) +
+		fsm_work(KEYPAD_INPUT) + fsm_work(DEACTIVATE_TIMER)) / fsm_entries(DEACTIVATE_TIMER) : 0);
+	wdt_reset();
+	zones_print_stats();
+	wdt_reset();
+	spi_bus_print_stats();
+	wdt_reset();
+	display_cache_print_stats();
+	wdt_reset();
+	uart_rx_print_stats();
+	wdt_reset();
+	mem_print_report();
+	wdt_reset();
+	fmt_print("Bridge lines: %u\n\r", g_bridge_lines);
+	spin_print_timeouts();
+	wdt_reset();
+	fmt_print("Keypad timeouts: %u\n\r", KEYPAD_GetTimeouts());
+	fmt_print("Events queued at most: %u, dropped: %u\n\r", event_queue_high_water(), event_queue_overflows());
+}
+
+// Time in each power mode and the work of the peripherals since the start, one line for tools/energy.py
+void
+print_energy()
+{
+	fmt_print("ENERGY mega tick_ms=%u active16=%lu active4=%lu idle16=%lu idle4=%lu", C_KeypadScanTickMs_U8,
+		power_mode_ticks(POWER_MODE_ACTIVE_16MHZ), power_mode_ticks(POWER_MODE_ACTIVE_4MHZ),
+		power_mode_ticks(POWER_MODE_IDLE_16MHZ), power_mode_ticks(POWER_MODE_IDLE_4MHZ));
+	fmt_print(" down_ms=%lu down_wakes=%u down_period_ms=%u spi_bytes=%lu spi_us=%lu uart_rx=%lu uart_tx=%lu\n\r",
+		power_down_periods() * POWER_DOWN_PERIOD_MS, power_down_wakes(), POWER_DOWN_PERIOD_MS, spi_bus_bytes(),
+		spi_bus_transfer_us(), uart_rx_bytes(), uart_tx_bytes());
 }
 
 /*
 Asks the user if they want to rearm the system.
-If rearm is selected there is REARM_TIME to leave the area before the system is detecting movement.
-If the shutdown is selected sleep mode for Uno and Mega is set to Power-down.
+Keys pressed before the question was shown have no transition in the earlier states, so they are ignored.
 */
 void
-askToRearm()
+enter_rearm()
 {
-	char key_pressed;
-	
 	// Informing the user by LCD
 	send_command_to_slave("4");
 	send_command_to_slave("3>Arm alarm?");
 	send_command_to_slave("5>A OK, B shutdown");
+}
+
+// Shows the seconds left before the system is detecting movement
+void
+show_countdown()
+{
+	char command_to_send[CHAR_ARRAY_SIZE] = "5>";
 	
-	// Getting user input
-	KEYPAD_Init();
-	key_pressed = KEYPAD_GetKey();
-	printf("%c\n\r", key_pressed);
+	command_to_send[2] = g_countdown + '0';
+	command_to_send[3] = 's';
+	send_command_to_slave(command_to_send);
+	set_timeout(1000);
+}
+
+// There is REARM_TIME to leave the area before the system is detecting movement
+void
+enter_arming()
+{
+	// Informing user of rearming using LCD
+	send_command_to_slave("4");
+	send_command_to_slave("3>Rearming in:");
+	g_countdown = REARM_TIME;
+	show_countdown();
+}
+
+void
+enter_shutdown()
+{
+	send_command_to_slave("3>Shutting down...");
+	set_timeout(2000);
+}
+
+/*##########################################  Transition actions  ##########################################*/
+
+// Adds the key to the user input or removes the last character if it was backspace
+bool
+store_key()
+{
+	int user_input_len = strlen(g_user_input);
+	
+	// Checks that from empty string a character cannot be deleted.
+	if (g_key == BACKSPACE_CHAR)
+	{
+		if (user_input_len > 0)
+		{
+			removeLastChar(g_user_input, &user_input_len);
+		}
+	}
+	// Appending to the user input only if the length of the password is not exceeded
+	else if (user_input_len <= PIN_REQUIRED_LEN)
+	{
+		appendCharToCharArray(g_user_input, g_key);
+		fmt_print("Current user input: %s\n\r", g_user_input);
+	}
+	return true;
+}
+
+// Stores the key and refreshes the LCD screen with correct amount of stars
+bool
+add_key()
+{
+	store_key();
+	show_stars();
+	return true;
+}
+
+// Only lets the transition happen if the password is correct
+bool
+check_password()
+{
+	// The OK key now waits for the verdict instead of stars
+	latency_move(LATENCY_KEY, LATENCY_VERDICT);
+	if (comparePassword(g_user_input))
+	{
+		return true;
+	}
+	
+	fmt_print("Wrong password\n\r");
+	// Notify the user
+	send_command_to_slave("4");
+	send_command_to_slave("3>Try again:");
+	latency_frame(LATENCY_VERDICT);
+	return false;
+}
+
+/*
+Counts the seconds after the movement.
+When the entry delay of the zone is reached the alarm is triggered.
+*/
+bool
+count_second()
+{
+	g_timer_counter++;
+	fmt_print("%d\n\r", g_timer_counter);
+	
+	return g_timer_counter >= g_entry_delay;
+}
+
+// The zone that tripped first is the one shown and its entry delay is used
+bool
+take_zone()
+{
+	g_alarm_zone = g_event_zone;
+	g_entry_delay = zone_entry_delay(g_event_zone);
+	return true;
+}
+
+// Another zone tripped during the entry delay, its own delay is used if it ends sooner
+bool
+shorten_entry_delay()
+{
+	uint8_t delay = zone_entry_delay(g_event_zone);
+	
+	fmt_print("Motion Detected in zone %u\n\r", g_event_zone + 1);
+	if (g_timer_counter + delay < g_entry_delay)
+	{
+		g_entry_delay = g_timer_counter + delay;
+	}
+	return true;
+}
+
+// Rearms once the countdown reaches zero
+bool
+count_down()
+{
+	g_countdown--;
+	if (g_countdown == 0)
+	{
+		return true;
+	}
+	show_countdown();
+	return false;
+}
+
+/*
+Sets Uno and Mega to Power-down.
+!Once here, there is no feature to wake the Mega other than the reset button!
+*/
+bool
+power_off()
+{
+	send_command_to_slave("4");
+	
+	// Setting all the slaves to Power-down, the frame that wakes them is lost
+	send_command_to_device(SPI_BROADCAST, "6");
+	display_cache_invalidate();
+	
+	// Setting the sleep mode for "Power-down" and enabling sleep mode
+	cli();
+	wdt_disable();
+	SMCR = (1 << SM1) | (1 << SE);
+	sleep_cpu();
+	return false;
+}
+
+/*##########################################  State machine tables  ##########################################*/
+
+const fsm_state_t g_states[STATE_COUNT] PROGMEM =
+{
+	// entry                    exit            power needs
+	{ enter_wait_movement,      NULL,           POWER_WAKE_MOTION },					// WAIT_MOVEMENT
+	{ enter_motion_detected,    cancel_timeout, POWER_WAKE_TIMERS },					// MOTION_DETECTED
+	{ enter_keypad_input,       NULL,           POWER_WAKE_TIMERS | POWER_CLOCK_SLOW },	// KEYPAD_INPUT
+	{ enter_alarm_triggered,    cancel_timeout, POWER_WAKE_TIMERS },					// ALARM_TRIGGERED
+	{ enter_deactivate_timer,   cancel_timeout, POWER_WAKE_TIMERS },					// DEACTIVATE_TIMER
+	{ enter_rearm,              NULL,           POWER_WAKE_TIMERS | POWER_CLOCK_SLOW },	// REARM
+	{ enter_disarmed,           cancel_timeout, POWER_WAKE_TIMERS },					// DISARMED
+	{ enter_arming,             cancel_timeout, POWER_WAKE_TIMERS },					// ARMING
+	{ enter_shutdown,           cancel_timeout, POWER_WAKE_TIMERS },					// SHUTDOWN
+};
+
+/*
+Searched from the top, the first row with the current state and the event is used.
+Keys pressed while a message is still shown go straight to the password input.
+*/
+const fsm_transition_t g_transitions[] PROGMEM =
+{
+	// state            event               action               next state
+	{ WAIT_MOVEMENT,    EV_MOTION,          take_zone,           MOTION_DETECTED },
+	{ WAIT_MOVEMENT,    EV_MOTION_INSTANT,  take_zone,           ALARM_TRIGGERED },
+	
+	{ MOTION_DETECTED,  EV_TIMEOUT,         NULL,                KEYPAD_INPUT },
+	{ MOTION_DETECTED,  EV_TICK,            count_second,        ALARM_TRIGGERED },
+	{ MOTION_DETECTED,  EV_MOTION,          shorten_entry_delay, FSM_INTERNAL },
+	{ MOTION_DETECTED,  EV_MOTION_INSTANT,  take_zone,           ALARM_TRIGGERED },
+	{ MOTION_DETECTED,  EV_KEY_OK,          check_password,      DEACTIVATE_TIMER },
+	{ MOTION_DETECTED,  EV_KEY_OTHER,       store_key,           KEYPAD_INPUT },
+	{ MOTION_DETECTED,  EV_KEY_REARM,       store_key,           KEYPAD_INPUT },
+	{ MOTION_DETECTED,  EV_KEY_POWER_OFF,   store_key,           KEYPAD_INPUT },
+	
+	{ KEYPAD_INPUT,     EV_KEY_OTHER,       add_key,             FSM_INTERNAL },
+	{ KEYPAD_INPUT,     EV_KEY_REARM,       add_key,             FSM_INTERNAL },
+	{ KEYPAD_INPUT,     EV_KEY_POWER_OFF,   add_key,             FSM_INTERNAL },
+	{ KEYPAD_INPUT,     EV_KEY_OK,          check_password,      DEACTIVATE_TIMER },
+	{ KEYPAD_INPUT,     EV_TICK,            count_second,        ALARM_TRIGGERED },
+	{ KEYPAD_INPUT,     EV_MOTION,          shorten_entry_delay, FSM_INTERNAL },
+	{ KEYPAD_INPUT,     EV_MOTION_INSTANT,  take_zone,           ALARM_TRIGGERED },
+	
+	{ ALARM_TRIGGERED,  EV_TIMEOUT,         NULL,                KEYPAD_INPUT },
+	{ ALARM_TRIGGERED,  EV_KEY_OK,          check_password,      DEACTIVATE_TIMER },
+	{ ALARM_TRIGGERED,  EV_KEY_OTHER,       store_key,           KEYPAD_INPUT },
+	{ ALARM_TRIGGERED,  EV_KEY_REARM,       store_key,           KEYPAD_INPUT },
+	{ ALARM_TRIGGERED,  EV_KEY_POWER_OFF,   store_key,           KEYPAD_INPUT },
+	
+	{ DEACTIVATE_TIMER, EV_TIMEOUT,         NULL,                DISARMED },
+	{ DISARMED,         EV_TIMEOUT,         NULL,                REARM },
+	
+	{ REARM,            EV_KEY_REARM,       NULL,                ARMING },
+	{ REARM,            EV_KEY_POWER_OFF,   NULL,                SHUTDOWN },
+	
+	{ ARMING,           EV_TIMEOUT,         count_down,          WAIT_MOVEMENT },
+	
+	{ SHUTDOWN,         EV_TIMEOUT,         power_off,           FSM_INTERNAL },
+};
+
+// The state machine and the power manager keep their counters in arrays of a fixed size
+_Static_assert(STATE_COUNT <= FSM_MAX_STATES, "more states than FSM_MAX_STATES");
+_Static_assert(STATE_COUNT <= POWER_MAX_STATES, "more states than POWER_MAX_STATES");
+_Static_assert(sizeof(g_transitions) / sizeof(g_transitions[0]) <= FSM_MAX_TRANSITIONS,
+	"more transitions than FSM_MAX_TRANSITIONS");
+
+/*############################################################################################################*/
+
+// Runs a console command, the line from the host without its "!"
+void
+console_command(char *command)
+{
+	if (strcmp_P(command, PSTR("bridge")) == 0)
+	{
+		g_bridge = true;
+		fmt_print("Bridge on\n\r");
+	}
+	else if (strcmp_P(command, PSTR("local")) == 0)
+	{
+		bridge_end();
+		send_screen();
+	}
+	else if (strcmp_P(command, PSTR("stats")) == 0)
+	{
+		print_fsm_stats();
+		// The panel prints its timing and link counters on its serial port
+		send_command_to_device(SPI_DEVICE_PANEL, "8");
+	}
+	else if (strcmp_P(command, PSTR("mem")) == 0)
+	{
+		mem_print_report();
+	}
+	else if (strcmp_P(command, PSTR("energy")) == 0)
+	{
+		print_energy();
+		// The panel prints its own line on its serial port
+		send_command_to_device(SPI_DEVICE_PANEL, "7");
+	}
+	else if (strcmp_P(command, PSTR("hist")) == 0)
+	{
+		latency_print();
+	}
+	else if (strcmp_P(command, PSTR("hist reset")) == 0)
+	{
+		latency_reset();
+		fmt_print("Histograms cleared\n\r");
+	}
+#if SPI_BUS_TRACE
+	else if (strcmp_P(command, PSTR("trace")) == 0)
+	{
+		spi_bus_print_trace();
+	}
+#endif
+#if PROFILER_ENABLE
+	else if (strcmp_P(command, PSTR("prof")) == 0)
+	{
+		profiler_dump();
+	}
+#endif
+	else
+	{
+		fmt_print("Unknown command: %s\n\r", command);
+	}
+}
+
+/*
+Checks that every command of a bridge frame is a screen or buzzer code, 1 to 5.
+The Uno does not know other codes and the host must not power off the panel or ask for its reports.
+*/
+bool
+bridge_codes_valid(const char *line)
+{
+	uint16_t code;
+	const char *end;
+	
+	while (true)
+	{
+		code = 0;
+		end = fmt_parse_u16(line, &code);
+		// An empty command is skipped by the Uno
+		if (end != line && (code < 1 || code > 5))
+		{
+			return false;
+		}
+		if (*end == '>')
+		{
+			end = strchr(end, ';');
+		}
+		if (end == NULL || *end == '\0')
+		{
+			return true;
+		}
+		if (*end != ';')
+		{
+			return false;
+		}
+		line = end + 1;
+	}
+}
+
+/*
+A line from the host. "!" starts a console command, any other line is a frame for the panel
+in bridge mode, e.g. "4;3>Door open;5>Hall armed". Each frame is answered with "ok" or "err"
+and the number of the line, the host uses that for its flow and to measure the latency.
+*/
+void
+host_line(char *line)
+{
+	uint8_t status;
+	
+	if (line[0] == '!')
+	{
+		console_command(&line[1]);
+		return;
+	}
+	if (!g_bridge)
+	{
+		fmt_print("Not in bridge mode, !bridge starts it\n\r");
+		return;
+	}
+	
+	g_bridge_lines++;
+	if (strlen(line) >= SPI_COMMAND_SIZE)
+	{
+		fmt_print("err %u too long\n\r", g_bridge_lines);
+		return;
+	}
+	if (!bridge_codes_valid(line))
+	{
+		fmt_print("err %u unknown command\n\r", g_bridge_lines);
+		return;
+	}
+	status = spi_bus_send(SPI_DEVICE_PANEL, line);
+	fmt_print("%s %u\n\r", (status == SPIN_OK) ? "ok" : "err", g_bridge_lines);
+}
+
+/*
+Power needs of the current state.
+Zones on INT4 and INT5 only see edges when the I/O clock runs, so then power-down cannot be used.
+USART0 stops in power-down too, so it is not used while the host is sending.
+*/
+uint8_t
+state_power_flags()
+{
+	uint8_t flags = fsm_state_attributes();
 	
-	// Check the selection
-	if (key_pressed == REARM_CHAR)
+	if ((flags & POWER_WAKE_MOTION) && zones_need_io_clock())
+	{
+		flags |= POWER_WAKE_TIMERS;
+	}
+	if (g_bridge || uart_rx_active())
+	{
+		flags |= POWER_WAKE_TIMERS;
+	}
+	return flags;
+}
+
+/*
+Sleeps until the next event comes from the interrupts, the power manager picks the sleep mode.
+In idle the keypad tick wakes the Mega every 2 ms, which keeps the watchdog fed.
+The watchdog is stopped for power-down since nothing runs then.
+*/
+void
+wait_for_event(event_t *event)
+{
+	while (!event_get(event))
+	{
+		wdt_reset();
+		// Checking the queue with interrupts disabled so an event cannot slip in before sleeping
+		cli();
+		if (event_queue_empty())
+		{
+			// The host may have started sending since the state was entered
+			uint8_t flags = state_power_flags();
+			bool power_down = !(flags & POWER_WAKE_TIMERS);
+			
+			power_set_state(fsm_state(), flags);
+			if (power_down)
+			{
+				wdt_disable();
+			}
+			power_sleep();
+			if (power_down)
+			{
+				wdt_enable(WATCHDOG_TIMEOUT);
+			}
+		}
+		sei();
+	}
+}
+
+// Turns an event from the queue into an event of the state machine
+uint8_t
+to_fsm_event(event_t *event)
+{
+	switch (event->type)
 	{
-		char command_to_send[CHAR_ARRAY_SIZE] = "5>";
+		case EVENT_MOTION:
+			// The zones are taken from the bitmap, one for each event
+			g_event_zone = zone_next();
+			if (g_event_zone == ZONE_NONE)
+			{
+				return EV_NONE;
+			}
+			return zone_is_instant(g_event_zone) ? EV_MOTION_INSTANT : EV_MOTION;
 		
-		// Informing user of rearming using LCD
-		send_command_to_slave("4");
-		send_command_to_slave("3>Rearming in:");
-		_delay_ms(100);
+		case EVENT_TICK:
+			return EV_TICK;
 		
-		for (int i = REARM_TIME; i > 0; i--)
+		case EVENT_SERIAL_LINE:
 		{
-			command_to_send[2] = i + '0';
-			command_to_send[3] = 's';
-			send_command_to_slave(command_to_send);
-			_delay_ms(1000);	
+			char line[UART_LINE_SIZE];
+			
+			// Not an event of the state machine, the lines are handled here
+			while (uart_rx_line(line))
+			{
+				host_line(line);
+			}
+			return EV_NONE;
 		}
-		g_state = WAIT_MOVEMENT;
 		
-	} else if (key_pressed == POWER_OFF_CHAR)
-	{
-		// Informing user of rearming using LCD
-		send_command_to_slave("3>Shutting down...");
-		_delay_ms(2000);
-		send_command_to_slave("4");
+		case EVENT_TIMEOUT:
+			// Timeouts of earlier states are not wanted anymore
+			return (event->arg == g_timeout_id) ? EV_TIMEOUT : EV_NONE;
 		
-		// Setting Uno to Power-down
-		send_command_to_slave("6");	
+		case EVENT_KEY:
+			g_key = event->arg;
+			fmt_print("Key pressed: %c\n\r", g_key);
+			if (g_key == OK_CHAR)
+			{
+				return EV_KEY_OK;
+			}
+			if (g_key == REARM_CHAR)
+			{
+				return EV_KEY_REARM;
+			}
+			if (g_key == POWER_OFF_CHAR)
+			{
+				return EV_KEY_POWER_OFF;
+			}
+			return EV_KEY_OTHER;
 		
-		// Setting the sleep mode for "Power-down"
-		SMCR |= (1 << SM1);
-		_delay_ms(100);
-		// Enabling sleep mode
-		SMCR |= (1 << SE);
-		sleep_cpu();
-		// !Once here, there is no feature to wake the Mega other than the reset button!
+		default:
+			return EV_NONE;
 	}
 }
 
@@ -325,34 +1030,52 @@ askToRearm()
 void 
 Interrupt_init()
 {
-		//Sensor interrupt - INT0 Pin 21
-		EICRA |= (1<<ISC01)|(1<<ISC00); //Set rising edge INT0
-		EIMSK |= (1<<INT0); //Enable INT0
-		
+		//Sensor interrupts of the zones, see zones.h for the pins
+		zones_init();
+	
 		// Enabling interrupts
 		sei();
 }
 
-// Initializes and starts the 1s timer
-void start_timer()
+// Starts the keypad scan on Timer0, the matrix is sampled every C_KeypadScanTickMs_U8 ms
+void start_keypad_scan()
 {
-	//Timer interrupt initialization
-	TCCR3B = 0; // Resetting it
-	TCCR3A = 0; // Normal operation mode for timer
-	TCNT3 = 0;
-	// // Where to calculate from. Source: https://oscarliang.com/arduino-timer-and-interrupt-tutorial/
-	TCNT3 = 3036; //65535 - (16 000 000/256);
-	TCCR3B |= (1 << CS32); //set the pre-scalar as 256
-	//Starting the Timer (enable overflow comparison)
-	TIMSK3 |= (1<<TOIE3);
+	TCCR0A = (1 << WGM01); // CTC mode
+	TCCR0B = power_timer_cs_62k5(); // pre-scaler 256 --> 62.5 kHz
+	OCR0A = (F_CPU / 256 / 1000) * C_KeypadScanTickMs_U8 - 1;
+	TIMSK0 |= (1 << OCIE0A);
 }
 
-// Triggered when sensor sees movement
-ISR(INT0_vect)
+/*
+Samples and debounces the keypad, each new key press is posted as an event.
+Also keeps the time and runs the timeout of the current state.
+*/
+ISR(TIMER0_COMPA_vect)
 {
-	if (g_state == WAIT_MOVEMENT){
-		printf("Motion Detected\n\r");
-		g_state = MOTION_DETECTED;
+	uint16_t pressed_keys;
+	
+	timebase_tick(C_KeypadScanTickMs_U8);
+	power_tick();
+	if (g_timeout_ticks != 0)
+	{
+		g_timeout_ticks--;
+		if (g_timeout_ticks == 0)
+		{
+			event_post(EVENT_TIMEOUT, g_timeout_id);
+		}
+	}
+	
+	KEYPAD_ScanTick();
+	pressed_keys = KEYPAD_GetPressEdges();
+	
+	for (uint8_t key = 0; pressed_keys != 0; key++)
+	{
+		if (pressed_keys & 1)
+		{
+			event_post(EVENT_KEY, KEYPAD_KeyToAscii(key));
+			latency_start(LATENCY_KEY);
+		}
+		pressed_keys >>= 1;
 	}
 }
 
@@ -361,54 +1084,42 @@ Run when overflow happens in timer, our case every second after movement in dete
 */
 ISR (TIMER3_OVF_vect)
 {
-	g_timer_counter++;
-	printf("%d\n\r", g_timer_counter);
-	
-	// Comparing the timer counter if the trigger time has been exceeded
-	if(g_timer_counter >= TRIGGER_TIME)
-	{
-		// Disable timer (disable overflow comparison)
-		TIMSK3 &= ~(1<<TOIE3);
-		g_timer_counter = 0; // Resetting the seconds
-		// Turning buzzer on
-		send_command_to_slave("1");
-		_delay_ms(100);
-		// Informing the user
-		send_command_to_slave("4");	
-		send_command_to_slave("3>Alarm triggered");
-		_delay_ms(5000);
-		
-		// Informing user that they can keep giving the password
-		send_command_to_slave("4");
-		send_command_to_slave("3>Enter Password:");
-	}
+	event_post(EVENT_TICK, 0);
+	// The tick that ends the entry delay is the one that turns the buzzers on
+	latency_start(LATENCY_SIREN);
 }
 
 int main(void)
 {
+	// After a watchdog reset the watchdog stays on with the shortest timeout, turning it off first
+	uint8_t reset_flags = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+	
     // Initializing the USART
 	USART_Init(MYUBRR);
 	stdout = &uart_output;
 	stdin = &uart_input;
+	// Lines from the host are received in the background
+	uart_rx_init();
 	
-	// Setting input from motion sensor
-	DDRD &= (0 << MOTION_SENSOR_PIN);
-		
-	// Setting SS, MOSI and SCL as outputs
-	DDRB |= (1 << PB0) | (1 << PB1) | (1 << PB2);
+	if (reset_flags & (1 << WDRF))
+	{
+		fmt_print("Reset by the watchdog\n\r");
+	}
 	
-	// Set the SPI on and make the mega master
-	SPCR |= (1 << SPE) | (1 << MSTR);
+	// Unused modules are turned off
+	power_init();
 	
-	// Set SPI clock to 1 MHz
-	SPCR |= (1 << SPR0);
+	// SS pins of the slaves and the SPI as master
+	spi_bus_init();
 	
 	//Saving the password to EEPROM
 	for (uint16_t address_index = 0; address_index < sizeof(PASSWORD); address_index++)
 	{
-		while(EECR & (1 << 1))
+		if (eeprom_wait() != SPIN_OK)
 		{
-			/* wait for the previous write operation to end */
+			break;
 		}
 		EEAR = address_index;
 		EEDR = PASSWORD[address_index];
@@ -416,73 +1127,53 @@ int main(void)
 		EECR |= (1 << 1);
 	}
 	
+	// Keypad is scanned in the background
+	KEYPAD_Init();
+	start_keypad_scan();
+	
 	// Enable interrupts
 	Interrupt_init();
 	
+	// Fastest SPI clock the panel receives without errors
+	spi_bus_self_test();
 	
-	// The user input from keypad is appended to this char array
-	char user_input[CHAR_ARRAY_SIZE] = "\0";
+#if SPI_BUS_BENCHMARK
+	// Needs the keypad tick for the time, done before the watchdog is on
+	spi_bus_benchmark();
+#endif
+	
+	// Last resort if a wait is stuck, every loop below takes well under WATCHDOG_TIMEOUT
+	wdt_enable(WATCHDOG_TIMEOUT);
+	
+#if PROFILER_ENABLE
+	// Only the main loop is profiled, "!prof" prints the samples and starts again
+	profiler_start();
+#endif
+	
+	// The system starts by asking if the alarm should be armed
+	spi_transaction_begin(&g_screen, SPI_DEVICE_PANEL);
+	fsm_init(g_transitions, sizeof(g_transitions) / sizeof(g_transitions[0]), g_states, REARM, millis());
+	send_screen();
+	power_set_state(fsm_state(), state_power_flags());
+	
+	event_t event;
 	
     while (1) 
     {	
-		switch(g_state)
+		wdt_reset();
+		mem_check_guard();
+		wait_for_event(&event);
+#if SPI_BUS_TRACE
+		spi_bus_trace_cause();
+#endif
+		
+		uint8_t fsm_event = to_fsm_event(&event);
+		if (fsm_event != EV_NONE)
 		{
-			case WAIT_MOVEMENT:
-				// Updating LCD
-				send_command_to_slave("4");
-				send_command_to_slave("3>I'm Waiting!!!");
-				
-				// Power down until interrupt comes from motion sensor
-				// Setting the sleep mode for "Power-down"
-				SMCR |= (1 << SM1);
-				_delay_ms(100);
-				// Enabling sleep mode
-				SMCR |= (1 << SE);
-				sleep_cpu();
-				break;
-				
-			case MOTION_DETECTED:
-				// Movement detected --> sending message to lcd
-				send_command_to_slave("4");
-				send_command_to_slave("3>Motion Detected!");
-				_delay_ms(100);
-				send_command_to_slave("5>Give pin in 15s");
-				start_timer();
-				// Showing the message for 2s to the user
-				_delay_ms(2000);
-				send_command_to_slave("4");
-				send_command_to_slave("3>Enter Password:");
-				_delay_ms(100);
-								
-				//Switching state to receive the password
-				g_state = KEYPAD_INPUT;
-				break;
-				
-			case KEYPAD_INPUT:
-				getPassword(user_input);
-				break;
-				
-				
-			case DEACTIVATE_TIMER:
-				
-				// Disabling buzzer if it has been triggered
-				send_command_to_slave("2");
-				_delay_ms(4000);
-				// Sending message to user 
-				send_command_to_slave("4");
-				send_command_to_slave("3>Alarm disarmed");
-				
-				_delay_ms(5000);
-				g_state = REARM;
-				break;
-				
-			case REARM:
-				askToRearm();
-				break;
-				
-			default:
-				printf("Unknown state\n\r");
-				break;
+			fsm_dispatch(fsm_event, millis());
+			send_screen();
+			// The clock of the new state is set after its entry action has sent the screen
+			power_set_state(fsm_state(), state_power_flags());
 		}
     }
 }
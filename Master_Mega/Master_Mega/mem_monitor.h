@@ -0,0 +1,47 @@
+/*
+ * mem_monitor.h
+ *
+ * Created: 19/10/2026 23:02:36
+ * Author : Group 07
+ */
+
+
+#ifndef MEM_MONITOR_H_
+#define MEM_MONITOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+SRAM use of the stack, the same copy is in both projects.
+Before main() the free SRAM between the data (.data and .bss) and the top of the stack is
+painted with MEM_PAINT. The stack overwrites the paint as it grows, so the painted bytes
+left show how deep it has ever been. malloc() is not used, the heap would start at __heap_start.
+The lowest MEM_GUARD_SIZE bytes are a guard: if they are not painted anymore the stack
+has run into the data.
+*/
+#define MEM_PAINT 0xC5
+#define MEM_GUARD_SIZE 16
+
+// Bytes the stack can grow to before it reaches the guard
+uint16_t mem_stack_size(void);
+
+// Most bytes the stack has used since the start
+uint16_t mem_stack_high_water(void);
+
+// Bytes between the stack pointer and the guard right now
+uint16_t mem_free_now(void);
+
+// True if the high water mark is deeper than when this was last asked
+bool mem_high_water_grown(void);
+
+/*
+Checks the guard. If the stack has reached it the data may be corrupted already,
+the reason is printed and the watchdog resets the board.
+*/
+void mem_check_guard(void);
+
+// Prints the sizes of the data and the stack and how much of the stack has been used
+void mem_print_report(void);
+
+#endif /* MEM_MONITOR_H_ */
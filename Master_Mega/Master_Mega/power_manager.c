@@ -0,0 +1,270 @@
+/*
+ * power_manager.c
+ *
+ * Created: 19/10/2026 15:02:44
+ * Author : Group 07
+ *
+ * Turns off what the current state does not need: unused modules through PRR0/PRR1,
+ * CPU speed while waiting for the user and the clocks during sleep.
+ */
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#include <avr/io.h>
+#include <avr/power.h>
+#include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "power_manager.h"
+#include "spin_timeout.h"
+#include "spi_bus.h"
+
+#define BAUD_RATE 9600
+
+static uint8_t g_state = 0;
+static uint8_t g_flags = POWER_WAKE_TIMERS;
+static bool g_slow = false;
+static volatile bool g_sleeping = false;
+
+// Keypad ticks (2 ms) sampled in each state
+static volatile uint32_t g_awake_ticks[POWER_MAX_STATES];
+static volatile uint32_t g_sleep_ticks[POWER_MAX_STATES];
+static uint8_t g_state_flags[POWER_MAX_STATES];
+
+// Energy accounting, whatever the state
+static volatile uint32_t g_mode_ticks[POWER_MODES];
+static volatile uint32_t g_down_periods = 0;
+static volatile bool g_watchdog_woke = false;
+static uint16_t g_down_wakes = 0;
+
+void
+power_init(void)
+{
+	// Used: Timer0 (keypad), SPI (Uno), USART0 (debug). Timer3 only while the alarm counts.
+	PRR0 = (1 << PRTWI) | (1 << PRTIM2) | (1 << PRTIM1) | (1 << PRADC);
+	PRR1 = (1 << PRTIM5) | (1 << PRTIM4) | (1 << PRTIM3) | (1 << PRUSART3) | (1 << PRUSART2) | (1 << PRUSART1);
+	ACSR = (1 << ACD);
+}
+
+void
+power_timer3(bool on)
+{
+	if (on)
+	{
+		PRR1 &= ~(1 << PRTIM3);
+	}
+	else
+	{
+		PRR1 |= (1 << PRTIM3);
+	}
+}
+
+uint8_t
+power_timer_cs_62k5(void)
+{
+	return g_slow ? ((1 << CS01) | (1 << CS00)) : (1 << CS02); // Pre-scaler 64 or 256
+}
+
+// Waits until the last character has left USART0, cutting the clock would corrupt it
+static void
+wait_uart_done(void)
+{
+	uint16_t polls = SPIN_LIMIT_UART_US;
+	
+	while (!(UCSR0A & (1 << UDRE0)) || !(UCSR0A & (1 << TXC0)))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_UART);
+			return;
+		}
+		_delay_us(1);
+	}
+}
+
+// Changes the CPU clock and everything that depends on it
+static void
+set_clock(bool slow)
+{
+	uint8_t sreg = SREG;
+	uint16_t ubrr = ((F_CPU / (slow ? POWER_SLOW_DIV : 1)) / 16 / BAUD_RATE) - 1;
+	
+	wait_uart_done();
+	
+	cli();
+	clock_prescale_set(slow ? clock_div_4 : clock_div_1);
+	g_slow = slow;
+	
+	UBRR0H = (unsigned char)(ubrr >> 8);
+	UBRR0L = (unsigned char)ubrr;
+	// SPI keeps its clock as far as the dividers go
+	spi_bus_cpu_clock_changed(slow);
+	// Only the running timers are given the new pre-scaler
+	if (TCCR0B & 0x07)
+	{
+		TCCR0B = (TCCR0B & ~0x07) | power_timer_cs_62k5();
+	}
+	if (TCCR3B & 0x07)
+	{
+		TCCR3B = (TCCR3B & ~0x07) | power_timer_cs_62k5();
+	}
+	if (TCCR1B & 0x07)
+	{
+		TCCR1B = (TCCR1B & ~0x07) | power_timer_cs_62k5(); // The profiler
+	}
+	SREG = sreg;
+}
+
+void
+power_set_state(uint8_t state, uint8_t flags)
+{
+	bool slow = (flags & POWER_CLOCK_SLOW) != 0;
+	
+	g_state = state;
+	g_flags = flags;
+	g_state_flags[state] = flags;
+	
+	if (slow != g_slow)
+	{
+		set_clock(slow);
+	}
+}
+
+void
+power_sleep(void)
+{
+	bool power_down = !(g_flags & POWER_WAKE_TIMERS);
+	
+	if (!power_down)
+	{
+		SMCR = (1 << SE); // Idle, the timers keep running
+	}
+	else
+	{
+		// Power-down, only the external interrupts wake up. The UART would be cut mid character.
+		wait_uart_done();
+		SMCR = (1 << SM1) | (1 << SE);
+		
+		// The caller has stopped the watchdog, here it only interrupts to count the time
+		g_watchdog_woke = false;
+		wdt_reset();
+		WDTCSR = (1 << WDCE) | (1 << WDE);
+		WDTCSR = (1 << WDIE) | (1 << WDP2) | (1 << WDP1); // 1 s
+	}
+	
+	g_sleeping = true;
+	sei();
+	sleep_cpu(); // Runs before any interrupt since sei() delays them by one instruction
+	g_sleeping = false;
+	SMCR = 0;
+	
+	if (power_down)
+	{
+		wdt_disable();
+		if (!g_watchdog_woke)
+		{
+			g_down_wakes++;
+		}
+	}
+}
+
+void
+power_idle(void)
+{
+	SMCR = (1 << SE);
+	g_sleeping = true;
+	sei();
+	sleep_cpu();
+	g_sleeping = false;
+	SMCR = 0;
+}
+
+// Only enabled during power-down
+ISR(WDT_vect)
+{
+	g_down_periods++;
+	g_watchdog_woke = true;
+}
+
+void
+power_tick(void)
+{
+	if (g_sleeping)
+	{
+		g_sleep_ticks[g_state]++;
+	}
+	else
+	{
+		g_awake_ticks[g_state]++;
+	}
+	g_mode_ticks[(g_sleeping ? POWER_MODE_IDLE_16MHZ : POWER_MODE_ACTIVE_16MHZ) + (g_slow ? 1 : 0)]++;
+}
+
+uint32_t
+power_mode_ticks(uint8_t mode)
+{
+	uint32_t ticks;
+	uint8_t sreg = SREG;
+	
+	cli();
+	ticks = g_mode_ticks[mode];
+	SREG = sreg;
+	return ticks;
+}
+
+uint32_t
+power_down_periods(void)
+{
+	uint32_t periods;
+	uint8_t sreg = SREG;
+	
+	cli();
+	periods = g_down_periods;
+	SREG = sreg;
+	return periods;
+}
+
+uint16_t
+power_down_wakes(void)
+{
+	return g_down_wakes;
+}
+
+uint16_t
+power_estimated_ua(uint8_t state)
+{
+	uint32_t awake, sleeping;
+	uint8_t flags = g_state_flags[state];
+	bool slow = (flags & POWER_CLOCK_SLOW) != 0;
+	uint32_t active_ua = slow ? POWER_ACTIVE_4MHZ_UA : POWER_ACTIVE_16MHZ_UA;
+	uint32_t sleep_ua;
+	
+	uint8_t sreg = SREG;
+	
+	// The counters are written by the Timer0 interrupt
+	cli();
+	awake = g_awake_ticks[state];
+	sleeping = g_sleep_ticks[state];
+	SREG = sreg;
+	
+	if (!(flags & POWER_WAKE_TIMERS))
+	{
+		return POWER_DOWN_UA;
+	}
+	if (awake + sleeping == 0)
+	{
+		return 0;
+	}
+	// Keeping the products below 2^32
+	while (awake + sleeping > 0xFFFF)
+	{
+		awake >>= 1;
+		sleeping >>= 1;
+	}
+	
+	sleep_ua = slow ? POWER_IDLE_4MHZ_UA : POWER_IDLE_16MHZ_UA;
+	return (awake * active_ua + sleeping * sleep_ua) / (awake + sleeping);
+}
@@ -0,0 +1,91 @@
+/*
+ * power_manager.h
+ *
+ * Created: 19/10/2026 15:02:44
+ * Author : Group 07
+ */
+
+
+#ifndef POWER_MANAGER_H_
+#define POWER_MANAGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define POWER_MAX_STATES 12
+
+/*
+Power needs of a state, used as the state attributes of the state machine.
+The sleep mode is the deepest one all the wake sources work in.
+*/
+#define POWER_WAKE_MOTION 0x01 // Motion sensor zones, INT0-1 and PCINT work in every sleep mode
+#define POWER_WAKE_TIMERS 0x02 // Keypad tick on Timer0 and alarm timer on Timer3, need the I/O clock (idle)
+#define POWER_CLOCK_SLOW 0x04 // Waiting for the user, the CPU clock is divided by POWER_SLOW_DIV
+
+#define POWER_SLOW_DIV 4 // Timer pre-scalers 256 and 64 give the same timer clock at 16 and 4 MHz
+
+/*
+Estimated supply current of the ATmega2560 in uA, typical values from the datasheet at 5 V.
+The rest of the board (USB chip, regulator, LED) is not included.
+*/
+#define POWER_ACTIVE_16MHZ_UA 20000
+#define POWER_IDLE_16MHZ_UA 7500
+#define POWER_ACTIVE_4MHZ_UA 6000
+#define POWER_IDLE_4MHZ_UA 2000
+#define POWER_DOWN_UA 10 // The watchdog runs to count the time in power-down
+
+/*Power modes the time is counted in for the energy estimate of tools/energy.py*/
+#define POWER_MODE_ACTIVE_16MHZ 0
+#define POWER_MODE_ACTIVE_4MHZ 1
+#define POWER_MODE_IDLE_16MHZ 2
+#define POWER_MODE_IDLE_4MHZ 3
+#define POWER_MODES 4
+#define POWER_DOWN_PERIOD_MS 1000 // Watchdog interrupt counting the time in power-down, about 10 % accurate
+
+// Gates the modules that are never used and turns off the analog comparator
+void power_init(void);
+
+/*
+Switches to the clock of the new state. The clock dependent settings follow:
+UART baud rate, SPI clock and the pre-scalers of Timer0 and Timer3.
+*/
+void power_set_state(uint8_t state, uint8_t flags);
+
+// Clock select bits for a 62.5 kHz timer clock (Timer0 and Timer3) at the current CPU clock
+uint8_t power_timer_cs_62k5(void);
+
+// Powers the alarm timer (Timer3) on and off
+void power_timer3(bool on);
+
+/*
+Sleeps in the deepest mode the wake sources of the current state allow.
+Called with interrupts disabled after checking there is nothing to do, returns with them enabled.
+*/
+void power_sleep(void);
+
+/*
+Sleeps in idle until the next interrupt, whatever the state allows. For short waits on the timers.
+Called with interrupts disabled, returns with them enabled.
+*/
+void power_idle(void);
+
+// Called from the Timer0 interrupt, samples if the CPU was sleeping
+void power_tick(void);
+
+// Keypad ticks sampled in the power mode since the start
+uint32_t power_mode_ticks(uint8_t mode);
+
+/*
+Watchdog periods spent in power-down. A power-down ended by something else than the watchdog
+is counted as a wake up, the part of the period it slept is not known.
+*/
+uint32_t power_down_periods(void);
+uint16_t power_down_wakes(void);
+
+/*
+Estimated average current of the state in uA from the sampled awake and sleeping time.
+Power-down stops Timer0, so a power-down state is assumed to sleep all the time it is not sampled.
+*/
+uint16_t power_estimated_ua(uint8_t state);
+
+#endif /* POWER_MANAGER_H_ */
@@ -0,0 +1,207 @@
+/*
+ * profiler.c
+ *
+ * Created: 19/10/2026 23:41:09
+ * Author : Group 07
+ *
+ * Samples the program counter of the interrupted code and counts the addresses in a hash table.
+ */
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include "profiler.h"
+
+#if PROFILER_ENABLE
+
+#include "fmt.h"
+
+#define STRINGIFY(name) #name
+#define VECTOR_NAME(vector) STRINGIFY(vector)
+
+#if defined(__AVR_ATmega2560__)
+#include "power_manager.h"
+#define SAMPLE_vect TIMER1_COMPA_vect // Fires at PROFILE_HZ
+#define COUNT_vect TIMER1_COMPB_vect // Never enabled, the sample jumps to it
+#define SAMPLE_OCR ((62500 / PROFILE_HZ) - 1) // Timer1 counts at 62.5 kHz on both CPU clocks
+#define SAMPLE_RATE (62500 / (SAMPLE_OCR + 1))
+#else
+#define SAMPLE_vect TIMER0_COMPB_vect
+#define COUNT_vect TIMER0_COMPA_vect
+#define SAMPLE_STEP (F_CPU / 1024 / PROFILE_HZ) // Timer0 counts with pre-scaler 1024
+#define SAMPLE_RATE (F_CPU / 1024 / SAMPLE_STEP)
+#endif
+
+#define PROBES 8 // Slots tried before a sample is given up
+
+typedef struct
+{
+	uint16_t key; // Program counter >> PROFILE_PC_SHIFT
+	uint16_t count; // 0 if the slot is free
+} profile_slot_t;
+
+static profile_slot_t g_slots[PROFILE_SLOTS];
+static volatile uint16_t g_samples = 0;
+static volatile uint16_t g_idle = 0; // Samples taken while sleeping
+static volatile uint16_t g_lost = 0; // Samples not counted, their slots were taken
+static volatile uint32_t g_sample_pc; // Word address of the interrupted instruction
+
+/*
+The return address is only on top of the stack before any register is pushed, the prologue of
+a C function would hide it. This stub reads it using r0 and Z only, puts them back and jumps to
+the C handler of a vector that is never enabled, which then runs as if it was the interrupt.
+None of the instructions change SREG. The return address is stored high byte first.
+*/
+ISR(SAMPLE_vect, ISR_NAKED)
+{
+	__asm volatile (
+		"	push r0\n"
+		"	push r30\n"
+		"	push r31\n"
+		"	in r30, __SP_L__\n"
+		"	in r31, __SP_H__\n"
+#if defined(__AVR_3_BYTE_PC__)
+		"	ldd r0, Z+4\n"
+		"	sts %[pc]+2, r0\n"
+		"	ldd r0, Z+5\n"
+		"	sts %[pc]+1, r0\n"
+		"	ldd r0, Z+6\n"
+		"	sts %[pc], r0\n"
+#else
+		"	ldd r0, Z+4\n"
+		"	sts %[pc]+1, r0\n"
+		"	ldd r0, Z+5\n"
+		"	sts %[pc], r0\n"
+#endif
+		"	pop r31\n"
+		"	pop r30\n"
+		"	pop r0\n"
+		"	jmp " VECTOR_NAME(COUNT_vect) "\n"
+		:
+		: [pc] "i" (&g_sample_pc)
+	);
+}
+
+ISR(COUNT_vect)
+{
+	uint16_t key = (uint16_t)(g_sample_pc >> PROFILE_PC_SHIFT);
+	uint8_t index = (uint8_t)(key ^ (key >> 7)) & (PROFILE_SLOTS - 1);
+	
+#if !defined(__AVR_ATmega2560__)
+	OCR0B += SAMPLE_STEP;
+#endif
+	// Full, the counts stop so that they still add up
+	if (g_samples == UINT16_MAX)
+	{
+		return;
+	}
+	g_samples++;
+	if (SMCR & (1 << SE))
+	{
+		g_idle++;
+	}
+	
+	for (uint8_t probe = 0; probe < PROBES; probe++)
+	{
+		profile_slot_t *slot = &g_slots[index];
+		
+		if (slot->count == 0)
+		{
+			slot->key = key;
+		}
+		if (slot->key == key)
+		{
+			slot->count++;
+			return;
+		}
+		index = (index + 1) & (PROFILE_SLOTS - 1);
+	}
+	g_lost++;
+}
+
+static void
+sampling(bool on)
+{
+#if defined(__AVR_ATmega2560__)
+	TIMSK1 = on ? (1 << OCIE1A) : 0;
+#else
+	if (on)
+	{
+		OCR0B = TCNT0 + SAMPLE_STEP;
+		TIFR0 = (1 << OCF0B);
+		TIMSK0 |= (1 << OCIE0B);
+	}
+	else
+	{
+		TIMSK0 &= ~(1 << OCIE0B);
+	}
+#endif
+}
+
+static void
+clear(void)
+{
+	for (uint8_t i = 0; i < PROFILE_SLOTS; i++)
+	{
+		g_slots[i].count = 0;
+	}
+	g_samples = 0;
+	g_idle = 0;
+	g_lost = 0;
+}
+
+void
+profiler_start(void)
+{
+	clear();
+#if defined(__AVR_ATmega2560__)
+	// The power manager turns Timer1 off and changes its pre-scaler with the CPU clock
+	PRR0 &= ~(1 << PRTIM1);
+	TCCR1A = 0;
+	TCNT1 = 0;
+	OCR1A = SAMPLE_OCR;
+	TCCR1B = (1 << WGM12) | power_timer_cs_62k5();
+#endif
+	sampling(true);
+}
+
+void
+profiler_dump(void)
+{
+	// Printing takes longer than the table would stay the same
+	sampling(false);
+	
+	fmt_print("PROFILE begin hz=%u shift=%u samples=%u idle=%u lost=%u\n\r", (uint16_t)SAMPLE_RATE,
+		PROFILE_PC_SHIFT, g_samples, g_idle, g_lost);
+	for (uint8_t i = 0; i < PROFILE_SLOTS; i++)
+	{
+		if (g_slots[i].count != 0)
+		{
+			fmt_print("%x %u\n\r", g_slots[i].key, g_slots[i].count);
+			wdt_reset();
+		}
+	}
+	fmt_print("PROFILE end\n\r");
+	
+	clear();
+	sampling(true);
+}
+
+uint16_t
+profiler_samples(void)
+{
+	uint16_t samples;
+	uint8_t sreg = SREG;
+	
+	cli();
+	samples = g_samples;
+	SREG = sreg;
+	return samples;
+}
+
+#endif
@@ -0,0 +1,982 @@
+/*
+ * spi_bus.c
+ *
+ * Created: 19/10/2026 18:05:12
+ * Author : Group 07
+ *
+ * SPI master for several slaves. A slave handles one frame at a time and cannot receive while
+ * it is busy with the last one, so the time each device needs is waited before its next frame.
+ * Frames to other devices are sent meanwhile instead of waiting.
+ * Frames end with their terminating zero, so a short command is not padded to the longest one.
+ *
+ * The SPI clock is chosen at start up by a self-test with the panel. The shift register of the
+ * Uno sends back each byte during the next one, so the echo can be checked without the Uno
+ * doing anything. When the Uno later finds CRC errors in the frames the next slower clock is used.
+ *
+ * A frame addressed to one device stays in the queue until the device has acknowledged it and is
+ * resent at once if it was not. Its sequence number lets the slave run a resent frame only once.
+ *
+ * The frames go out on the hardware SPI or on USART1 in master SPI mode, see SPI_BUS_TRANSPORT.
+ * The SPI has no transmit buffer and waits BYTE_GAP_US after each byte for the Uno. The USART
+ * streams the bytes without gaps instead, at a clock slow enough for the Uno to keep up.
+ */
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include <util/crc16.h>
+#include <string.h>
+#include "spi_bus.h"
+#include "fmt.h"
+#include "spin_timeout.h"
+#include "timebase.h"
+#include "power_manager.h"
+
+#define SLAVE_WAKE_US 10 // Uno sleeps in standby between frames and wakes up when SS goes low
+#define BYTE_GAP_US 6 // Uno reads each byte and adds it to the CRC before the next one, about 4 us
+#define REPLY_WAIT_US 20 // Uno checks the CRC and loads its reply
+#define RETRY_GAP_US 50 // Uno goes back to waiting for a frame after a NAK
+#define NO_SEQUENCE 0xFF // Nothing sent yet
+#define ALL_DEVICES ((1 << SPI_DEVICE_COUNT) - 1)
+
+#if SPI_BUS_TRACE
+#define TRACE_BYTES 4 // Time of SS going low, after the terminating zero
+#else
+#define TRACE_BYTES 0
+#endif
+
+/*SPI clocks of the self-test, fosc divided by 2 << index*/
+#define CLOCK_FOSC_2 0
+#define CLOCK_FOSC_8 2 // 4 us a byte, about the time the Uno needs for it
+#define CLOCK_FOSC_16 3 // 1 MHz, used until the self-test has passed and when nothing passes
+#define CLOCK_SLOWEST 6 // fosc/128
+
+#if SPI_BUS_TRANSPORT == SPI_TRANSPORT_USART1
+#define CLOCK_FASTEST CLOCK_FOSC_8 // No gap between the bytes, a faster clock would overrun the Uno
+#define TRANSPORT_NAME "USART1"
+#else
+#define CLOCK_FASTEST CLOCK_FOSC_2
+#define TRANSPORT_NAME "SPI"
+#endif
+
+#define TEST_MARKER 0x7F // Second byte of a test frame, the Uno ignores the rest of it
+#define TEST_FRAME_BYTES 128 // Pattern bytes in one test frame
+#define TEST_SETUP_US 100 // Uno turns MISO on and starts to wait for the end of the frame
+#define TEST_FRAME_GAP_US 200 // Uno goes back to waiting for a frame
+#define TEST_BOOT_DELAY_MS 300 // Uno initialises its LCD at the same time as Mega starts
+
+/*
+SS of the panel is PB0, the hardware SS, which has to be an output for the SPI to stay master.
+The other devices are on PL0-PL2 (pins 49-47). After a frame the Uno runs its commands, at most
+a few ms for a marquee written straight to the LCD, its serial output is buffered and does not
+count. A line that does not fit in its buffer is left out, it never waits for the UART.
+*/
+static const spi_device_t g_devices[SPI_DEVICE_COUNT] PROGMEM =
+{
+	// name        address  SS              settle ms
+	{ "Panel",     1,       &PORTB, PB0,    60 },
+	{ "Siren",     2,       &PORTL, PL0,    60 },
+	{ "Station2",  3,       &PORTL, PL1,    60 },
+	{ "Station3",  4,       &PORTL, PL2,    60 },
+};
+
+typedef struct
+{
+	uint8_t devices; // Bitmap of the devices that get the frame
+	char commands[SPI_COMMAND_SIZE];
+#if SPI_BUS_TRACE
+	uint32_t cause_us;
+	uint32_t queued_us;
+#endif
+} spi_frame_t;
+
+static spi_frame_t g_queue[SPI_QUEUE_SIZE];
+static uint8_t g_queued = 0;
+
+static uint32_t g_ready_at[SPI_DEVICE_COUNT]; // millis() when the device can take the next frame
+
+static uint16_t g_frames[SPI_DEVICE_COUNT];
+static uint16_t g_broadcasts = 0;
+static uint32_t g_settle_wait_ms = 0;
+static uint32_t g_transfer_us = 0;
+static uint32_t g_bytes = 0;
+
+static uint8_t g_clock = CLOCK_FOSC_16;
+static bool g_cpu_slow = false;
+static uint8_t g_clock_errors = 0; // CRC errors since the clock was changed
+static uint16_t g_crc_errors = 0;
+static uint16_t g_no_replies = 0;
+static uint16_t g_clock_fallbacks = 0;
+
+static uint8_t g_sequence[SPI_DEVICE_COUNT]; // Last sequence number sent to each device
+static uint8_t g_broadcast_sequence = NO_SEQUENCE;
+static uint8_t g_replied = 0; // Devices that have answered a frame, the others are taken as not connected
+static uint8_t g_reset_seen = 0; // Devices that have started again since they last answered
+static uint16_t g_retransmits = 0;
+static uint16_t g_given_up = 0;
+static uint16_t g_duplicates = 0;
+static uint16_t g_slave_resets = 0;
+
+#if SPI_BUS_TRACE
+// One frame that has been sent, all the times are micros()
+typedef struct
+{
+	uint32_t cause_us; // Event the main loop took before the frame was queued
+	uint32_t queued_us;
+	uint32_t ss_us; // SS low for the last attempt, the time the frame carried
+	uint32_t end_us; // Reply checked and SS high
+	uint8_t device; // SPI_BROADCAST for all of them
+	uint8_t sequence;
+	uint8_t attempts;
+	uint8_t status;
+} spi_trace_t;
+
+static spi_trace_t g_trace[SPI_TRACE_SIZE];
+static uint8_t g_trace_next = 0;
+static uint8_t g_trace_count = 0;
+static uint32_t g_trace_cause_us = 0;
+static uint32_t g_trace_ss_us; // Of the last frame transferred
+#endif
+
+// Pulls SS of the devices low (select) or high
+static void
+select_devices(uint8_t devices, bool select)
+{
+	spi_device_t device;
+	
+	for (uint8_t i = 0; i < SPI_DEVICE_COUNT; i++)
+	{
+		if (devices & (1 << i))
+		{
+			memcpy_P(&device, &g_devices[i], sizeof(spi_device_t));
+			if (select)
+			{
+				*device.ss_port &= ~(1 << device.ss_bit);
+			}
+			else
+			{
+				*device.ss_port |= (1 << device.ss_bit);
+			}
+		}
+	}
+}
+
+// Sets the clock divider of the transport, one step is 4 times slower while the CPU runs at 4 MHz
+static void
+apply_clock(void)
+{
+	uint8_t clock = g_clock;
+	
+	if (g_cpu_slow)
+	{
+		// Same SCK at a quarter of the CPU clock, as far as the dividers go
+		clock = (clock > 2) ? clock - 2 : 0;
+	}
+#if SPI_BUS_TRANSPORT == SPI_TRANSPORT_USART1
+	// SCK is fosc / (2 * (UBRR1 + 1))
+	UBRR1 = (1 << clock) - 1;
+#else
+	SPCR = (SPCR & ~((1 << SPR1) | (1 << SPR0))) | (clock >> 1);
+	if (clock < CLOCK_SLOWEST && !(clock & 1))
+	{
+		SPSR |= (1 << SPI2X);
+	}
+	else
+	{
+		SPSR &= ~(1 << SPI2X);
+	}
+#endif
+}
+
+#if SPI_BUS_TRANSPORT == SPI_TRANSPORT_USART1
+/*
+Sends one byte and gives the byte that came back on MISO.
+Only used with nothing else in the USART, i.e. after stream_end().
+Returns SPIN_TIMEOUT if the transfer did not complete in time.
+*/
+static uint8_t
+exchange(uint8_t byte, uint8_t *received)
+{
+	uint8_t polls = SPIN_LIMIT_SPI_US;
+	
+	UDR1 = byte;
+	while (!(UCSR1A & (1 << RXC1)))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_SPI);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+	*received = UDR1;
+	return SPIN_OK;
+}
+
+/*
+Puts one byte of a frame into the transmit buffer as soon as it is free, while the byte
+before it is still shifted out. What comes back on MISO is taken by stream_received()
+or thrown away by stream_end().
+*/
+static uint8_t
+stream_byte(uint8_t byte)
+{
+	uint8_t polls = SPIN_LIMIT_SPI_US;
+	
+	while (!(UCSR1A & (1 << UDRE1)))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_SPI);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+	// Transmit complete is cleared so it is only set after the last byte
+	UCSR1A = (1 << TXC1);
+	UDR1 = byte;
+	return SPIN_OK;
+}
+
+// Waits until the last byte of the frame has left and empties the receive buffer
+static uint8_t
+stream_end(void)
+{
+	uint8_t polls = SPIN_LIMIT_SPI_US;
+	
+	while (!(UCSR1A & (1 << TXC1)))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_SPI);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+	while (UCSR1A & (1 << RXC1))
+	{
+		(void)UDR1;
+	}
+	return SPIN_OK;
+}
+
+/*
+Takes the oldest byte that has come back on MISO while streaming, false if there is none.
+The receive buffer holds two bytes, so it is called after every stream_byte().
+*/
+static bool
+stream_received(uint8_t *received)
+{
+	if (!(UCSR1A & (1 << RXC1)))
+	{
+		return false;
+	}
+	*received = UDR1;
+	return true;
+}
+#else
+/*
+Sends one byte and gives the byte that came back on MISO.
+Returns SPIN_TIMEOUT if the transfer did not complete in time.
+*/
+static uint8_t
+exchange(uint8_t byte, uint8_t *received)
+{
+	uint8_t polls = SPIN_LIMIT_SPI_US;
+	
+	SPDR = byte;
+	// Checking SPI status register if the transmit is complete
+	while (!(SPSR & (1 << SPIF)))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_SPI);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+	*received = SPDR;
+	// Giving the Uno time to handle the byte
+	_delay_us(BYTE_GAP_US);
+	return SPIN_OK;
+}
+
+static uint8_t g_stream_received;
+static bool g_stream_pending = false;
+
+// The SPI has no transmit buffer, each byte of a frame waits for the one before it
+static uint8_t
+stream_byte(uint8_t byte)
+{
+	uint8_t status = exchange(byte, &g_stream_received);
+	
+	g_stream_pending = (status == SPIN_OK);
+	return status;
+}
+
+static uint8_t
+stream_end(void)
+{
+	g_stream_pending = false;
+	return SPIN_OK;
+}
+
+static bool
+stream_received(uint8_t *received)
+{
+	if (!g_stream_pending)
+	{
+		return false;
+	}
+	*received = g_stream_received;
+	g_stream_pending = false;
+	return true;
+}
+#endif
+
+// Counts a CRC error reported by the slave, too many at one clock slow the clock down
+static void
+crc_error(void)
+{
+	g_crc_errors++;
+	if (++g_clock_errors >= SPI_FALLBACK_ERRORS && g_clock < CLOCK_SLOWEST)
+	{
+		g_clock++;
+		g_clock_errors = 0;
+		g_clock_fallbacks++;
+		apply_clock();
+		fmt_print("SPI clock lowered to fosc/%u\n\r", 2 << g_clock);
+	}
+}
+
+/*
+Checks the reply of a device to a frame addressed to it.
+Returns SPIN_OK if the device has the frame, SPI_NAK or SPI_NO_REPLY if it has to be sent again.
+*/
+static uint8_t
+handle_reply(uint8_t devices, uint8_t reply)
+{
+	switch (reply)
+	{
+		case SPI_REPLY_RESET:
+			// The first answer of a device is from its start, not from a reset
+			if (g_replied & devices)
+			{
+				g_reset_seen |= devices;
+				g_slave_resets++;
+			}
+			break;
+		
+		case SPI_REPLY_DUPLICATE:
+			// The frame had already been run, the acknowledge of the first one was lost
+			g_duplicates++;
+			break;
+		
+		case SPI_REPLY_ACK:
+			break;
+		
+		case SPI_REPLY_NAK:
+			crc_error();
+			return SPI_NAK;
+		
+		default:
+			// Nothing on MISO, e.g. a device that is not connected
+			g_no_replies++;
+			return SPI_NO_REPLY;
+	}
+	g_replied |= devices;
+	return SPIN_OK;
+}
+
+/*
+Sends one frame with SS of the devices low: address, sequence number, commands, terminating zero and CRC-8.
+A frame to one device is answered with one of the SPI_REPLY_ codes on MISO.
+Returns SPIN_OK, SPIN_TIMEOUT if a byte did not go out, SPI_NAK if the slave found the frame
+corrupted or SPI_NO_REPLY if nothing sensible came back.
+*/
+static uint8_t
+transfer_frame(uint8_t devices, uint8_t address, uint8_t sequence, const char *commands)
+{
+	uint8_t length = strlen(commands) + 3; // Address, sequence number and the terminating zero
+	uint8_t status = SPIN_OK;
+	uint8_t crc = 0;
+	uint8_t byte, reply;
+	uint32_t start = micros();
+	
+	select_devices(devices, true);
+	_delay_us(SLAVE_WAKE_US); // Giving the Uno time to wake up before the first clock edge
+	
+	for (uint8_t i = 0; i <= length + TRACE_BYTES && status == SPIN_OK; i++)
+	{
+		// Address, then the commands up to and including their terminating zero, the trace time, then the CRC
+		if (i == length + TRACE_BYTES)
+		{
+			byte = crc;
+		}
+		else
+		{
+			if (i == 0)
+			{
+				byte = address;
+			}
+			else if (i >= length)
+			{
+				byte = (uint8_t)(start >> (8 * (i - length)));
+			}
+			else
+			{
+				byte = (i == 1) ? sequence : commands[i - 2];
+			}
+			crc = _crc8_ccitt_update(crc, byte);
+		}
+		status = stream_byte(byte);
+	}
+	if (status == SPIN_OK)
+	{
+		status = stream_end();
+	}
+	
+	if (status == SPIN_OK && address != SPI_ADDRESS_BROADCAST)
+	{
+		_delay_us(REPLY_WAIT_US);
+		status = exchange(0xFF, &reply);
+		if (status == SPIN_OK)
+		{
+			status = handle_reply(devices, reply);
+		}
+	}
+	
+	// The slaves drop a partial frame when SS goes high
+	select_devices(devices, false);
+	g_bytes += length + TRACE_BYTES + 1;
+	g_transfer_us += micros() - start;
+#if SPI_BUS_TRACE
+	g_trace_ss_us = start;
+#endif
+	return status;
+}
+
+// Devices of the bitmap that have not finished their last frame
+static uint8_t
+busy_devices(uint8_t devices, uint32_t now)
+{
+	uint8_t busy = 0;
+	
+	for (uint8_t i = 0; i < SPI_DEVICE_COUNT; i++)
+	{
+		if ((devices & (1 << i)) && (int32_t)(now - g_ready_at[i]) < 0)
+		{
+			busy |= (1 << i);
+		}
+	}
+	return busy;
+}
+
+// Earliest millis() one of the busy devices of the bitmap is ready at
+static uint32_t
+next_ready(uint8_t devices, uint32_t now)
+{
+	uint32_t wait = UINT32_MAX;
+	
+	for (uint8_t i = 0; i < SPI_DEVICE_COUNT; i++)
+	{
+		if ((devices & (1 << i)) && (int32_t)(now - g_ready_at[i]) < 0 && g_ready_at[i] - now < wait)
+		{
+			wait = g_ready_at[i] - now;
+		}
+	}
+	return now + wait;
+}
+
+/*
+Sequence number after the last one. Numbers 1-127 go round, 0 is only used for the first frame
+after Mega has started so the slave does not take it for the frame it got before the reset.
+*/
+static uint8_t
+next_sequence(uint8_t sequence)
+{
+	if (sequence == NO_SEQUENCE)
+	{
+		return 0;
+	}
+	return (sequence >= 127) ? 1 : sequence + 1;
+}
+
+#if SPI_BUS_TRACE
+// Keeps the times of a frame that has been sent, the oldest one is overwritten when all are used
+static void
+record_trace(const spi_frame_t *frame, uint8_t device, uint8_t sequence, uint8_t attempts, uint8_t status)
+{
+	spi_trace_t *trace = &g_trace[g_trace_next];
+	
+	trace->cause_us = frame->cause_us;
+	trace->queued_us = frame->queued_us;
+	trace->ss_us = g_trace_ss_us;
+	trace->end_us = micros();
+	trace->device = (frame->devices == ALL_DEVICES) ? SPI_BROADCAST : device;
+	trace->sequence = sequence;
+	trace->attempts = attempts;
+	trace->status = status;
+	
+	g_trace_next = (g_trace_next + 1) % SPI_TRACE_SIZE;
+	if (g_trace_count < SPI_TRACE_SIZE)
+	{
+		g_trace_count++;
+	}
+}
+#endif
+
+/*
+Sends the frame at index of the queue and removes it.
+A frame to one device is sent up to SPI_RETRIES more times until the device has acknowledged it.
+*/
+static uint8_t
+send_queued(uint8_t index)
+{
+	spi_frame_t *frame = &g_queue[index];
+	uint8_t address = SPI_ADDRESS_BROADCAST;
+	uint8_t device = 0;
+	uint8_t sequence, status, attempt;
+	uint32_t now;
+	
+	if (frame->devices != ALL_DEVICES)
+	{
+		for (uint8_t i = 0; i < SPI_DEVICE_COUNT; i++)
+		{
+			if (frame->devices & (1 << i))
+			{
+				device = i;
+				address = pgm_read_byte(&g_devices[i].address);
+			}
+		}
+	}
+	
+	if (frame->devices == ALL_DEVICES)
+	{
+		sequence = g_broadcast_sequence = next_sequence(g_broadcast_sequence);
+	}
+	else
+	{
+		sequence = g_sequence[device] = next_sequence(g_sequence[device]);
+	}
+	
+	for (attempt = 0; ; attempt++)
+	{
+		status = transfer_frame(frame->devices, address, SPI_SEQUENCE_FLAG | sequence, frame->commands);
+		if (status == SPI_NO_REPLY && !(g_replied & frame->devices))
+		{
+			// Never answered, not connected or without a reply, there is nothing to wait for
+			status = SPIN_OK;
+		}
+		if (status == SPIN_OK || attempt == SPI_RETRIES)
+		{
+			break;
+		}
+		g_retransmits++;
+		_delay_us(RETRY_GAP_US);
+	}
+	if (status != SPIN_OK)
+	{
+		g_given_up++;
+	}
+#if SPI_BUS_TRACE
+	record_trace(frame, device, sequence, attempt + 1, status);
+#endif
+	
+	now = millis();
+	for (uint8_t i = 0; i < SPI_DEVICE_COUNT; i++)
+	{
+		if (frame->devices & (1 << i))
+		{
+			g_ready_at[i] = now + pgm_read_byte(&g_devices[i].settle_ms);
+			g_frames[i]++;
+		}
+	}
+	if (frame->devices == ALL_DEVICES)
+	{
+		g_broadcasts++;
+	}
+	
+	g_queued--;
+	memmove(frame, frame + 1, (g_queued - index) * sizeof(spi_frame_t));
+	return status;
+}
+
+void
+spi_bus_init(void)
+{
+	memset(g_sequence, NO_SEQUENCE, sizeof(g_sequence));
+	
+	// Setting the SS pins as outputs
+	select_devices(ALL_DEVICES, false);
+	DDRB |= (1 << PB0);
+	DDRL |= (1 << PL2) | (1 << PL1) | (1 << PL0);
+	
+#if SPI_BUS_TRANSPORT == SPI_TRANSPORT_USART1
+	// The SPI is left off, its pins are free
+	PRR1 &= ~(1 << PRUSART1);
+	PRR0 |= (1 << PRSPI);
+	
+	// XCK1 as output makes the USART master, the baud rate has to be zero while the transmitter is enabled
+	UBRR1 = 0;
+	DDRD |= (1 << PD5);
+	// Master SPI mode 0 and MSB first like the Uno's SPI
+	UCSR1C = (1 << UMSEL11) | (1 << UMSEL10);
+	UCSR1B = (1 << RXEN1) | (1 << TXEN1);
+#else
+	// Setting MOSI and SCL as outputs
+	DDRB |= (1 << PB1) | (1 << PB2);
+	
+	// Set the SPI on and make the mega master
+	SPCR |= (1 << SPE) | (1 << MSTR);
+#endif
+	
+	// Set SPI clock to 1 MHz until the self-test has picked one
+	apply_clock();
+}
+
+void
+spi_bus_cpu_clock_changed(bool slow)
+{
+	g_cpu_slow = slow;
+	apply_clock();
+}
+
+// Next byte of the test pattern, a Galois LFSR that goes through all the values except zero
+static uint8_t
+next_pattern(uint8_t pattern)
+{
+	return (pattern & 1) ? (pattern >> 1) ^ 0xB8 : (pattern >> 1);
+}
+
+/*
+Checks the bytes that have come back so far. Every byte comes back during the next one,
+so the echoes are the marker and then the pattern as it was sent, one byte behind.
+*/
+static uint16_t
+test_echoes(uint16_t *echoed, uint8_t *expected, uint8_t *pattern)
+{
+	uint16_t errors = 0;
+	uint8_t received;
+	
+	while (stream_received(&received))
+	{
+		if (received != *expected)
+		{
+			errors++;
+		}
+		*expected = (*echoed == 0) ? 0 : *pattern;
+		if (*echoed != 0)
+		{
+			*pattern = next_pattern(*pattern);
+		}
+		(*echoed)++;
+	}
+	return errors;
+}
+
+/*
+Streams test frames to the panel at the current clock the way transfer_frame() sends its bytes,
+and counts the bytes that did not come back. The time the pattern bytes took is added to *us.
+*/
+static uint16_t
+test_clock(uint32_t *us)
+{
+	uint16_t errors = 0;
+	uint8_t pattern = 1;
+	uint8_t echo_pattern, expected;
+	uint16_t echoed;
+	uint32_t start;
+	
+	for (uint8_t frame = 0; frame < SPI_TEST_BYTES / TEST_FRAME_BYTES; frame++)
+	{
+		select_devices(1 << SPI_DEVICE_PANEL, true);
+		_delay_us(SLAVE_WAKE_US);
+		stream_byte(pgm_read_byte(&g_devices[SPI_DEVICE_PANEL].address));
+		stream_byte(TEST_MARKER);
+		stream_end();
+		_delay_us(TEST_SETUP_US);
+		
+		// Zero first, then the other values
+		expected = TEST_MARKER;
+		echo_pattern = pattern;
+		echoed = 0;
+		start = micros();
+		for (uint16_t i = 0; i < TEST_FRAME_BYTES; i++)
+		{
+			if (stream_byte((i == 0) ? 0 : pattern) != SPIN_OK)
+			{
+				break;
+			}
+			if (i != 0)
+			{
+				pattern = next_pattern(pattern);
+			}
+			errors += test_echoes(&echoed, &expected, &echo_pattern);
+		}
+		
+		// The last bytes are still on their way back
+		for (uint8_t polls = SPIN_LIMIT_SPI_US; echoed < TEST_FRAME_BYTES && polls != 0; polls--)
+		{
+			_delay_us(1);
+			errors += test_echoes(&echoed, &expected, &echo_pattern);
+		}
+		errors += TEST_FRAME_BYTES - echoed;
+		stream_end();
+		*us += micros() - start;
+		select_devices(1 << SPI_DEVICE_PANEL, false);
+		_delay_us(TEST_FRAME_GAP_US);
+	}
+	return errors;
+}
+
+uint8_t
+spi_bus_self_test(void)
+{
+	uint16_t errors;
+	uint32_t us;
+	
+	_delay_ms(TEST_BOOT_DELAY_MS);
+	
+	for (uint8_t clock = CLOCK_FASTEST; clock <= CLOCK_FOSC_16; clock++)
+	{
+		g_clock = clock;
+		apply_clock();
+		us = 0;
+		errors = test_clock(&us);
+		fmt_print(TRANSPORT_NAME " fosc/%u: %u bytes, %u errors, %lu bytes/s\n\r", 2 << clock, SPI_TEST_BYTES, errors,
+			us ? SPI_TEST_BYTES * 1000000UL / us : 0);
+		if (errors == 0)
+		{
+			return SPIN_OK;
+		}
+	}
+	
+	// Keeping the 1 MHz the link has always used
+	fmt_print("SPI self-test failed, using fosc/16\n\r");
+	return SPIN_TIMEOUT;
+}
+
+uint8_t
+spi_bus_queue(uint8_t device, const char *command)
+{
+	uint8_t status = SPIN_OK;
+	spi_frame_t *frame;
+	
+	if (g_queued == SPI_QUEUE_SIZE)
+	{
+		status = spi_bus_flush();
+	}
+	
+	frame = &g_queue[g_queued++];
+	frame->devices = (device == SPI_BROADCAST) ? ALL_DEVICES : (1 << device);
+	strncpy(frame->commands, command, SPI_COMMAND_SIZE - 1);
+	frame->commands[SPI_COMMAND_SIZE - 1] = '\0';
+#if SPI_BUS_TRACE
+	frame->cause_us = g_trace_cause_us;
+	frame->queued_us = micros();
+#endif
+	return status;
+}
+
+uint8_t
+spi_bus_flush(void)
+{
+	uint8_t status = SPIN_OK;
+	uint8_t blocked, busy, i;
+	uint32_t now, wait_from, ready_at;
+	
+	while (g_queued != 0)
+	{
+		now = millis();
+		blocked = 0; // Devices with an older frame still waiting, keeps their frames in order
+		for (i = 0; i < g_queued; i++)
+		{
+			busy = busy_devices(g_queue[i].devices, now);
+			if (!(g_queue[i].devices & blocked) && busy == 0)
+			{
+				break;
+			}
+			blocked |= g_queue[i].devices;
+		}
+		
+		if (i < g_queued)
+		{
+			if (send_queued(i) != SPIN_OK)
+			{
+				status = SPIN_TIMEOUT;
+			}
+			continue;
+		}
+		
+		// Every device with a frame is busy, sleeping until the first of them is ready
+		ready_at = next_ready(blocked, now);
+		wait_from = now;
+		for (;;)
+		{
+			cli();
+			now = millis();
+			if ((int32_t)(now - ready_at) >= 0)
+			{
+				break;
+			}
+			power_idle();
+		}
+		sei();
+		g_settle_wait_ms += now - wait_from;
+	}
+	return status;
+}
+
+uint8_t
+spi_bus_send(uint8_t device, const char *command)
+{
+	uint8_t status = spi_bus_queue(device, command);
+	
+	if (spi_bus_flush() != SPIN_OK)
+	{
+		status = SPIN_TIMEOUT;
+	}
+	return status;
+}
+
+void
+spi_transaction_begin(spi_transaction_t *transaction, uint8_t device)
+{
+	transaction->device = device;
+	transaction->length = 0;
+	transaction->commands[0] = '\0';
+}
+
+bool
+spi_transaction_add(spi_transaction_t *transaction, const char *command)
+{
+	uint8_t length = strlen(command);
+	uint8_t separator = (transaction->length != 0) ? 1 : 0;
+	
+	if (transaction->length + separator + length >= SPI_COMMAND_SIZE)
+	{
+		return false;
+	}
+	if (separator)
+	{
+		transaction->commands[transaction->length++] = SPI_COMMAND_SEPARATOR;
+	}
+	strcpy(&transaction->commands[transaction->length], command);
+	transaction->length += length;
+	return true;
+}
+
+bool
+spi_transaction_empty(const spi_transaction_t *transaction)
+{
+	return transaction->length == 0;
+}
+
+uint8_t
+spi_transaction_send(spi_transaction_t *transaction)
+{
+	uint8_t status = spi_bus_send(transaction->device, transaction->commands);
+	
+	spi_transaction_begin(transaction, transaction->device);
+	return status;
+}
+
+bool
+spi_bus_slave_reset(uint8_t device)
+{
+	bool reset = (g_reset_seen & (1 << device)) != 0;
+	
+	g_reset_seen &= ~(1 << device);
+	return reset;
+}
+
+uint32_t
+spi_bus_transfer_us(void)
+{
+	return g_transfer_us;
+}
+
+uint32_t
+spi_bus_bytes(void)
+{
+	return g_bytes;
+}
+
+void
+spi_bus_print_stats(void)
+{
+	for (uint8_t i = 0; i < SPI_DEVICE_COUNT; i++)
+	{
+		fmt_printf_P(PSTR("%-9S frames: %u\n\r"), g_devices[i].name, g_frames[i]);
+	}
+	fmt_print("Broadcast frames: %u, waited for busy devices: %lu ms\n\r", g_broadcasts, g_settle_wait_ms);
+	fmt_print("Bytes sent: %lu, SS low for %lu us\n\r", g_bytes, g_transfer_us);
+	fmt_print(TRANSPORT_NAME " clock fosc/%u, CRC errors: %u, no reply: %u, clock lowered %u times\n\r", 2 << g_clock, g_crc_errors,
+		g_no_replies, g_clock_fallbacks);
+	fmt_print("Retransmits: %u, given up: %u, duplicates dropped by slaves: %u, slave resets: %u\n\r", g_retransmits,
+		g_given_up, g_duplicates, g_slave_resets);
+}
+
+#if SPI_BUS_TRACE
+void
+spi_bus_trace_cause(void)
+{
+	g_trace_cause_us = micros();
+}
+
+void
+spi_bus_print_trace(void)
+{
+	uint8_t index = (g_trace_next + SPI_TRACE_SIZE - g_trace_count) % SPI_TRACE_SIZE;
+	spi_trace_t *trace;
+	
+	for (; g_trace_count != 0; g_trace_count--)
+	{
+		trace = &g_trace[index];
+		fmt_print("TRACE mega dev=%u seq=%u cause=%lu queued=%lu ss=%lu end=%lu tries=%u status=%u\n\r",
+			trace->device, trace->sequence, trace->cause_us, trace->queued_us, trace->ss_us, trace->end_us,
+			trace->attempts, trace->status);
+		wdt_reset();
+		index = (index + 1) % SPI_TRACE_SIZE;
+	}
+}
+#endif
+
+#if SPI_BUS_BENCHMARK
+#define BENCHMARK_FRAMES 24
+
+void
+spi_bus_benchmark(void)
+{
+	uint32_t start, elapsed;
+	uint32_t bytes = g_bytes;
+	uint32_t us = g_transfer_us;
+	
+	for (uint8_t devices = 1; devices <= SPI_DEVICE_COUNT; devices *= 2)
+	{
+		start = millis();
+		for (uint8_t i = 0; i < BENCHMARK_FRAMES; i++)
+		{
+			// Buzzer off, harmless on every device
+			spi_bus_queue(i % devices, "2");
+		}
+		spi_bus_flush();
+		elapsed = millis() - start;
+		fmt_print("%u slaves: %u frames in %lu ms, %lu frames/s\n\r", devices, BENCHMARK_FRAMES, elapsed,
+			elapsed ? BENCHMARK_FRAMES * 1000UL / elapsed : 0);
+	}
+	
+	// Bytes per second while SS is low, compares the transports without the settle time of the slaves
+	bytes = g_bytes - bytes;
+	us = g_transfer_us - us;
+	fmt_print(TRANSPORT_NAME " at fosc/%u: %lu bytes in %lu us, %lu bytes/s\n\r", 2 << g_clock, bytes, us,
+		us ? bytes * 1000000UL / us : 0);
+}
+#endif
@@ -0,0 +1,162 @@
+/*
+ * spi_bus.h
+ *
+ * Created: 19/10/2026 18:05:12
+ * Author : Group 07
+ */
+
+
+#ifndef SPI_BUS_H_
+#define SPI_BUS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+A frame is the address of the slave, a sequence number and one or more commands ("N>payload")
+separated by SPI_COMMAND_SEPARATOR, it ends with a zero and a CRC-8 (CCITT) of the bytes before it.
+The slave runs all the commands of a frame before it shows anything, so a frame is applied
+as a whole or, if it is cut or corrupted, not at all.
+Every slave has its own SS pin. A broadcast frame pulls all of them low at once and has
+address 0, each slave then runs it. Slaves do not drive MISO while several are selected.
+*/
+#define SPI_FRAME_SIZE 64 // At most, including the address, the sequence number and the terminating zero
+#define SPI_COMMAND_SIZE (SPI_FRAME_SIZE - 2) // Commands of a frame including the terminating zero
+#define SPI_SEQUENCE_FLAG 0x80 // Set in the sequence number byte, which is then never zero or the test marker
+#define SPI_COMMAND_SEPARATOR ';'
+#define SPI_ADDRESS_BROADCAST 0
+
+/*Devices, the rows of the device table*/
+#define SPI_DEVICE_PANEL 0 // Uno with the LCD and the buzzer
+#define SPI_DEVICE_SIREN 1
+#define SPI_DEVICE_STATION_2 2
+#define SPI_DEVICE_STATION_3 3
+#define SPI_DEVICE_COUNT 4
+#define SPI_BROADCAST 0xFF // As device: all the devices with one frame
+
+#define SPI_QUEUE_SIZE 8 // Frames waiting in spi_bus_flush()
+
+/*Reply of a slave to a frame addressed to it, sent on MISO after the CRC*/
+#define SPI_REPLY_ACK 0x06
+#define SPI_REPLY_DUPLICATE 0x07 // Same sequence number as the last frame, not run again
+#define SPI_REPLY_RESET 0x08 // First frame since the slave started, its screen was empty
+#define SPI_REPLY_NAK 0x15 // CRC did not match, the frame was dropped
+
+/*Status of a frame, next to SPIN_OK and SPIN_TIMEOUT*/
+#define SPI_NAK 2 // The slave dropped the frame
+#define SPI_NO_REPLY 3 // No reply code came back
+
+#define SPI_RETRIES 3 // Times a frame to one device is sent again before it is given up
+
+#define SPI_TEST_BYTES 2048 // Pattern bytes checked at each clock by the self-test
+#define SPI_FALLBACK_ERRORS 2 // CRC errors at one clock before the next slower clock is used
+
+// Set to 1 to measure the frame rate with 1, 2 and 4 slaves at start up
+#define SPI_BUS_BENCHMARK 0
+
+/*
+Set to 1 to trace the frames, FRAME_TRACE of the Uno has to be the same. Each frame then carries
+the micros() of Mega when SS went low, 4 bytes (LSB first) between the terminating zero and the CRC,
+and the Uno times its own stages from that SS. The last SPI_TRACE_SIZE frames are kept here.
+*/
+#define SPI_BUS_TRACE 0
+#define SPI_TRACE_SIZE 16
+
+/*
+Hardware that sends the frames, chosen when building. The USART has a transmit buffer, so the
+next byte is written while the last one is still shifted out and the bytes go back to back.
+XCK1 (PD5, pin 48 of the chip) is not on the Arduino Mega headers, it needs a wire to the Uno's SCK.
+*/
+#define SPI_TRANSPORT_SPI 0 // MOSI PB2, MISO PB3, SCK PB1 (pins 51, 50, 52)
+#define SPI_TRANSPORT_USART1 1 // Master SPI mode, MOSI TXD1 PD3, MISO RXD1 PD2 (pins 18, 19), SCK XCK1 PD5
+#define SPI_BUS_TRANSPORT SPI_TRANSPORT_SPI
+
+typedef struct
+{
+	char name[9];
+	uint8_t address; // First byte of the frames to the device, 1-255
+	volatile uint8_t *ss_port;
+	uint8_t ss_bit;
+	uint8_t settle_ms; // Time the device needs for a frame before it listens again
+} spi_device_t;
+
+// Commands collected to be sent to one device in one frame
+typedef struct
+{
+	uint8_t device;
+	uint8_t length;
+	char commands[SPI_COMMAND_SIZE];
+} spi_transaction_t;
+
+// Sets the SS pins high and the transport as master at 1 MHz
+void spi_bus_init(void);
+
+/*
+Tries the SPI clocks from the fastest one of the transport down to fosc/16 with echoed patterns
+from the panel and keeps the fastest one without errors. Prints the bytes per second of each. Needs the keypad tick for the time.
+Returns SPIN_TIMEOUT if no clock passed, 1 MHz (fosc/16) is kept then.
+*/
+uint8_t spi_bus_self_test(void);
+
+// Called by the power manager when the CPU clock changes, the SPI clock is scaled with it
+void spi_bus_cpu_clock_changed(bool slow);
+
+/*
+Adds a frame to the device (or SPI_BROADCAST) to the queue.
+A full queue is flushed first, returns SPIN_TIMEOUT if that flush failed.
+*/
+uint8_t spi_bus_queue(uint8_t device, const char *command);
+
+/*
+Sends the queued frames. The frames to one device go out in order, but a frame to a device
+that is ready can go before an older frame to a device that is still busy with its last one.
+Returns SPIN_TIMEOUT if a byte did not go out in time, the frame is dropped then.
+*/
+uint8_t spi_bus_flush(void);
+
+// Queues and flushes one frame
+uint8_t spi_bus_send(uint8_t device, const char *command);
+
+// Starts an empty transaction to the device (or SPI_BROADCAST)
+void spi_transaction_begin(spi_transaction_t *transaction, uint8_t device);
+
+// Adds a command to the transaction, returns false and adds nothing if the frame is full
+bool spi_transaction_add(spi_transaction_t *transaction, const char *command);
+
+bool spi_transaction_empty(const spi_transaction_t *transaction);
+
+/*
+Sends the commands of the transaction in one frame and empties it.
+Returns SPIN_TIMEOUT if the frame was cut, the slave then drops all of it.
+*/
+uint8_t spi_transaction_send(spi_transaction_t *transaction);
+
+/*
+True if the device has started again (e.g. by its watchdog) since it last answered.
+The flag is cleared by reading it.
+*/
+bool spi_bus_slave_reset(uint8_t device);
+
+// Time SS has been low for all the frames so far, in us
+uint32_t spi_bus_transfer_us(void);
+
+// Bytes of all the frames sent so far, resent ones included
+uint32_t spi_bus_bytes(void);
+
+// Prints the frames sent to each device and the time spent waiting for them
+void spi_bus_print_stats(void);
+
+#if SPI_BUS_TRACE
+// The frames queued from now on are traced from this time, the main loop calls it when it takes an event
+void spi_bus_trace_cause(void);
+
+// Prints the kept frames oldest first as "TRACE mega" lines for tools/trace_merge.py and forgets them
+void spi_bus_print_trace(void);
+#endif
+
+#if SPI_BUS_BENCHMARK
+// Sends the same frames to 1, 2 and 4 devices and prints the frames per second of the bus
+void spi_bus_benchmark(void);
+#endif
+
+#endif /* SPI_BUS_H_ */
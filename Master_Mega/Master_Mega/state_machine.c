@@ -0,0 +1,165 @@
+/*
+ * state_machine.c
+ *
+ * Created: 19/10/2026 10:41:05
+ * Author : Group 07
+ *
+ * Table driven state machine. The tables are read from PROGMEM one row at a time.
+ * Time spent in each state and the use of each transition are recorded.
+ */
+
+#include <stddef.h>
+#include "state_machine.h"
+
+static const fsm_transition_t *g_transitions;
+static uint8_t g_transition_count;
+static const fsm_state_t *g_states;
+
+static uint8_t g_current;
+static uint32_t g_entered_at;
+
+static uint32_t g_time_in_state[FSM_MAX_STATES];
+static uint16_t g_entries[FSM_MAX_STATES];
+static uint16_t g_work[FSM_MAX_STATES];
+static uint16_t g_transition_hits[FSM_MAX_TRANSITIONS];
+static uint16_t g_unhandled = 0;
+
+// Reads a row of the states table from PROGMEM
+static void
+read_state(uint8_t state, fsm_state_t *row)
+{
+	memcpy_P(row, &g_states[state], sizeof(fsm_state_t));
+}
+
+static void
+enter_state(uint8_t state, uint32_t now_ms)
+{
+	fsm_state_t row;
+
+	g_current = state;
+	g_entered_at = now_ms;
+	g_entries[state]++;
+
+	read_state(state, &row);
+	if (row.entry != NULL)
+	{
+		row.entry();
+	}
+}
+
+static void
+exit_state(uint32_t now_ms)
+{
+	fsm_state_t row;
+
+	read_state(g_current, &row);
+	if (row.exit != NULL)
+	{
+		row.exit();
+	}
+	g_time_in_state[g_current] += now_ms - g_entered_at;
+}
+
+void
+fsm_init(const fsm_transition_t *transitions, uint8_t transition_count,
+	const fsm_state_t *states, uint8_t initial_state, uint32_t now_ms)
+{
+	g_transitions = transitions;
+	// Rows past the counters are never used
+	g_transition_count = (transition_count < FSM_MAX_TRANSITIONS) ? transition_count : FSM_MAX_TRANSITIONS;
+	g_states = states;
+
+	enter_state(initial_state, now_ms);
+}
+
+void
+fsm_dispatch(uint8_t event, uint32_t now_ms)
+{
+	fsm_transition_t row;
+
+	for (uint8_t i = 0; i < g_transition_count; i++)
+	{
+		memcpy_P(&row, &g_transitions[i], sizeof(fsm_transition_t));
+		// A row to a state past the counters is never taken
+		if (row.state != g_current || row.event != event
+			|| (row.next_state != FSM_INTERNAL && row.next_state >= FSM_MAX_STATES))
+		{
+			continue;
+		}
+
+		g_transition_hits[i]++;
+		if (row.action != NULL && !row.action())
+		{
+			return;
+		}
+		if (row.next_state != FSM_INTERNAL)
+		{
+			exit_state(now_ms);
+			enter_state(row.next_state, now_ms);
+		}
+		return;
+	}
+	g_unhandled++;
+}
+
+uint8_t
+fsm_state(void)
+{
+	return g_current;
+}
+
+uint8_t
+fsm_state_attributes(void)
+{
+	fsm_state_t row;
+
+	read_state(g_current, &row);
+	return row.attributes;
+}
+
+void
+fsm_count_work(void)
+{
+	g_work[g_current]++;
+}
+
+uint32_t
+fsm_time_in_state(uint8_t state, uint32_t now_ms)
+{
+	// Including the time of the visit that is still going on
+	if (state == g_current)
+	{
+		return g_time_in_state[state] + (now_ms - g_entered_at);
+	}
+	return g_time_in_state[state];
+}
+
+uint16_t
+fsm_entries(uint8_t state)
+{
+	return g_entries[state];
+}
+
+uint16_t
+fsm_work(uint8_t state)
+{
+	return g_work[state];
+}
+
+uint8_t
+fsm_transition_count(void)
+{
+	return g_transition_count;
+}
+
+uint16_t
+fsm_transition_hits(uint8_t row)
+{
+	return g_transition_hits[row];
+}
+
+uint16_t
+fsm_unhandled_events(void)
+{
+	return g_unhandled;
+}
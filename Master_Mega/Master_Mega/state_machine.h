@@ -0,0 +1,69 @@
+/*
+ * state_machine.h
+ *
+ * Created: 19/10/2026 10:41:05
+ * Author : Group 07
+ */
+
+
+#ifndef STATE_MACHINE_H_
+#define STATE_MACHINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+
+#define FSM_MAX_STATES 12
+#define FSM_MAX_TRANSITIONS 40
+#define FSM_INTERNAL 0xFF // As next state: stays in the state without running exit and entry
+
+// Run on a transition. Returning false cancels the state change, the state stays the same.
+typedef bool (*fsm_action_t)(void);
+typedef void (*fsm_hook_t)(void);
+
+// One row of the transition table, the table is kept in PROGMEM
+typedef struct
+{
+	uint8_t state;
+	uint8_t event;
+	fsm_action_t action; // NULL if nothing needs to be done
+	uint8_t next_state;
+} fsm_transition_t;
+
+// Entry and exit actions of a state, kept in PROGMEM. Both can be NULL.
+typedef struct
+{
+	fsm_hook_t entry;
+	fsm_hook_t exit;
+	uint8_t attributes; // Meaning is given by the user of the state machine
+} fsm_state_t;
+
+/*
+Starts the state machine in initial_state and runs its entry action.
+Both tables have to be in PROGMEM, at most FSM_MAX_STATES states and FSM_MAX_TRANSITIONS rows.
+Rows past FSM_MAX_TRANSITIONS and rows to a state id not below FSM_MAX_STATES are ignored.
+*/
+void fsm_init(const fsm_transition_t *transitions, uint8_t transition_count,
+	const fsm_state_t *states, uint8_t initial_state, uint32_t now_ms);
+
+/*
+Finds the row for the current state and the event, runs its action and changes the state.
+Events without a row are counted and ignored.
+*/
+void fsm_dispatch(uint8_t event, uint32_t now_ms);
+
+uint8_t fsm_state(void);
+uint8_t fsm_state_attributes(void);
+
+// Counts a piece of work (e.g. a frame sent) for the current state
+void fsm_count_work(void);
+
+/*Metrics*/
+uint32_t fsm_time_in_state(uint8_t state, uint32_t now_ms);
+uint16_t fsm_entries(uint8_t state);
+uint16_t fsm_work(uint8_t state);
+uint8_t fsm_transition_count(void);
+uint16_t fsm_transition_hits(uint8_t row);
+uint16_t fsm_unhandled_events(void);
+
+#endif /* STATE_MACHINE_H_ */
@@ -0,0 +1,56 @@
+/*
+ * timebase.c
+ *
+ * Created: 19/10/2026 17:36:20
+ * Author : Group 07
+ *
+ * System time kept by the keypad scan interrupt of Timer0. Shared by the main loop and
+ * the interrupts that need to timestamp their inputs.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "timebase.h"
+
+#define US_PER_COUNT 16 // Timer0 counts at 62.5 kHz at both CPU speeds, see power_manager.c
+
+static volatile uint32_t g_millis = 0;
+static uint8_t g_tick_ms = 0;
+
+uint32_t
+millis(void)
+{
+	uint32_t now;
+	uint8_t sreg = SREG;
+	
+	cli();
+	now = g_millis;
+	SREG = sreg;
+	return now;
+}
+
+uint32_t
+micros(void)
+{
+	uint32_t now;
+	uint8_t count;
+	uint8_t sreg = SREG;
+	
+	cli();
+	now = g_millis;
+	count = TCNT0;
+	// The counter has already started the next tick but its interrupt has not run yet
+	if ((TIFR0 & (1 << OCF0A)) && count < OCR0A)
+	{
+		now += g_tick_ms;
+	}
+	SREG = sreg;
+	return now * 1000 + count * US_PER_COUNT;
+}
+
+void
+timebase_tick(uint8_t tick_ms)
+{
+	g_tick_ms = tick_ms;
+	g_millis += tick_ms;
+}
@@ -0,0 +1,29 @@
+/*
+ * timebase.h
+ *
+ * Created: 19/10/2026 17:36:20
+ * Author : Group 07
+ */
+
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <stdint.h>
+
+/*
+Milliseconds the CPU has been awake, Timer0 does not run in power-down.
+Can be called from the interrupts as well.
+*/
+uint32_t millis(void);
+
+/*
+Microseconds the CPU has been awake, with the resolution of Timer0 (16 us).
+Wraps around after 71 minutes, only for measuring short times.
+*/
+uint32_t micros(void);
+
+// Called from the Timer0 interrupt every tick_ms milliseconds
+void timebase_tick(uint8_t tick_ms);
+
+#endif /* TIMEBASE_H_ */
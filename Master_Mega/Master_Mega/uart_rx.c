@@ -0,0 +1,259 @@
+/*
+ * uart_rx.c
+ *
+ * Created: 19/10/2026 21:06:18
+ * Author : Group 07
+ *
+ * Receives the lines from the host in the background. The ring takes the next line while the
+ * main loop sends the one before it, so the host does not have to wait for each frame.
+ */
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "uart_rx.h"
+#include "fmt.h"
+#include "event_queue.h"
+#include "spin_timeout.h"
+#include "timebase.h"
+
+#define RING_MASK (UART_RX_SIZE - 1)
+#define WAKE_QUIET_MS 1000 // Back to power-down if no line came after the wake up edge
+// Clears transmit complete with a plain write, |= would write back the error flags that have to be written 0
+#define CLEAR_TXC0() (UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0))
+
+static volatile char g_ring[UART_RX_SIZE];
+static volatile uint8_t g_head = 0; // Written by the interrupt, runs freely, the index is masked
+static volatile uint8_t g_tail = 0; // Moved by the main loop
+static volatile uint8_t g_line_length = 0; // Characters of the line being received
+static volatile bool g_discard = false; // The line being received is too long, dropped up to its end
+static volatile bool g_paused = false; // XOFF has been sent
+static volatile uint8_t g_flow_pending; // XON or XOFF waiting for the transmit buffer
+
+static volatile bool g_woken = false; // RXD0 woke the Mega from power-down
+static volatile uint32_t g_woken_ms;
+
+static volatile uint16_t g_lines = 0;
+static volatile uint16_t g_dropped = 0;
+static volatile uint16_t g_errors = 0;
+static volatile uint16_t g_xoffs = 0;
+static volatile uint32_t g_rx_bytes = 0;
+static volatile uint32_t g_tx_bytes = 0;
+
+// Characters in the ring, called with interrupts disabled or from the interrupt
+static uint8_t
+used(void)
+{
+	return (uint8_t)(g_head - g_tail);
+}
+
+// Sends XON or XOFF now or as soon as the transmit buffer is free, called with interrupts disabled
+static void
+send_flow(uint8_t flow)
+{
+	if (UCSR0A & (1 << UDRE0))
+	{
+		CLEAR_TXC0();
+		UDR0 = flow;
+		g_tx_bytes++;
+	}
+	else
+	{
+		g_flow_pending = flow;
+		UCSR0B |= (1 << UDRIE0);
+	}
+}
+
+void
+uart_rx_init(void)
+{
+	UCSR0B |= (1 << RXCIE0);
+	
+	// RXD0 is PCINT8, its start bit wakes the Mega from power-down
+	PCMSK1 |= (1 << PCINT8);
+	PCICR |= (1 << PCIE1);
+}
+
+ISR(USART0_RX_vect)
+{
+	uint8_t status = UCSR0A;
+	char c = UDR0;
+	
+	g_rx_bytes++;
+	if (status & ((1 << FE0) | (1 << DOR0)))
+	{
+		// The line is corrupted, it is dropped when it ends
+		g_errors++;
+		g_discard = true;
+	}
+	
+	if (c == '\r' || c == '\n')
+	{
+		if (g_discard)
+		{
+			g_head -= g_line_length;
+			g_discard = false;
+			g_dropped++;
+		}
+		else if (g_line_length != 0)
+		{
+			g_ring[g_head++ & RING_MASK] = '\0';
+			g_lines++;
+			event_post(EVENT_SERIAL_LINE, 0);
+		}
+		g_line_length = 0;
+	}
+	else if (!g_discard)
+	{
+		// Room is always left for the terminating zero
+		if (g_line_length == UART_LINE_SIZE - 1 || used() >= UART_RX_SIZE - 1)
+		{
+			g_discard = true;
+		}
+		else
+		{
+			g_ring[g_head++ & RING_MASK] = c;
+			g_line_length++;
+		}
+	}
+	
+	if (!g_paused && used() >= UART_RX_SIZE - UART_RX_SKID)
+	{
+		g_paused = true;
+		g_xoffs++;
+		send_flow(UART_XOFF);
+	}
+}
+
+ISR(USART0_UDRE_vect)
+{
+	UCSR0B &= ~(1 << UDRIE0);
+	CLEAR_TXC0();
+	UDR0 = g_flow_pending;
+	g_tx_bytes++;
+}
+
+// Start bit of the first character after power-down, USART0 runs from now on
+ISR(PCINT1_vect)
+{
+	PCMSK1 &= ~(1 << PCINT8);
+	g_woken = true;
+	g_woken_ms = millis();
+}
+
+bool
+uart_rx_line(char *line)
+{
+	uint8_t sreg = SREG;
+	uint8_t i = 0;
+	char c;
+	
+	cli();
+	// Only complete lines end with a zero, the line being received is not in the ring yet
+	if (used() == g_line_length)
+	{
+		SREG = sreg;
+		return false;
+	}
+	SREG = sreg;
+	
+	do
+	{
+		c = g_ring[g_tail & RING_MASK];
+		line[i++] = c;
+		g_tail++;
+	} while (c != '\0');
+	
+	cli();
+	if (g_paused && used() <= UART_RX_SIZE / 4)
+	{
+		g_paused = false;
+		send_flow(UART_XON);
+	}
+	SREG = sreg;
+	return true;
+}
+
+bool
+uart_rx_active(void)
+{
+	uint8_t sreg = SREG;
+	bool active;
+	
+	cli();
+	active = (used() != 0) || g_discard;
+	if (g_woken && !active && millis() - g_woken_ms >= WAKE_QUIET_MS)
+	{
+		g_woken = false;
+		PCIFR = (1 << PCIF1);
+		PCMSK1 |= (1 << PCINT8);
+	}
+	active = active || g_woken;
+	SREG = sreg;
+	return active;
+}
+
+uint8_t
+uart_tx_put(uint8_t data)
+{
+	uint16_t polls = SPIN_LIMIT_UART_US;
+	uint8_t sreg;
+	
+	while (1)
+	{
+		sreg = SREG;
+		cli();
+		if (UCSR0A & (1 << UDRE0))
+		{
+			/* Transmit complete is cleared for the power manager */
+			CLEAR_TXC0();
+			UDR0 = data;
+			g_tx_bytes++;
+			SREG = sreg;
+			return SPIN_OK;
+		}
+		SREG = sreg;
+		
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_UART);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+}
+
+void
+uart_rx_print_stats(void)
+{
+	fmt_print("Host lines: %u, dropped: %u, receive errors: %u, XOFF sent: %u\n\r", g_lines, g_dropped, g_errors,
+		g_xoffs);
+}
+
+uint32_t
+uart_rx_bytes(void)
+{
+	uint32_t bytes;
+	uint8_t sreg = SREG;
+	
+	cli();
+	bytes = g_rx_bytes;
+	SREG = sreg;
+	return bytes;
+}
+
+uint32_t
+uart_tx_bytes(void)
+{
+	uint32_t bytes;
+	uint8_t sreg = SREG;
+	
+	cli();
+	bytes = g_tx_bytes;
+	SREG = sreg;
+	return bytes;
+}
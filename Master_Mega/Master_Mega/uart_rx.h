@@ -0,0 +1,56 @@
+/*
+ * uart_rx.h
+ *
+ * Created: 19/10/2026 21:06:18
+ * Author : Group 07
+ */
+
+
+#ifndef UART_RX_H_
+#define UART_RX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Lines from the host on USART0, ended by CR or LF. The receive interrupt puts them into a ring
+and posts EVENT_SERIAL_LINE for each one, the main loop takes them out with uart_rx_line().
+The host is asked to pause with XOFF when the ring is nearly full and to go on with XON.
+*/
+#define UART_RX_SIZE 128 // Ring, has to be a power of two, at most 128
+#define UART_RX_SKID 64 // Free space left when XOFF is sent, the host and its USB chip keep sending for a while
+#define UART_LINE_SIZE 64 // Longest line including the terminating zero, longer lines are dropped
+
+#define UART_XON 0x11
+#define UART_XOFF 0x13
+
+/*
+Enables the receive interrupt. In power-down USART0 is stopped, the first edge on RXD0 (PCINT8)
+wakes the Mega and keeps it awake until the line is in. The character of that edge is lost.
+*/
+void uart_rx_init(void);
+
+/*
+Copies the oldest complete line to line, at least UART_LINE_SIZE bytes, and frees its place.
+Returns false if no line is complete.
+*/
+bool uart_rx_line(char *line);
+
+// True while a line is being received or waiting, the Mega must not go to power-down then
+bool uart_rx_active(void);
+
+/*
+Sends a character with the transmit buffer checked and written as one step,
+an XON or XOFF from the receive interrupt cannot get in between.
+Returns SPIN_TIMEOUT if the buffer did not get empty in time.
+*/
+uint8_t uart_tx_put(uint8_t data);
+
+// Prints the lines received and the flow control used
+void uart_rx_print_stats(void);
+
+// Characters received and sent since the start, XON and XOFF included
+uint32_t uart_rx_bytes(void);
+uint32_t uart_tx_bytes(void);
+
+#endif /* UART_RX_H_ */
@@ -0,0 +1,260 @@
+/*
+ * zones.c
+ *
+ * Created: 19/10/2026 16:48:03
+ * Author : Group 07
+ *
+ * The interrupts only set the bit of their zone in a bitmap and post an event when the bit
+ * was not set yet. A sensor that keeps triggering does not fill the event queue. The INT zones
+ * each have their own vector, so adding zones does not slow down the others.
+ *
+ * Every edge is timestamped with the system time and goes through the hold-off and the rate
+ * limit of its zone before it can trip the zone. The dropped edges are only counted.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "zones.h"
+#include "fmt.h"
+#include "event_queue.h"
+#include "timebase.h"
+#include "latency.h"
+
+/*
+Only the PIR of the Hall (PD0, pin 21) is on the board. The other inputs have no pull-up and
+would float, so their zones are bypassed until a sensor is wired: its output to the pin (Door
+PD1 pin 20, Window PB4 pin 10), with a 10 kOhm pull-down so the pin stays low without it.
+*/
+static const zone_t g_zones[ZONE_COUNT] PROGMEM =
+{
+	// name        entry delay  options                       hold-off ms
+	{ "Hall",      15,          0,                            3000 },	// INT0
+	{ "Door",      30,          ZONE_BYPASS,                  3000 },	// INT1
+	{ "Zone 3",    15,          ZONE_BYPASS,                  3000 },	// INT4
+	{ "Zone 4",    15,          ZONE_BYPASS,                  3000 },	// INT5
+	{ "Window",    0,           ZONE_BYPASS | ZONE_INSTANT,   500 },	// PCINT4
+	{ "Zone 6",    15,          ZONE_BYPASS,                  3000 },	// PCINT5
+	{ "Zone 7",    15,          ZONE_BYPASS,                  3000 },	// PCINT6
+	{ "Zone 8",    15,          ZONE_BYPASS,                  3000 },	// PCINT7
+};
+
+// Index of the lowest set bit of a nibble, the bitmap is searched one nibble at a time
+static const uint8_t g_lowest_bit[16] PROGMEM = { 0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+
+static volatile uint8_t g_tripped = 0; // Zone bitmap
+static uint8_t g_watched = 0; // Zones that are not bypassed
+static uint8_t g_pcint_previous = 0; // PORTB zone pins on the previous pin change
+
+// Hold-off and rate limit, only used by the interrupts and by zones_clear() with them disabled
+static uint8_t g_seen = 0; // Zones that have accepted an edge since the last clear
+static uint32_t g_last_accept_ms[ZONE_COUNT];
+static uint32_t g_window_start_ms[ZONE_COUNT];
+static uint8_t g_window_count[ZONE_COUNT];
+
+static uint16_t g_raw_edges[ZONE_COUNT];
+static uint16_t g_accepted_edges[ZONE_COUNT];
+
+// Decides if an edge of the zone is let through, the first edge after a clear always is
+static bool
+zone_accept(uint8_t zone, uint32_t now)
+{
+	if (g_seen & (1 << zone))
+	{
+		if (now - g_last_accept_ms[zone] < pgm_read_word(&g_zones[zone].holdoff_ms))
+		{
+			return false;
+		}
+		if (now - g_window_start_ms[zone] >= ZONE_RATE_WINDOW_MS)
+		{
+			g_window_start_ms[zone] = now;
+			g_window_count[zone] = 0;
+		}
+		else if (g_window_count[zone] >= ZONE_RATE_MAX)
+		{
+			return false;
+		}
+	}
+	else
+	{
+		g_seen |= (1 << zone);
+		g_window_start_ms[zone] = now;
+		g_window_count[zone] = 0;
+	}
+	g_last_accept_ms[zone] = now;
+	g_window_count[zone]++;
+	return true;
+}
+
+// Called from the interrupts, only the first trip of the zone is posted
+static void
+zone_trip(uint8_t zone)
+{
+	g_raw_edges[zone]++;
+	if (!zone_accept(zone, millis()))
+	{
+		return;
+	}
+	g_accepted_edges[zone]++;
+	
+	if (!(g_tripped & (1 << zone)))
+	{
+		g_tripped |= (1 << zone);
+		event_post(EVENT_MOTION, zone);
+		latency_start(LATENCY_MOTION);
+	}
+}
+
+void
+zones_init(void)
+{
+	uint8_t sreg = SREG;
+	
+	for (uint8_t zone = 0; zone < ZONE_COUNT; zone++)
+	{
+		if (!(pgm_read_byte(&g_zones[zone].options) & ZONE_BYPASS))
+		{
+			g_watched |= (1 << zone);
+		}
+	}
+	
+	cli();
+	// All zone pins are inputs
+	DDRD &= ~((1 << PD1) | (1 << PD0));
+	DDRE &= ~((1 << PE5) | (1 << PE4));
+	DDRB &= ~ZONE_PCINT_MASK;
+	
+	// Rising edge, the sensors are active high
+	EICRA |= (1<<ISC11)|(1<<ISC10)|(1<<ISC01)|(1<<ISC00);
+	EICRB |= (1<<ISC51)|(1<<ISC50)|(1<<ISC41)|(1<<ISC40);
+	EIFR = (1<<INTF5)|(1<<INTF4)|(1<<INTF1)|(1<<INTF0);
+	EIMSK |= (g_watched & 0x03) | ((g_watched & 0x0C) << 2); // Zones 0-1 --> INT0-1, zones 2-3 --> INT4-5
+	
+	g_pcint_previous = PINB & ZONE_PCINT_MASK;
+	PCMSK0 |= g_watched & ZONE_PCINT_MASK;
+	if (g_watched & ZONE_PCINT_MASK)
+	{
+		PCICR |= (1 << PCIE0);
+	}
+	SREG = sreg;
+}
+
+void
+zones_clear(void)
+{
+	uint8_t sreg = SREG;
+	
+	cli();
+	g_tripped = 0;
+	g_seen = 0;
+	SREG = sreg;
+}
+
+uint8_t
+zone_next(void)
+{
+	uint8_t sreg = SREG;
+	uint8_t bits, zone;
+	
+	cli();
+	bits = g_tripped;
+	if (bits == 0)
+	{
+		SREG = sreg;
+		return ZONE_NONE;
+	}
+	if (bits & 0x0F)
+	{
+		zone = pgm_read_byte(&g_lowest_bit[bits & 0x0F]);
+	}
+	else
+	{
+		zone = 4 + pgm_read_byte(&g_lowest_bit[bits >> 4]);
+	}
+	g_tripped = bits & ~(1 << zone);
+	SREG = sreg;
+	return zone;
+}
+
+uint8_t
+zone_entry_delay(uint8_t zone)
+{
+	return pgm_read_byte(&g_zones[zone].entry_delay);
+}
+
+bool
+zone_is_instant(uint8_t zone)
+{
+	return (pgm_read_byte(&g_zones[zone].options) & ZONE_INSTANT) != 0;
+}
+
+const char *
+zone_name(uint8_t zone)
+{
+	return g_zones[zone].name;
+}
+
+bool
+zones_need_io_clock(void)
+{
+	return (g_watched & ZONE_IO_CLOCK_MASK) != 0;
+}
+
+void
+zones_print_stats(void)
+{
+	uint16_t raw, accepted;
+	uint8_t sreg;
+	
+	fmt_print("Zone      raw edges  accepted  dropped\n\r");
+	for (uint8_t zone = 0; zone < ZONE_COUNT; zone++)
+	{
+		if (!(g_watched & (1 << zone)))
+		{
+			continue;
+		}
+		// The counters are written by the interrupts
+		sreg = SREG;
+		cli();
+		raw = g_raw_edges[zone];
+		accepted = g_accepted_edges[zone];
+		SREG = sreg;
+		fmt_printf_P(PSTR("%-9S %9u %9u %8u\n\r"), g_zones[zone].name, raw, accepted, raw - accepted);
+	}
+}
+
+ISR(INT0_vect)
+{
+	zone_trip(0);
+}
+
+ISR(INT1_vect)
+{
+	zone_trip(1);
+}
+
+ISR(INT4_vect)
+{
+	zone_trip(2);
+}
+
+ISR(INT5_vect)
+{
+	zone_trip(3);
+}
+
+// Shared by the PORTB zones, only the rising edges of watched pins trip a zone
+ISR(PCINT0_vect)
+{
+	uint8_t pins = PINB & ZONE_PCINT_MASK;
+	uint8_t rising = pins & ~g_pcint_previous & g_watched;
+	
+	g_pcint_previous = pins;
+	for (uint8_t zone = 4; zone < ZONE_COUNT; zone++)
+	{
+		if (rising & (1 << zone))
+		{
+			zone_trip(zone);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ * zones.h
+ *
+ * Created: 19/10/2026 16:48:03
+ * Author : Group 07
+ */
+
+
+#ifndef ZONES_H_
+#define ZONES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Motion sensor zones, zone n is bit n of the zone bitmap.
+  Zone 0: INT0  PD0 (pin 21)
+  Zone 1: INT1  PD1 (pin 20)
+  Zone 2: INT4  PE4 (pin 2)
+  Zone 3: INT5  PE5 (pin 3)
+  Zone 4-7: PCINT4-7  PB4-PB7 (pins 10-13)
+INT2 and INT3 (PD2, PD3) are kept free for USART1, INT6 and INT7 are not on the Arduino Mega headers.
+*/
+#define ZONE_COUNT 8
+#define ZONE_NONE 0xFF
+
+#define ZONE_PCINT_MASK 0xF0 // Zones on PORTB, the bit of the zone is the bit of the pin
+#define ZONE_IO_CLOCK_MASK 0x0C // INT4 and INT5 only see edges with the I/O clock running
+
+/*Zone options*/
+#define ZONE_BYPASS 0x01 // Not watched, its interrupt is left disabled
+#define ZONE_INSTANT 0x02 // Triggers the alarm without entry delay
+
+#define ZONE_NAME_LEN 9
+
+/*
+Rate limit of each zone, edges after ZONE_RATE_MAX accepted edges in ZONE_RATE_WINDOW_MS
+are dropped until the window ends. Together with the hold-off of the zone this stops a
+chattering sensor from posting events and waking the main loop over and over.
+*/
+#define ZONE_RATE_MAX 4
+#define ZONE_RATE_WINDOW_MS 60000UL
+
+typedef struct
+{
+	char name[ZONE_NAME_LEN]; // Shown on the LCD
+	uint8_t entry_delay; // Seconds to give the password
+	uint8_t options;
+	uint16_t holdoff_ms; // Edges this soon after the last accepted one are dropped
+} zone_t;
+
+// Sets the inputs and enables the interrupts of the zones that are not bypassed
+void zones_init(void);
+
+// Forgets the zones that have tripped and restarts the rate limits, e.g. when arming
+void zones_clear(void);
+
+/*
+Takes the lowest zone that has tripped from the bitmap, ZONE_NONE if there is none.
+Each zone posts one EVENT_MOTION when its bit gets set, so calling this once per event is enough.
+*/
+uint8_t zone_next(void);
+
+uint8_t zone_entry_delay(uint8_t zone);
+bool zone_is_instant(uint8_t zone);
+
+// Name of the zone, in PROGMEM
+const char *zone_name(uint8_t zone);
+
+// True if a watched zone cannot wake the Mega from power-down
+bool zones_need_io_clock(void);
+
+// Prints the raw and accepted edges of the watched zones
+void zones_print_stats(void);
+
+#endif /* ZONES_H_ */
@@ -47,12 +47,32 @@
 #define lcd_e_high()    LCD_E_PORT  |=  _BV(LCD_E_PIN);
 #define lcd_e_low()     LCD_E_PORT  &= ~_BV(LCD_E_PIN);
 #define lcd_e_toggle()  toggle_e()
+#if LCD_WRITE_ONLY
+#define lcd_rw_low()                            /* RW is tied to GND */
+#define lcd_rw_ddr_out()
+#else
 #define lcd_rw_high()   LCD_RW_PORT |=  _BV(LCD_RW_PIN)
 #define lcd_rw_low()    LCD_RW_PORT &= ~_BV(LCD_RW_PIN)
+#define lcd_rw_ddr_out() DDR(LCD_RW_PORT) |= _BV(LCD_RW_PIN)
+#endif
 #define lcd_rs_high()   LCD_RS_PORT |=  _BV(LCD_RS_PIN)
 #define lcd_rs_low()    LCD_RS_PORT &= ~_BV(LCD_RS_PIN)
 #endif
 
+#if LCD_IO_MODE
+/* all four data lines on one port, in any order */
+#define LCD_DATA_SAME_PORT  ( ( &LCD_DATA0_PORT == &LCD_DATA1_PORT) && ( &LCD_DATA1_PORT == &LCD_DATA2_PORT ) \
+                           && ( &LCD_DATA2_PORT == &LCD_DATA3_PORT ) )
+/* data lines on consecutive pins of that port, e.g. PD2..PD5 */
+#define LCD_DATA_SHIFTED    ( (LCD_DATA1_PIN == LCD_DATA0_PIN+1) && (LCD_DATA2_PIN == LCD_DATA0_PIN+2) \
+                           && (LCD_DATA3_PIN == LCD_DATA0_PIN+3) )
+#define LCD_DATA_MASK       ( _BV(LCD_DATA0_PIN) | _BV(LCD_DATA1_PIN) | _BV(LCD_DATA2_PIN) | _BV(LCD_DATA3_PIN) )
+
+/* port pattern for a nibble, used when the data lines share one port */
+#define LCD_NIBBLE(n)       ( ((n) & 0x01 ? _BV(LCD_DATA0_PIN) : 0) | ((n) & 0x02 ? _BV(LCD_DATA1_PIN) : 0) \
+                            | ((n) & 0x04 ? _BV(LCD_DATA2_PIN) : 0) | ((n) & 0x08 ? _BV(LCD_DATA3_PIN) : 0) )
+#endif
+
 #if LCD_IO_MODE
 #if LCD_LINES==1
 #define LCD_FUNCTION_DEFAULT    LCD_FUNCTION_4BIT_1LINE 
@@ -67,6 +87,17 @@
 #endif
 #endif
 
+/* the controller has 8 user-definable 5x8 characters in CGRAM */
+#define LCD_CGRAM_SLOTS         8
+#define LCD_CGRAM_ROWS          8
+
+/* codes 0..7 and 8..15 both address the CGRAM slots, but 0 ends a C string and 10 is the
+   newline of lcd_putc(), so slot 0 is given as 8 and the other slots as 1..7 */
+#define LCD_CGRAM_CHAR(slot)    ((slot) ? (slot) : 8)
+
+/* ROM character used for a completely filled bar graph cell */
+#define LCD_BAR_FULL            0xFF
+
 #if LCD_CONTROLLER_KS0073
 #if LCD_LINES==4
 
@@ -83,6 +114,56 @@
 #if LCD_IO_MODE
 static void toggle_e(void);
 #endif
+#if LCD_LINES==2
+static void lcd_page_sync(char fill);
+#endif
+
+/*
+** CGRAM glyph cache state
+*/
+static const uint8_t *glyphSlot[LCD_CGRAM_SLOTS];  /* PROGMEM glyph loaded in each slot, NULL: free */
+static uint8_t glyphLru[LCD_CGRAM_SLOTS];           /* slot numbers, most recently used first */
+static uint16_t cgramUploads;                       /* number of glyphs written to CGRAM */
+
+#if LCD_IO_MODE
+/* precomputed port patterns for the configured data pins, see LCD_NIBBLE() */
+static const uint8_t nibblePort[16] = {
+    LCD_NIBBLE(0),  LCD_NIBBLE(1),  LCD_NIBBLE(2),  LCD_NIBBLE(3),
+    LCD_NIBBLE(4),  LCD_NIBBLE(5),  LCD_NIBBLE(6),  LCD_NIBBLE(7),
+    LCD_NIBBLE(8),  LCD_NIBBLE(9),  LCD_NIBBLE(10), LCD_NIBBLE(11),
+    LCD_NIBBLE(12), LCD_NIBBLE(13), LCD_NIBBLE(14), LCD_NIBBLE(15)
+};
+static uint8_t dataPinsOutput;                      /* data pins are configured as output */
+#endif
+#if LCD_WRITE_ONLY
+static uint8_t addressCounter;                      /* software copy of the controller's address counter */
+static uint8_t cgramSelected;                       /* address counter points into CGRAM */
+static uint8_t slowCommand;                         /* last command was clear or home */
+#endif
+
+/*
+** DDRAM page state
+*/
+static uint16_t busCycles;                          /* read and write cycles on the LCD bus */
+static uint16_t busyTimeouts;                       /* busy flag waits that gave up */
+#if LCD_LINES==2
+static char pageShadow[LCD_PAGES][LCD_LINES][LCD_DISP_LENGTH];  /* DDRAM content of each page, 0: unknown */
+static char pageNext[LCD_LINES][LCD_DISP_LENGTH];  /* screen composed by lcd_page_puts() */
+static uint8_t pageVisible;                         /* page currently scrolled into view */
+static uint8_t marqueeLine;                         /* line scrolled by lcd_marquee_step(), 0xFF: none */
+static uint8_t marqueeShifted;                      /* marquee moves the whole display, undone by lcd_home() */
+static uint8_t marqueeOffset;                       /* characters scrolled so far, 0..LCD_DDRAM_LINE_CELLS-1 */
+static char marqueeText[LCD_DDRAM_LINE_CELLS];      /* marquee text padded with spaces as DDRAM holds it */
+#endif
+
+/* partially filled bar graph cells, 1..4 pixel columns lit from the left */
+static const uint8_t PROGMEM barGlyph[LCD_BAR_STEPS-1][LCD_CGRAM_ROWS] = {
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },
+    { 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18 },
+    { 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C },
+    { 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E }
+};
+
 
 /*
 ** local functions
@@ -119,6 +200,7 @@ static void lcd_write(uint8_t data,uint8_t rs)
 {
     unsigned char dataBits ;
 
+    busCycles++;
 
     if (rs) {        /* write data        (RS=1, RW=0) */
        lcd_rs_high();
@@ -127,11 +209,13 @@ static void lcd_write(uint8_t data,uint8_t rs)
     }
     lcd_rw_low();    /* RW=0  write mode      */
 
-    if ( ( &LCD_DATA0_PORT == &LCD_DATA1_PORT) && ( &LCD_DATA1_PORT == &LCD_DATA2_PORT ) && ( &LCD_DATA2_PORT == &LCD_DATA3_PORT )
-      && (LCD_DATA0_PIN == 0) && (LCD_DATA1_PIN == 1) && (LCD_DATA2_PIN == 2) && (LCD_DATA3_PIN == 3) )
+    if ( LCD_DATA_SAME_PORT && (LCD_DATA0_PIN == 0) && LCD_DATA_SHIFTED )
     {
-        /* configure data pins as output */
-        DDR(LCD_DATA0_PORT) |= 0x0F;
+        /* configure data pins as output, unless the last access was a write */
+        if ( !dataPinsOutput ) {
+            DDR(LCD_DATA0_PORT) |= 0x0F;
+            dataPinsOutput = 1;
+        }
 
         /* output high nibble first */
         dataBits = LCD_DATA0_PORT & 0xF0;
@@ -145,13 +229,36 @@ static void lcd_write(uint8_t data,uint8_t rs)
         /* all data pins high (inactive) */
         LCD_DATA0_PORT = dataBits | 0x0F;
     }
+    else if ( LCD_DATA_SAME_PORT )
+    {
+        /* data lines on other pins of one port: one port write per nibble via lookup table */
+        if ( !dataPinsOutput ) {
+            DDR(LCD_DATA0_PORT) |= LCD_DATA_MASK;
+            dataPinsOutput = 1;
+        }
+
+        /* output high nibble first */
+        dataBits = LCD_DATA0_PORT & ~LCD_DATA_MASK;
+        LCD_DATA0_PORT = dataBits | nibblePort[data>>4];
+        lcd_e_toggle();
+
+        /* output low nibble */
+        LCD_DATA0_PORT = dataBits | nibblePort[data&0x0F];
+        lcd_e_toggle();
+
+        /* all data pins high (inactive) */
+        LCD_DATA0_PORT = dataBits | LCD_DATA_MASK;
+    }
     else
     {
         /* configure data pins as output */
-        DDR(LCD_DATA0_PORT) |= _BV(LCD_DATA0_PIN);
-        DDR(LCD_DATA1_PORT) |= _BV(LCD_DATA1_PIN);
-        DDR(LCD_DATA2_PORT) |= _BV(LCD_DATA2_PIN);
-        DDR(LCD_DATA3_PORT) |= _BV(LCD_DATA3_PIN);
+        if ( !dataPinsOutput ) {
+            DDR(LCD_DATA0_PORT) |= _BV(LCD_DATA0_PIN);
+            DDR(LCD_DATA1_PORT) |= _BV(LCD_DATA1_PIN);
+            DDR(LCD_DATA2_PORT) |= _BV(LCD_DATA2_PIN);
+            DDR(LCD_DATA3_PORT) |= _BV(LCD_DATA3_PIN);
+            dataPinsOutput = 1;
+        }
         
         /* output high nibble first */
         LCD_DATA3_PORT &= ~_BV(LCD_DATA3_PIN);
@@ -181,6 +288,35 @@ static void lcd_write(uint8_t data,uint8_t rs)
         LCD_DATA2_PORT |= _BV(LCD_DATA2_PIN);
         LCD_DATA3_PORT |= _BV(LCD_DATA3_PIN);
     }
+
+#if LCD_WRITE_ONLY
+    /* keep track of the address counter, the busy flag cannot be read */
+    if (rs) {
+        addressCounter++;
+#if LCD_LINES==2
+        if ( !cgramSelected && addressCounter == LCD_START_LINE1+LCD_DDRAM_LINE_CELLS )
+            addressCounter = LCD_START_LINE2;
+        else if ( !cgramSelected && addressCounter == LCD_START_LINE2+LCD_DDRAM_LINE_CELLS )
+            addressCounter = LCD_START_LINE1;
+#endif
+        slowCommand = 0;
+    } else if ( data & (1<<LCD_DDRAM) ) {
+        addressCounter = data & ~(1<<LCD_DDRAM);
+        cgramSelected = 0;
+        slowCommand = 0;
+    } else if ( data & (1<<LCD_CGRAM) ) {
+        addressCounter = data & ~(1<<LCD_CGRAM);
+        cgramSelected = 1;
+        slowCommand = 0;
+    } else if ( data & ((1<<LCD_FUNCTION)|(1<<LCD_MOVE)|(1<<LCD_ON)|(1<<LCD_ENTRY_MODE)) ) {
+        slowCommand = 0;
+    } else {
+        /* clear display or return home */
+        addressCounter = 0;
+        cgramSelected = 0;
+        slowCommand = 1;
+    }
+#endif
 }
 #else
 #define lcd_write(d,rs) if (rs) *(volatile uint8_t*)(LCD_IO_DATA) = d; else *(volatile uint8_t*)(LCD_IO_FUNCTION) = d;
@@ -195,11 +331,12 @@ Input:    rs     1: read data
                  0: read busy flag / address counter
 Returns:  byte read from LCD controller
 *************************************************************************/
-#if LCD_IO_MODE
+#if LCD_IO_MODE && !LCD_WRITE_ONLY
 static uint8_t lcd_read(uint8_t rs) 
 {
     uint8_t data;
     
+    busCycles++;
     
     if (rs)
         lcd_rs_high();                       /* RS=1: read data      */
@@ -207,10 +344,10 @@ static uint8_t lcd_read(uint8_t rs)
         lcd_rs_low();                        /* RS=0: read busy flag */
     lcd_rw_high();                           /* RW=1  read mode      */
     
-    if ( ( &LCD_DATA0_PORT == &LCD_DATA1_PORT) && ( &LCD_DATA1_PORT == &LCD_DATA2_PORT ) && ( &LCD_DATA2_PORT == &LCD_DATA3_PORT )
-      && ( LCD_DATA0_PIN == 0 )&& (LCD_DATA1_PIN == 1) && (LCD_DATA2_PIN == 2) && (LCD_DATA3_PIN == 3) )
+    if ( LCD_DATA_SAME_PORT && (LCD_DATA0_PIN == 0) && LCD_DATA_SHIFTED )
     {
         DDR(LCD_DATA0_PORT) &= 0xF0;         /* configure data pins as input */
+        dataPinsOutput = 0;
         
         lcd_e_high();
         lcd_e_delay();        
@@ -224,6 +361,47 @@ static uint8_t lcd_read(uint8_t rs)
         data |= PIN(LCD_DATA0_PORT)&0x0F;    /* read low nibble        */
         lcd_e_low();
     }
+    else if ( LCD_DATA_SAME_PORT )
+    {
+        uint8_t pins;
+
+        /* configure data pins as input, unless the last access was a read */
+        if ( dataPinsOutput ) {
+            DDR(LCD_DATA0_PORT) &= ~LCD_DATA_MASK;
+            dataPinsOutput = 0;
+        }
+
+        /* read high nibble first, sampling the port once per nibble */
+        lcd_e_high();
+        lcd_e_delay();
+        pins = PIN(LCD_DATA0_PORT);
+        lcd_e_low();
+        if ( LCD_DATA_SHIFTED ) {
+            data = ((pins >> LCD_DATA0_PIN) & 0x0F) << 4;
+        } else {
+            data = 0;
+            if ( pins & _BV(LCD_DATA0_PIN) ) data |= 0x10;
+            if ( pins & _BV(LCD_DATA1_PIN) ) data |= 0x20;
+            if ( pins & _BV(LCD_DATA2_PIN) ) data |= 0x40;
+            if ( pins & _BV(LCD_DATA3_PIN) ) data |= 0x80;
+        }
+
+        lcd_e_delay();                       /* Enable 500ns low       */
+
+        /* read low nibble */
+        lcd_e_high();
+        lcd_e_delay();
+        pins = PIN(LCD_DATA0_PORT);
+        lcd_e_low();
+        if ( LCD_DATA_SHIFTED ) {
+            data |= (pins >> LCD_DATA0_PIN) & 0x0F;
+        } else {
+            if ( pins & _BV(LCD_DATA0_PIN) ) data |= 0x01;
+            if ( pins & _BV(LCD_DATA1_PIN) ) data |= 0x02;
+            if ( pins & _BV(LCD_DATA2_PIN) ) data |= 0x04;
+            if ( pins & _BV(LCD_DATA3_PIN) ) data |= 0x08;
+        }
+    }
     else
     {
         /* configure data pins as input */
@@ -231,6 +409,7 @@ static uint8_t lcd_read(uint8_t rs)
         DDR(LCD_DATA1_PORT) &= ~_BV(LCD_DATA1_PIN);
         DDR(LCD_DATA2_PORT) &= ~_BV(LCD_DATA2_PIN);
         DDR(LCD_DATA3_PORT) &= ~_BV(LCD_DATA3_PIN);
+        dataPinsOutput = 0;
                 
         /* read high nibble first */
         lcd_e_high();
@@ -255,7 +434,7 @@ static uint8_t lcd_read(uint8_t rs)
     }
     return data;
 }
-#else
+#elif !LCD_IO_MODE
 #define lcd_read(rs) (rs) ? *(volatile uint8_t*)(LCD_IO_DATA+LCD_IO_READ) : *(volatile uint8_t*)(LCD_IO_FUNCTION+LCD_IO_READ)
 /* rs==0 -> read instruction from LCD_IO_FUNCTION */
 /* rs==1 -> read data from LCD_IO_DATA */
@@ -264,14 +443,35 @@ static uint8_t lcd_read(uint8_t rs)
 
 /*************************************************************************
 loops while lcd is busy, returns address counter
+gives up after LCD_BUSY_POLLS reads so a dead display cannot hang the caller
 *************************************************************************/
+#if LCD_WRITE_ONLY
+static uint8_t lcd_waitbusy(void)
+{
+    /* RW is tied low: wait the worst case execution time of the last access */
+    if (slowCommand) {
+        delay(LCD_DELAY_CLEAR);
+        slowCommand = 0;
+    } else {
+        delay(LCD_DELAY_COMMAND);
+    }
+    return addressCounter;
+
+}/* lcd_waitbusy */
+#else
 static uint8_t lcd_waitbusy(void)
 
 {
     register uint8_t c;
+    uint16_t polls = LCD_BUSY_POLLS;
     
     /* wait until busy flag is cleared */
-    while ( (c=lcd_read(0)) & (1<<LCD_BUSY)) {}
+    while ( (c=lcd_read(0)) & (1<<LCD_BUSY)) {
+        if (--polls == 0) {
+            busyTimeouts++;
+            break;
+        }
+    }
     
     /* the address counter is updated 4us after the busy flag is cleared */
     delay(LCD_DELAY_BUSY_FLAG);
@@ -280,6 +480,7 @@ static uint8_t lcd_waitbusy(void)
     return (lcd_read(0));  // return address counter
     
 }/* lcd_waitbusy */
+#endif
 
 
 /*************************************************************************
@@ -400,6 +601,10 @@ Clear display and set cursor to home position
 void lcd_clrscr(void)
 {
     lcd_command(1<<LCD_CLR);
+#if LCD_LINES==2
+    /* clear fills DDRAM with spaces and undoes any display shift */
+    lcd_page_sync(' ');
+#endif
 }
 
 
@@ -409,6 +614,10 @@ Set cursor to home position
 void lcd_home(void)
 {
     lcd_command(1<<LCD_HOME);
+#if LCD_LINES==2
+    pageVisible = 0;                /* home also undoes the display shift */
+    marqueeShifted = 0;             /* a marquee goes on by rewriting its line */
+#endif
 }
 
 
@@ -493,6 +702,369 @@ void lcd_puts_p(const char *progmem_s)
 }/* lcd_puts_p */
 
 
+/*************************************************************************
+Forget all glyphs loaded to CGRAM, next lcd_glyph() calls upload again
+*************************************************************************/
+void lcd_glyph_flush(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < LCD_CGRAM_SLOTS; i++) {
+        glyphSlot[i] = 0;
+        glyphLru[i] = LCD_CGRAM_SLOTS-1-i;   /* slot 0 is evicted first */
+    }
+}/* lcd_glyph_flush */
+
+
+/*************************************************************************
+Get character code of a custom glyph, loading it into CGRAM if needed
+Input:    progmem_glyph  8 row bitmaps (5 LSBs used) in program memory
+Returns:  character code to pass to lcd_putc() / put into strings
+*************************************************************************/
+uint8_t lcd_glyph(const uint8_t *progmem_glyph)
+{
+    uint8_t i, slot, addressCounter;
+
+
+    /* look the glyph up, the slot found last is the least recently used one */
+    for (i = 0; i < LCD_CGRAM_SLOTS-1; i++) {
+        if (glyphSlot[glyphLru[i]] == progmem_glyph) {
+            break;
+        }
+    }
+    slot = glyphLru[i];
+
+    /* move the slot to the front of the LRU list */
+    for ( ; i > 0; i--) {
+        glyphLru[i] = glyphLru[i-1];
+    }
+    glyphLru[0] = slot;
+
+    if (glyphSlot[slot] != progmem_glyph)
+    {
+        /* miss: overwrite the least recently used slot and restore the cursor */
+        addressCounter = lcd_waitbusy();
+        lcd_command((1<<LCD_CGRAM) | (slot*LCD_CGRAM_ROWS));
+        for (i = 0; i < LCD_CGRAM_ROWS; i++) {
+            lcd_data(pgm_read_byte(progmem_glyph++));
+        }
+        lcd_command((1<<LCD_DDRAM) | addressCounter);
+
+        glyphSlot[slot] = progmem_glyph - LCD_CGRAM_ROWS;
+        cgramUploads++;
+    }
+    return LCD_CGRAM_CHAR(slot);
+
+}/* lcd_glyph */
+
+
+/*************************************************************************
+Return number of glyphs uploaded to CGRAM since power-on
+*************************************************************************/
+uint16_t lcd_glyph_uploads(void)
+{
+    return cgramUploads;
+}
+
+
+/*************************************************************************
+Draw horizontal bar graph with 5 steps per character cell
+Input:    x, y    position of the leftmost cell
+          width   number of character cells used by the graph
+          value   current value, clipped to max
+          max     value that fills the whole graph
+Returns:  none
+*************************************************************************/
+void lcd_bargraph(uint8_t x, uint8_t y, uint8_t width, uint16_t value, uint16_t max)
+{
+    uint16_t lit;
+    uint8_t  partial;
+
+
+    if (value > max) {
+        value = max;
+    }
+    lit = max ? (uint32_t)value * width * LCD_BAR_STEPS / max : 0;
+
+    /* partial glyph is fetched before positioning, an upload would move the cursor */
+    partial = lit % LCD_BAR_STEPS;
+    if (partial) {
+        partial = lcd_glyph(barGlyph[partial-1]);
+    }
+
+    lcd_gotoxy(x, y);
+    for ( ; width > 0; width--) {
+        if (lit >= LCD_BAR_STEPS) {
+            lcd_data(LCD_BAR_FULL);
+            lit -= LCD_BAR_STEPS;
+        } else if (lit) {
+            lcd_data(partial);
+            lit = 0;
+        } else {
+            lcd_data(' ');
+        }
+    }
+}/* lcd_bargraph */
+
+
+/*************************************************************************
+Return number of LCD bus read and write cycles since power-on
+*************************************************************************/
+uint16_t lcd_bus_cycles(void)
+{
+    return busCycles;
+}
+
+
+/*************************************************************************
+Return number of busy flag waits that gave up
+*************************************************************************/
+uint16_t lcd_busy_timeouts(void)
+{
+    return busyTimeouts;
+}
+
+
+#if LCD_LINES==2
+/*************************************************************************
+Reset page bookkeeping after the whole DDRAM was set to <fill>
+and the display shift was undone
+*************************************************************************/
+static void lcd_page_sync(char fill)
+{
+    uint8_t page, y, x;
+
+    for (page = 0; page < LCD_PAGES; page++)
+        for (y = 0; y < LCD_LINES; y++)
+            for (x = 0; x < LCD_DISP_LENGTH; x++)
+                pageShadow[page][y][x] = fill;
+    for (y = 0; y < LCD_LINES; y++)
+        for (x = 0; x < LCD_DISP_LENGTH; x++)
+            pageNext[y][x] = fill;
+    pageVisible = 0;
+    marqueeLine = 0xFF;
+    marqueeShifted = 0;
+}/* lcd_page_sync */
+
+
+/*************************************************************************
+Write a line of a page.
+Only cells that differ from the shadow of that page are written.
+*************************************************************************/
+static void lcd_page_write_line(uint8_t page, uint8_t y, const char *line)
+{
+    uint8_t x, positioned;
+    char    *shadow;
+
+
+    shadow = pageShadow[page][y];
+    positioned = 0;
+    for (x = 0; x < LCD_DISP_LENGTH; x++)
+    {
+        if (shadow[x] == line[x]) {
+            positioned = 0;     /* skip cell, address counter no longer matches */
+            continue;
+        }
+        if (!positioned) {
+            lcd_command((1<<LCD_DDRAM) + (y ? LCD_START_LINE2 : LCD_START_LINE1) + page*LCD_DISP_LENGTH + x);
+            positioned = 1;
+        }
+        lcd_data(line[x]);
+        shadow[x] = line[x];
+    }
+}/* lcd_page_write_line */
+
+
+/*************************************************************************
+Write the composed screen to the hidden page
+*************************************************************************/
+static void lcd_page_write(void)
+{
+    uint8_t y;
+
+    for (y = 0; y < LCD_LINES; y++) {
+        lcd_page_write_line(pageVisible ^ 1, y, pageNext[y]);
+    }
+}/* lcd_page_write */
+
+
+/*************************************************************************
+Get the visible part of the marquee text after marqueeOffset steps,
+the text wraps around like the display shift does
+*************************************************************************/
+static void lcd_marquee_window(char *line)
+{
+    uint8_t x, i;
+
+    i = marqueeOffset;
+    for (x = 0; x < LCD_DISP_LENGTH; x++) {
+        line[x] = marqueeText[i];
+        if (++i == LCD_DDRAM_LINE_CELLS) {
+            i = 0;
+        }
+    }
+}/* lcd_marquee_window */
+
+
+/*************************************************************************
+Compose a line of the next screen, shown by lcd_page_flip()
+Input:    y  line (0: first line)
+          s  string, truncated or padded with spaces to LCD_DISP_LENGTH
+Returns:  none
+*************************************************************************/
+void lcd_page_puts(uint8_t y, const char *s)
+{
+    uint8_t x;
+
+    if (y == marqueeLine) {
+        marqueeLine = 0xFF;         /* replaced, a shifted display stays until the flip */
+    }
+    for (x = 0; x < LCD_DISP_LENGTH; x++) {
+        pageNext[y][x] = *s ? *s++ : ' ';
+    }
+}/* lcd_page_puts */
+
+
+/*************************************************************************
+Start the next screen from the visible one, so single lines can be changed
+*************************************************************************/
+void lcd_page_copy(void)
+{
+    uint8_t y, x;
+
+    for (y = 0; y < LCD_LINES; y++)
+        for (x = 0; x < LCD_DISP_LENGTH; x++)
+            pageNext[y][x] = pageShadow[pageVisible][y][x];
+}/* lcd_page_copy */
+
+
+/*************************************************************************
+Render the composed screen into the hidden page and show it
+*************************************************************************/
+void lcd_page_flip(void)
+{
+    uint8_t i, y;
+
+
+    if (marqueeShifted) {
+        lcd_home();                 /* undo the marquee shift, page shadows are still valid */
+    }
+    if (marqueeLine != 0xFF) {
+        lcd_marquee_window(pageNext[marqueeLine]);  /* the marquee goes on in the new screen */
+    }
+
+    /* nothing to do if the composed screen is already shown */
+    for (y = 0; y < LCD_LINES; y++) {
+        for (i = 0; i < LCD_DISP_LENGTH; i++) {
+            if (pageNext[y][i] != pageShadow[pageVisible][y][i]) {
+                break;
+            }
+        }
+        if (i < LCD_DISP_LENGTH) {
+            break;
+        }
+    }
+    if (y == LCD_LINES) {
+        return;
+    }
+
+    lcd_page_write();
+    if (pageVisible) {
+        /* a single command returns the display shift to column 0 */
+        lcd_home();
+    } else {
+        for (i = 0; i < LCD_DISP_LENGTH; i++) {
+            lcd_command(LCD_MOVE_DISP_LEFT);
+        }
+        pageVisible = 1;
+    }
+}/* lcd_page_flip */
+
+
+/*************************************************************************
+Show text longer than the display as a marquee.
+The display is shifted in hardware while the other line is empty,
+otherwise only line y is rewritten at each step.
+Input:    y  line of the text, the other line is kept
+          s  string, at most LCD_DDRAM_LINE_CELLS characters are used
+Returns:  none
+*************************************************************************/
+void lcd_marquee_puts(uint8_t y, const char *s)
+{
+    uint8_t x, page, length;
+    char    line[LCD_DISP_LENGTH];
+
+
+    for (length = 0; length < LCD_DDRAM_LINE_CELLS && s[length]; length++) {
+        marqueeText[length] = s[length];
+    }
+    for (x = length; x < LCD_DDRAM_LINE_CELLS; x++) {
+        marqueeText[x] = ' ';
+    }
+    marqueeOffset = 0;
+
+    for (x = 0; x < LCD_DISP_LENGTH && pageShadow[pageVisible][y ^ 1][x] == ' '; x++)
+        ;
+    if (x < LCD_DISP_LENGTH)
+    {
+        /* the display shift would move the other line too */
+        if (marqueeShifted) {
+            lcd_home();
+        }
+        lcd_marquee_window(line);
+        lcd_page_write_line(pageVisible, y, line);
+        marqueeLine = y;
+        return;
+    }
+
+    lcd_clrscr();
+    lcd_gotoxy(0, y);
+    for (x = 0; x < length; x++) {
+        lcd_data(s[x]);
+    }
+
+    /* the text crosses both pages of line y, the shadows keep what it left there
+       so the screen composed from them after the marquee shows its start */
+    for (page = 0; page < LCD_PAGES; page++)
+        for (x = 0; x < LCD_DISP_LENGTH; x++)
+            pageShadow[page][y][x] = marqueeText[page*LCD_DISP_LENGTH + x];
+    marqueeLine = y;
+    marqueeShifted = 1;
+}/* lcd_marquee_puts */
+
+
+/*************************************************************************
+Scroll the marquee text one character to the left
+*************************************************************************/
+void lcd_marquee_step(void)
+{
+    char line[LCD_DISP_LENGTH];
+
+    if (marqueeLine == 0xFF) {
+        return;
+    }
+    if (++marqueeOffset == LCD_DDRAM_LINE_CELLS) {
+        marqueeOffset = 0;
+    }
+    if (marqueeShifted) {
+        lcd_command(LCD_MOVE_DISP_LEFT);
+    } else {
+        lcd_marquee_window(line);
+        lcd_page_write_line(pageVisible, marqueeLine, line);
+    }
+}
+
+
+/*************************************************************************
+Return 1 while a marquee is shown
+*************************************************************************/
+uint8_t lcd_marquee_active(void)
+{
+    return marqueeLine != 0xFF;
+}
+#endif /* LCD_LINES==2 */
+
+
 /*************************************************************************
 Initialize display and select type of cursor 
 Input:    dispAttr LCD_DISP_OFF            display off
@@ -522,14 +1094,14 @@ void lcd_init(uint8_t dispAttr)
         /* configure all port bits as output (all LCD data lines on same port, but control lines on different ports) */
         DDR(LCD_DATA0_PORT) |= 0x0F;
         DDR(LCD_RS_PORT)    |= _BV(LCD_RS_PIN);
-        DDR(LCD_RW_PORT)    |= _BV(LCD_RW_PIN);
+        lcd_rw_ddr_out();
         DDR(LCD_E_PORT)     |= _BV(LCD_E_PIN);
     }
     else
     {
         /* configure all port bits as output (LCD data and control lines on different ports */
         DDR(LCD_RS_PORT)    |= _BV(LCD_RS_PIN);
-        DDR(LCD_RW_PORT)    |= _BV(LCD_RW_PIN);
+        lcd_rw_ddr_out();
         DDR(LCD_E_PORT)     |= _BV(LCD_E_PIN);
         DDR(LCD_DATA0_PORT) |= _BV(LCD_DATA0_PIN);
         DDR(LCD_DATA1_PORT) |= _BV(LCD_DATA1_PIN);
@@ -588,5 +1160,6 @@ void lcd_init(uint8_t dispAttr)
     lcd_clrscr();                           /* display clear                */ 
     lcd_command(LCD_MODE_DEFAULT);          /* set entry mode               */
     lcd_command(dispAttr);                  /* display/cursor control       */
+    lcd_glyph_flush();                      /* CGRAM content undefined      */
 
 }/* lcd_init */
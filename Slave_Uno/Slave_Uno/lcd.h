@@ -100,6 +100,10 @@
 #ifndef LCD_START_LINE4
 #define LCD_START_LINE4  0x54     /**< DDRAM address of first char of line 4 */
 #endif
+#ifndef LCD_DDRAM_LINE_CELLS
+#define LCD_DDRAM_LINE_CELLS 0x28   /**< DDRAM cells per line in 2-line mode, beyond the visible ones */
+#endif
+#define LCD_PAGES  (LCD_DDRAM_LINE_CELLS/LCD_DISP_LENGTH)  /**< screens that fit side by side into DDRAM */
 #ifndef LCD_WRAP_LINES
 #define LCD_WRAP_LINES      0     /**< 0: no wrap, 1: wrap at end of visibile line */
 #endif
@@ -124,6 +128,9 @@
  *  
  */
 #define LCD_IO_MODE      1            /**< 0: memory mapped mode, 1: IO port mode */
+#ifndef LCD_WRITE_ONLY
+#define LCD_WRITE_ONLY   0            /**< 1: RW tied to GND, busy flag not read but timed delays used */
+#endif
 
 #if LCD_IO_MODE
 
@@ -214,6 +221,15 @@
 #ifndef LCD_DELAY_BUSY_FLAG
 #define LCD_DELAY_BUSY_FLAG    4      /**< time in micro seconds the address counter is updated after busy flag is cleared */
 #endif
+#ifndef LCD_BUSY_POLLS
+#define LCD_BUSY_POLLS      2000      /**< busy flag reads before giving up, each read takes more than 1 us */
+#endif
+#ifndef LCD_DELAY_COMMAND
+#define LCD_DELAY_COMMAND     50      /**< execution time of a command or data write in micro seconds, LCD_WRITE_ONLY mode */
+#endif
+#ifndef LCD_DELAY_CLEAR
+#define LCD_DELAY_CLEAR     2000      /**< execution time of clear display and return home in micro seconds, LCD_WRITE_ONLY mode */
+#endif
 #ifndef LCD_DELAY_ENABLE_PULSE
 #define LCD_DELAY_ENABLE_PULSE 1      /**< enable signal pulse width in micro seconds */
 #endif
@@ -275,6 +291,12 @@
 #define LCD_MODE_DEFAULT     ((1<<LCD_ENTRY_MODE) | (1<<LCD_ENTRY_INC) )
 
 
+/**
+ * @name Definitions for custom characters
+ */
+#define LCD_BAR_STEPS        5      /**< bar graph resolution per character cell (5x8 font) */
+
+
 
 /** 
  *  @name Functions
@@ -359,6 +381,119 @@ extern void lcd_command(uint8_t cmd);
 extern void lcd_data(uint8_t data);
 
 
+/**
+ @brief    Get character code of a custom glyph, loading it into CGRAM on demand
+
+ The 8 CGRAM slots are managed as a least recently used cache keyed by the
+ glyph address, so a glyph already loaded is never uploaded again.
+ Evicting a slot changes every character on screen still using it.
+ @param    progmem_glyph 8 row bitmaps (5 LSBs used) in program memory
+ @return   character code 1..8 to pass to lcd_putc() or to put into strings
+*/
+extern uint8_t lcd_glyph(const uint8_t *progmem_glyph);
+
+
+/**
+ @brief    Forget all glyphs loaded to CGRAM
+ @return   none
+*/
+extern void lcd_glyph_flush(void);
+
+
+/**
+ @brief    Number of glyphs uploaded to CGRAM since power-on
+ @return   upload count, stays constant while a screen is redrawn from cache
+*/
+extern uint16_t lcd_glyph_uploads(void);
+
+
+/**
+ @brief    Draw horizontal bar graph with LCD_BAR_STEPS steps per character cell
+ @param    x leftmost cell of the graph
+ @param    y line of the graph
+ @param    width number of character cells used
+ @param    value current value, clipped to max
+ @param    max value that fills the whole graph
+ @return   none
+*/
+extern void lcd_bargraph(uint8_t x, uint8_t y, uint8_t width, uint16_t value, uint16_t max);
+
+
+/**
+ @brief    Number of LCD bus read and write cycles since power-on
+ @return   cycle count, wraps around at 65535
+*/
+extern uint16_t lcd_bus_cycles(void);
+
+
+/**
+ @brief    Number of waits for the busy flag that gave up after LCD_BUSY_POLLS reads
+ @return   timeout count, non-zero means the display is not answering
+*/
+extern uint16_t lcd_busy_timeouts(void);
+
+
+#if LCD_LINES==2
+/**
+ @brief    Compose a line of the next screen
+ 
+ DDRAM holds LCD_PAGES screens side by side. lcd_page_flip() writes the
+ composed screen to a page that is shifted out of view and then shows it,
+ so the user never sees a half drawn screen. Only cells that differ from
+ what that page already holds are written. Do not mix with lcd_gotoxy()
+ and lcd_puts() unless lcd_clrscr() is called in between.
+ @param    y line (0: first line)
+ @param    s string, truncated or padded with spaces to LCD_DISP_LENGTH
+ @return   none
+*/
+extern void lcd_page_puts(uint8_t y, const char *s);
+
+
+/**
+ @brief    Start the next screen from the visible one
+ @return   none
+*/
+extern void lcd_page_copy(void);
+
+
+/**
+ @brief    Render the composed screen into the hidden page and show it
+ 
+ Does nothing if the composed screen is the one already shown.
+ @return   none
+*/
+extern void lcd_page_flip(void);
+
+
+/**
+ @brief    Show text longer than the display, scrolled by lcd_marquee_step()
+ 
+ The other line is kept. While it is empty the whole display is shifted
+ with a single command per step, otherwise only line y is rewritten.
+ The marquee goes on across lcd_page_flip() until lcd_page_puts() replaces
+ its line.
+ @param    y line of the text
+ @param    s string, at most LCD_DDRAM_LINE_CELLS characters are shown
+ @return   none
+*/
+extern void lcd_marquee_puts(uint8_t y, const char *s);
+
+
+/**
+ @brief    Scroll the marquee one character to the left
+ @return   none
+*/
+extern void lcd_marquee_step(void);
+
+
+/**
+ @brief    Check if a marquee is shown
+ @return   1 while a marquee is shown, else 0
+*/
+extern uint8_t lcd_marquee_active(void);
+#endif
+
+
 /**
  @brief macros for automatically storing string constant in program memory
 */
@@ -10,6 +10,8 @@
 #define BAUD 9600
 #define MYUBRR (FOSC/16/BAUD-1)
 #define CHAR_ARRAY_SIZE 40
+#define FRAME_SIZE 64 // Longest frame from Mega: address, sequence number, commands and the terminating zero, the CRC comes after
+#define COMMAND_SEPARATOR ';' // Between the commands of one frame
 
 /*Definitions to switch cases*/
 #define WAIT_COMMAND 0
@@ -19,12 +21,61 @@
 #define DISPLAY_CLEAR 4
 #define DISPLAY_SECOND_ROW 5
 #define POWER_OFF 6
+#define ENERGY_REPORT 7
+#define STATS_REPORT 8
 
 //Defining Pins
 //#define GREEN_LED PD0 //Pin 0 connected to Green LED
 //#define RED_LED PD1 //Pin 1 connected to Red LED
 #define BUZZER_PIN PB1
 
+/*LCD page flipping*/
+#define PRESENT_IDLE_TICKS 2 // Timer0 overflows (16.4 ms each) without a new frame before a composed screen is shown
+#define MARQUEE_STEP_TICKS 20 // Timer0 overflows between marquee steps, about 330 ms
+
+// A frame takes at most 64 ms even if every byte is late, printing it about 80 ms
+#define WATCHDOG_TIMEOUT WDTO_1S
+
+/*Sleeping between frames*/
+#define WAKE_LATENCY_MAX_US 255 // Kept in a byte, a longer wake up is shown as this
+
+/*Priority lanes*/
+#define SIREN_LATENCY_BOUND_US 1000 // From SS to the buzzer, a full frame at the default SPI clock takes about 0.5 ms
+
+/*Energy accounting*/
+#define ENERGY_TICK_US 16384 // Timer0 overflow, the time awake and in idle is sampled on it
+#define ENERGY_STANDBY_PERIOD_MS 16 // Watchdog interrupt counting the time in standby, about 10 % accurate
+#define ENERGY_OFF_PERIOD_MS 1000 // Same in power-down, each wake up from it starts the crystal again (1 ms)
+
+/*Serial output*/
+#define UART_TX_SIZE 128 // Characters waiting to be sent, a power of two
+#define DIAGNOSTIC_ROOM 80 // Free space needed for a line printed between frames, otherwise the line is skipped
+
+/*Profiler*/
+#define PROFILE_DUMP_SAMPLES 4096 // Printed after the frame that reaches this, about 4 s of samples while awake
+
+/*Addresses, the first byte of a frame*/
+#define SLAVE_ADDRESS 1 // Row of this Uno in the device table of Mega, set for each Uno when building
+#define BROADCAST_ADDRESS 0 // Frames for all the slaves
+
+/*Link to Mega*/
+#define REPLY_ACK 0x06 // Sent on MISO after a frame to this Uno that passed the CRC
+#define REPLY_NAK 0x15 // The frame was corrupted and dropped
+#define REPLY_DUPLICATE 0x07 // Same sequence number as the last frame, not run again
+#define REPLY_RESET 0x08 // First frame since this Uno started
+#define TEST_MARKER 0x7F // Second byte of a self-test frame from Mega
+#define SEQUENCE_FLAG 0x80 // Always set in the sequence number, alone it marks the first frame after Mega started
+#define NO_SEQUENCE 0 // No frame yet, Mega never sends it
+
+/*Tracing*/
+#define FRAME_TRACE 0 // Set to 1 together with SPI_BUS_TRACE of Mega, the frames then carry the time of SS on Mega's clock
+#define TRACE_TIME_BYTES 4 // Between the terminating zero and the CRC, LSB first
+#define TRACE_TICK_US 64 // Timer0 count with pre-scaler 1024
+#define TRACE_NONE 0 // Stages of the last frame
+#define TRACE_RECEIVED 1
+#define TRACE_RUN 2
+#define TRACE_SHOWN 3
+
 #include <avr/io.h>
 #include <util/delay.h>
 #include <util/setbaud.h>
@@ -32,7 +83,13 @@
 #include <avr/interrupt.h>
 #include <string.h>
 #include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
 #include "lcd.h" // Source: From the provided course material
+#include "spin_timeout.h"
+#include "fmt.h"
+#include "mem_monitor.h"
+#include "profiler.h"
 
 /*USART*/
 /*Source from course material*/
@@ -40,7 +97,7 @@
 /* 
 These functions are for 
 communicating between the Arduino and the computer through the USB.
-Can be used by printf();. 
+Can be used by fmt_print();. 
 */
 
 static void
@@ -55,26 +112,134 @@ USART_Init( uint16_t ubrr)
 	UCSR0C = (1<<USBS0)|(3<<UCSZ00);
 }
 
+// Waits until the transmit buffer is empty, returns SPIN_TIMEOUT if it did not get empty in time
+static uint8_t
+USART_Wait_Empty()
+{
+	uint16_t polls = SPIN_LIMIT_UART_US;
+	
+	while ( !( UCSR0A & (1<<UDRE0)) )
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_UART);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+	return SPIN_OK;
+}
+
+static uint8_t g_uart_used = 0; // Transmit complete flag is only valid after the first character
+
+/*
+The characters wait in a ring buffer and the data register empty interrupt sends them. Printing
+after a frame only takes the time to format the line, so the Uno listens again long before
+Mega sends the next frame instead of after the 1.15 ms each character takes on the line.
+*/
+static uint8_t g_tx_buffer[UART_TX_SIZE];
+static volatile uint8_t g_tx_head = 0; // Next free place, moved by the main loop
+static volatile uint8_t g_tx_tail = 0; // Next character to send, moved by the interrupt
+static uint16_t g_lines_skipped = 0; // Lines between frames left out while the buffer was full
+
+ISR(USART_UDRE_vect)
+{
+	if (g_tx_tail == g_tx_head)
+	{
+		UCSR0B &= ~(1 << UDRIE0);
+		return;
+	}
+	// Transmit complete is cleared with a plain write, the flags written back by |= would be cleared too
+	UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+	UDR0 = g_tx_buffer[g_tx_tail];
+	g_tx_tail = (g_tx_tail + 1) & (UART_TX_SIZE - 1);
+}
+
+/*
+Time in each power mode and the work of the peripherals since the start, for tools/energy.py.
+Timer0 samples the time awake, in idle and with the buzzer on. It stops in standby and power-down,
+there the watchdog interrupt counts the periods instead. A sleep ended by a frame is counted
+as a wake up, the part of the period it slept is not known.
+*/
+static volatile uint32_t g_energy_active = 0; // Timer0 overflows
+static volatile uint32_t g_energy_idle = 0;
+static volatile uint32_t g_energy_buzzer = 0;
+static volatile uint32_t g_energy_standby = 0; // Watchdog periods
+static volatile uint32_t g_energy_off = 0;
+static volatile uint8_t g_energy_watchdog_woke = 0;
+static uint16_t g_energy_standby_wakes = 0;
+static uint16_t g_energy_off_wakes = 0;
+static uint32_t g_energy_spi_bytes = 0; // All the frames on the bus, the shift register takes them in anyway
+static uint32_t g_energy_uart_bytes = 0;
+static uint32_t g_energy_lcd_cycles = 0;
+static uint16_t g_energy_lcd_last = 0; // lcd_bus_cycles() at the last count, it wraps at 65535
+
 static void
 USART_Transmit( unsigned char data, FILE *stream )
 {
-	/* Wait for empty transmit buffer */
-	while ( !( UCSR0A & (1<<UDRE0)) )
+	uint8_t next = (g_tx_head + 1) & (UART_TX_SIZE - 1);
+	uint16_t polls = SPIN_LIMIT_UART_US;
+	
+	/* Wait for room in the buffer, the character is dropped if the interrupt never makes any */
+	while (next == g_tx_tail)
 	{
-		;// Doing nothing at all
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_UART);
+			return;
+		}
+		_delay_us(1);
+	}
+	g_tx_buffer[g_tx_head] = data;
+	g_tx_head = next;
+	UCSR0B |= (1 << UDRIE0);
+	g_uart_used = 1;
+	g_energy_uart_bytes++;
+}
+
+// Free places in the transmit buffer
+static uint8_t
+USART_Room()
+{
+	return (g_tx_tail - g_tx_head - 1) & (UART_TX_SIZE - 1);
+}
+
+// Nothing waiting and the last character has left, sleeping deeper than idle would cut it otherwise
+static uint8_t
+USART_Idle()
+{
+	return g_tx_tail == g_tx_head && (!g_uart_used || (UCSR0A & (1<<TXC0)));
+}
+
+// Waits until all the characters have left
+static void
+USART_Flush()
+{
+	uint16_t polls = SPIN_LIMIT_UART_US;
+	uint8_t tail = g_tx_tail;
+	
+	while ( !USART_Idle() )
+	{
+		// The limit is for one character, it starts again each time one is sent
+		if (g_tx_tail != tail)
+		{
+			tail = g_tx_tail;
+			polls = SPIN_LIMIT_UART_US;
+		}
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_UART);
+			return;
+		}
+		_delay_us(1);
 	}
-	/* Put data into buffer, sends the data */
-	UDR0 = data;
 }
 
 static char
 USART_Receive( FILE *stream)
 {
 	/* Wait for empty transmit buffer */
-	while ( !( UCSR0A & (1<<UDRE0)) )
-	{
-		;// Doing nothing at all
-	}
+	USART_Wait_Empty();
 	/* Get and return received data from buffer */
 	return UDR0;
 }
@@ -97,32 +262,777 @@ topCalculation(int prescale, int frequency)
 	return (F_CPU / 2 * prescale * frequency);
 }
 
-// Waits for the command to be sent from the mega
+static void
+buzzer_set(uint8_t on)
+{
+	if (on)
+	{
+		TCCR1B |= (1 << CS10);
+	}
+	else
+	{
+		TCCR1B &= ~(1 << CS10);
+	}
+}
+
+/*ENERGY*/
+
+// Only enabled while sleeping in standby or power-down
+ISR(WDT_vect)
+{
+	if (SMCR & (1 << SM2))
+	{
+		g_energy_standby++;
+	}
+	else
+	{
+		g_energy_off++;
+	}
+	g_energy_watchdog_woke = 1;
+}
+
+// Puts the watchdog in interrupt mode, the caller has stopped it and sets it back after the sleep
+static void
+energy_watchdog_start(uint8_t prescaler)
+{
+	g_energy_watchdog_woke = 0;
+	wdt_reset();
+	WDTCSR = (1 << WDCE) | (1 << WDE);
+	WDTCSR = (1 << WDIE) | prescaler;
+}
+
+// Adds the LCD bus cycles since the last call, often enough that the counter of lcd.c does not go round twice
+static void
+energy_count_lcd(void)
+{
+	uint16_t cycles = lcd_bus_cycles();
+	
+	g_energy_lcd_cycles += (uint16_t)(cycles - g_energy_lcd_last);
+	g_energy_lcd_last = cycles;
+}
+
+static uint32_t
+energy_snapshot(volatile uint32_t *counter)
+{
+	uint32_t value;
+	uint8_t sreg = SREG;
+	
+	cli();
+	value = *counter;
+	SREG = sreg;
+	return value;
+}
+
+// One line for tools/energy.py
+static void
+print_energy(void)
+{
+	energy_count_lcd();
+	fmt_print("ENERGY uno tick_us=%lu active=%lu idle=%lu buzzer=%lu", (uint32_t)ENERGY_TICK_US,
+		energy_snapshot(&g_energy_active), energy_snapshot(&g_energy_idle), energy_snapshot(&g_energy_buzzer));
+	fmt_print(" standby_ms=%lu standby_wakes=%u standby_period_ms=%u",
+		energy_snapshot(&g_energy_standby) * ENERGY_STANDBY_PERIOD_MS, g_energy_standby_wakes, ENERGY_STANDBY_PERIOD_MS);
+	fmt_print(" off_ms=%lu off_wakes=%u off_period_ms=%u spi_bytes=%lu uart_tx=%lu lcd_cycles=%lu\n\r",
+		energy_snapshot(&g_energy_off) * ENERGY_OFF_PERIOD_MS, g_energy_off_wakes, ENERGY_OFF_PERIOD_MS,
+		g_energy_spi_bytes, g_energy_uart_bytes, g_energy_lcd_cycles);
+}
+
+/*DISPLAY*/
+
+/*
+Screen changes from Mega are rendered to the hidden page of the LCD 
+and shown all at once when no more commands come in.
+*/
+static uint8_t g_screen_pending = 0; // Hidden page holds a screen that is not shown yet
+static uint16_t g_screen_cycles = 0; // LCD bus cycles when composing the screen started
+static uint8_t g_idle_ticks = 0;
+static uint8_t g_marquee_ticks = 0;
+static volatile uint8_t g_display_tick = 0; // Set by the Timer0 overflow, every 16.4 ms
+
+// Time from waking up on SS to the first byte of the frame, measured with Timer2
+static uint8_t g_wake_latency_us = 0;
+static uint8_t g_wake_latency_max_us = 0;
+
+// Time from SS to the buzzer changing, for the frames that carry a buzzer command
+static uint16_t g_siren_latency_us = 0;
+static uint16_t g_siren_latency_max_us = 0;
+static uint16_t g_siren_over_bound = 0;
+static uint16_t g_siren_frames = 0;
+
+static volatile uint8_t g_frame_clock_overflows = 0; // Timer2 overflows since SS went low
+
+#if FRAME_TRACE
+/*
+Stages of the last frame run, counted from SS going low. Mega sends the time of that SS on its
+own clock, so tools/trace_merge.py can put both boards on one timeline. The receive time comes
+from the frame clock, the later stages from Timer0, which keeps running in idle until the screen is shown.
+*/
+static volatile uint8_t g_timer0_overflows = 0;
+static volatile uint16_t g_trace_ss_ticks = 0; // Timer0 when SS went low
+static uint32_t g_trace_master_us; // micros() of Mega when SS went low
+static uint16_t g_trace_rx_us; // CRC checked
+static uint16_t g_trace_run_ticks; // All the commands run
+static uint16_t g_trace_lcd_ticks; // Screen shown
+static uint8_t g_trace_sequence;
+static uint8_t g_trace_stage = TRACE_NONE;
+
+// Timer0 counts since the start, goes round after 4.2 s
+static uint16_t
+trace_ticks(void)
+{
+	uint8_t sreg = SREG;
+	uint8_t count, overflows;
+	
+	cli();
+	count = TCNT0;
+	overflows = g_timer0_overflows;
+	// Overflow that happened after cli() but is not counted yet
+	if ((TIFR0 & (1 << TOV0)) && count < 0x80)
+	{
+		overflows++;
+	}
+	SREG = sreg;
+	return ((uint16_t)overflows << 8) | count;
+}
+
+// Prints the stages of the last frame as a "TRACE uno" line, lcd is only there if its screen was shown
+static void
+trace_print(void)
+{
+	fmt_print("TRACE uno seq=%u t=%lu rx=%u run=%lu", g_trace_sequence, g_trace_master_us, g_trace_rx_us,
+		(uint32_t)g_trace_run_ticks * TRACE_TICK_US);
+	if (g_trace_stage == TRACE_SHOWN)
+	{
+		fmt_print(" lcd=%lu", (uint32_t)g_trace_lcd_ticks * TRACE_TICK_US);
+	}
+	fmt_print("\n\r");
+	g_trace_stage = TRACE_NONE;
+}
+#endif
+
+// Prepares the hidden page for a new screen
+static void
+display_begin(void)
+{
+	if (!g_screen_pending)
+	{
+		g_screen_cycles = lcd_bus_cycles();
+		g_screen_pending = 1;
+	}
+	g_idle_ticks = 0;
+}
+
+// Replaces the whole screen with an empty one
+static void
+display_clear(void)
+{
+	display_begin();
+	lcd_page_puts(0, "");
+	lcd_page_puts(1, "");
+}
+
+// Changes one row, too long text is scrolled as a marquee
+static void
+display_row(uint8_t row, char *text)
+{
+	if (strlen(text) > LCD_DISP_LENGTH)
+	{
+		// Rows composed before it are shown first, the marquee keeps the other row
+		if (g_screen_pending)
+		{
+			lcd_page_flip();
+			g_screen_pending = 0;
+		}
+		lcd_marquee_puts(row, text);
+		g_marquee_ticks = 0;
+		return;
+	}
+	
+	uint8_t first_change = !g_screen_pending;
+	
+	display_begin();
+	// Starting from what is visible so the other row stays as it is
+	if (first_change)
+	{
+		lcd_page_copy();
+	}
+	lcd_page_puts(row, text);
+}
+
+/*
+Called while waiting for a frame from Mega.
+Shows the composed screen once the link has been idle and scrolls the marquee.
+*/
+static void
+display_idle_tasks(void)
+{
+	if (!g_display_tick)
+	{
+		return;
+	}
+	g_display_tick = 0;
+	energy_count_lcd();
+	
+	// Mega has already started the next frame (SS low), not touching the LCD now
+	if (!(PINB & (1 << PB2)))
+	{
+		return;
+	}
+	
+	if (g_screen_pending && ++g_idle_ticks >= PRESENT_IDLE_TICKS)
+	{
+		lcd_page_flip();
+		g_screen_pending = 0;
+#if FRAME_TRACE
+		if (g_trace_stage == TRACE_RUN)
+		{
+			g_trace_lcd_ticks = trace_ticks() - g_trace_ss_ticks;
+			g_trace_stage = TRACE_SHOWN;
+		}
+#endif
+		if (USART_Room() >= DIAGNOSTIC_ROOM)
+		{
+			fmt_print("Screen shown, LCD bus cycles: %u, busy timeouts: %u\n\r", lcd_bus_cycles() - g_screen_cycles,
+				lcd_busy_timeouts());
+		}
+		else
+		{
+			g_lines_skipped++;
+		}
+#if FRAME_TRACE
+		if (g_trace_stage == TRACE_SHOWN)
+		{
+			trace_print();
+		}
+#endif
+	}
+	
+	if (lcd_marquee_active() && ++g_marquee_ticks >= MARQUEE_STEP_TICKS)
+	{
+		lcd_marquee_step();
+		g_marquee_ticks = 0;
+	}
+}
+
+// Runs when the display needs timing, also wakes the Uno from idle
+ISR(TIMER0_OVF_vect)
+{
+	g_display_tick = 1;
+#if FRAME_TRACE
+	g_timer0_overflows++;
+#endif
+	// The sleep enable bit is still set when the interrupt wakes the Uno from idle
+	if (SMCR & (1 << SE))
+	{
+		g_energy_idle++;
+	}
+	else
+	{
+		g_energy_active++;
+	}
+	if (TCCR1B & (1 << CS10))
+	{
+		g_energy_buzzer++;
+	}
+}
+
+/*
+Wakes the Uno when Mega pulls SS low to start a frame.
+Timer2 is started as the frame clock, it runs until the Uno goes back to sleep.
+*/
+ISR(PCINT0_vect)
+{
+	if (!(PINB & (1 << PB2)))
+	{
+		TCNT2 = 0;
+		TIFR2 = (1 << TOV2);
+		g_frame_clock_overflows = 0;
+		TCCR2B = (1 << CS21); // Pre-scaler 8 --> 2 MHz
+#if FRAME_TRACE
+		g_trace_ss_ticks = trace_ticks();
+#endif
+	}
+}
+
+// Every 128 us while a frame is handled
+ISR(TIMER2_OVF_vect)
+{
+	if (g_frame_clock_overflows < 0xFF)
+	{
+		g_frame_clock_overflows++;
+	}
+}
+
+// Microseconds since Mega pulled SS low, stops at about 32 ms
+static uint16_t
+frame_clock_us(void)
+{
+	uint8_t sreg = SREG;
+	uint8_t count, overflows;
+	
+	cli();
+	count = TCNT2;
+	overflows = g_frame_clock_overflows;
+	// Overflow that happened after cli() but is not counted yet
+	if ((TIFR2 & (1 << TOV2)) && count < 0x80 && overflows < 0xFF)
+	{
+		overflows++;
+	}
+	SREG = sreg;
+	return ((uint16_t)overflows << 7) | (count >> 1);
+}
+
+/*
+Sleeps until Mega starts a frame.
+Standby is used when nothing on the Uno needs a timer. Only the oscillator keeps running there,
+so the Uno wakes up in 6 clock cycles, well before the first SCK edge of the frame.
+While the buzzer is on, the display has work to do or characters are still being sent, idle is
+used instead. Waiting for the serial output here would keep the Uno from the next frame.
+*/
+static void
+sleep_until_frame(void)
+{
+	uint8_t standby = !g_screen_pending && !lcd_marquee_active() && !(TCCR1B & (1 << CS10)) && USART_Idle();
+	
+	cli();
+	// Not sleeping if the frame has already started
+	if ((PINB & (1 << PB2)) && !(SPSR & (1 << SPIF)))
+	{
+		// The frame clock would wake idle every 128 us, the next SS starts it again
+		TCCR2B = 0;
+		if (standby)
+		{
+			// The watchdog would reset the Uno while it sleeps, it only counts the time there
+			energy_watchdog_start(WDTO_15MS);
+			SMCR = (1 << SM2) | (1 << SM1) | (1 << SE); // Standby
+		}
+		else
+		{
+			SMCR = (1 << SE); // Idle, Timer0 and Timer1 keep running
+		}
+		sei();
+		sleep_cpu(); // Runs before any interrupt since sei() delays them by one instruction
+		SMCR = 0;
+		if (standby)
+		{
+			wdt_enable(WATCHDOG_TIMEOUT);
+			if (!g_energy_watchdog_woke)
+			{
+				g_energy_standby_wakes++;
+			}
+		}
+	}
+	sei();
+}
+
+// Reads the frame clock started by the SS interrupt
+static void
+measure_wake_latency(void)
+{
+	uint16_t latency;
+	
+	if (!(TCCR2B & (1 << CS21)))
+	{
+		return;
+	}
+	
+	latency = frame_clock_us();
+	g_wake_latency_us = latency > WAKE_LATENCY_MAX_US ? WAKE_LATENCY_MAX_US : latency;
+	if (g_wake_latency_us > g_wake_latency_max_us)
+	{
+		g_wake_latency_max_us = g_wake_latency_us;
+	}
+}
+
+/*
+Waits for the first byte of a frame. There is no limit since Mega may stay quiet for any time,
+the display is updated and the watchdog fed meanwhile.
+*/
+static void
+wait_frame_start(void)
+{
+	while(!(SPSR & (1 << SPIF)))
+	{
+		wdt_reset();
+		display_idle_tasks();
+		sleep_until_frame();
+	}
+	measure_wake_latency();
+}
+
+/*
+Waits for the next byte inside a frame.
+Returns SPIN_TIMEOUT if Mega stopped sending, e.g. it was reset in the middle of the frame.
+*/
+static uint8_t
+wait_frame_byte(void)
+{
+	uint16_t polls = SPIN_LIMIT_SPI_US;
+	
+	while(!(SPSR & (1 << SPIF)))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_SPI);
+			return SPIN_TIMEOUT;
+		}
+		_delay_us(1);
+	}
+	return SPIN_OK;
+}
+
+/*
+Waits until Mega releases SS at the end of a frame that is not read to its last byte.
+The SPI hardware is reset while SS is high, so the next frame starts from its first byte.
+The byte clocked in last, e.g. an echoed test byte or the one that took the reply out, is
+left in SPDR with SPIF set. Reading both clears it, otherwise it would be the address of the next frame.
+*/
+static void
+wait_frame_end(void)
+{
+	uint16_t polls = SPIN_LIMIT_FRAME_END_US;
+	
+	while(!(PINB & (1 << PB2)))
+	{
+		if (--polls == 0)
+		{
+			spin_timeout(SPIN_SITE_FRAME_END);
+			return;
+		}
+		_delay_us(1);
+	}
+	if (SPSR & (1 << SPIF))
+	{
+		(void)SPDR;
+	}
+}
+
+// The frame last received from Mega and the first of its commands that has not been run yet
+static char g_frame[FRAME_SIZE];
+static char *g_next_command = NULL;
+
+/*
+Link counters. Printing while Mega waits to resend a frame would make it miss the frame again,
+so they are only printed with the next frame that is run.
+*/
+static uint16_t g_crc_errors = 0;
+static uint16_t g_cut_frames = 0;
+static uint16_t g_duplicates = 0;
+static uint16_t g_link_tests = 0;
+static uint8_t g_link_changed = 0;
+
+static uint8_t g_last_sequence = NO_SEQUENCE; // Of the last frame run that was addressed to this Uno
+
+// Ends a frame addressed to this Uno after Mega has clocked the reply out, a resend may follow 50 us later
+static void
+end_own_frame(uint8_t reply)
+{
+	SPDR = reply;
+	wait_frame_end();
+	DDRB &= ~(1 << PB4);
+}
+
+// Drops a frame that Mega stopped sending in the middle
+static void
+drop_cut_frame(void)
+{
+	wait_frame_end();
+	DDRB &= ~(1 << PB4);
+	g_cut_frames++;
+	g_link_changed = 1;
+}
+
+/*
+Actuator lane: the buzzer commands of a frame are run as soon as the frame has passed the checks,
+before it is printed and before any display command. They are taken out of the frame,
+what is left is the display lane and is run by next_command() in order.
+*/
+static void
+run_actuator_commands(char *commands)
+{
+	char *command = commands;
+	char *end;
+	uint8_t length;
+	uint8_t ran = 0;
+	uint16_t latency;
+	
+	while (*command != '\0')
+	{
+		end = strchr(command, COMMAND_SEPARATOR);
+		length = (end != NULL) ? end - command + 1 : strlen(command);
+		
+		// Command codes are one digit, the buzzer commands have no payload
+		if ((command[0] == '0' + BUZZER_ON || command[0] == '0' + BUZZER_OFF)
+			&& (command[1] == '\0' || command[1] == COMMAND_SEPARATOR))
+		{
+			buzzer_set(command[0] == '0' + BUZZER_ON);
+			memmove(command, command + length, strlen(command + length) + 1);
+			ran = 1;
+			continue;
+		}
+		command += length;
+	}
+	if (!ran)
+	{
+		return;
+	}
+	
+	latency = frame_clock_us();
+	g_siren_latency_us = latency;
+	if (latency > g_siren_latency_max_us)
+	{
+		g_siren_latency_max_us = latency;
+	}
+	if (latency > SIREN_LATENCY_BOUND_US)
+	{
+		g_siren_over_bound++;
+	}
+	g_siren_frames++;
+}
+
+/*
+Decides if a frame addressed to this Uno is run and which reply it gets.
+A frame with the sequence number of the last one was resent because the reply got lost, it is not run again.
+Sequence number 0 is the first frame after Mega started, it is always run.
+*/
+static uint8_t
+check_sequence(uint8_t sequence, uint8_t *run)
+{
+	uint8_t reply = REPLY_ACK;
+	
+	*run = 1;
+	if (g_last_sequence == NO_SEQUENCE)
+	{
+		// Mega redraws the screen when it sees this after it has had other replies
+		reply = REPLY_RESET;
+	}
+	else if (sequence == g_last_sequence && sequence != SEQUENCE_FLAG)
+	{
+		reply = REPLY_DUPLICATE;
+		*run = 0;
+		g_duplicates++;
+		g_link_changed = 1;
+	}
+	g_last_sequence = sequence;
+	return reply;
+}
+
+/*
+Waits for the next frame from Mega: address, sequence number, commands, terminating zero and CRC-8.
+Buzzer commands are run right here, the rest are taken one at a time by next_command(), a frame that was cut or corrupted is dropped as a whole.
+The bytes are read as fast as they come, Mega leaves a few microseconds between them for the CRC.
+*/
 void
-receive_command_from_mega(int *state, char *delimeter, char *payload)
+receive_command_from_mega(void)
 {
-	// To this array data is saved from Master in SPI communication
-	char spi_data_to_receive[CHAR_ARRAY_SIZE];
+	uint8_t own, crc, reply;
+	uint8_t run = 1;
+	uint8_t i = 0;
+#if FRAME_TRACE
+	uint8_t trace_time[TRACE_TIME_BYTES];
+	uint16_t rx_us;
+#endif
+	
+	// Between frames the display can be updated
+	wait_frame_start();
+	g_frame[0] = SPDR;
+	own = (g_frame[0] == SLAVE_ADDRESS);
+	if (own)
+	{
+		// Only this Uno is selected, it can answer on MISO
+		DDRB |= (1 << PB4);
+	}
+	crc = _crc8_ccitt_update(0, g_frame[0]);
 	
-	int temp_state;
-	for (int8_t i = 0; i < CHAR_ARRAY_SIZE; i++)
+	// The frame ends with a zero after the sequence number, the next byte is the CRC
+	do
 	{
-		// Delays are added to prevent things happening too fast
-		_delay_us(10);
-		// Checking SPI status register for reception complete
-		while(!(SPSR & (1 << SPIF))) {;}
-		// Delays are added to prevent things happening too fast
-		_delay_us(10);
+		if (wait_frame_byte() != SPIN_OK)
+		{
+			drop_cut_frame();
+			return;
+		}
 		// Getting the data from the register (Data from Mega)
-		spi_data_to_receive[i] = SPDR;
+		g_frame[++i] = SPDR;
+		crc = _crc8_ccitt_update(crc, g_frame[i]);
+		
+		// Link self-test, the shift register echoes the pattern back without any help
+		if (i == 1 && own && g_frame[1] == TEST_MARKER)
+		{
+			wait_frame_end();
+			DDRB &= ~(1 << PB4);
+			g_link_tests++;
+			g_link_changed = 1;
+			return;
+		}
+	} while ((i < 2 || g_frame[i] != '\0') && i < FRAME_SIZE - 1);
+	g_frame[i] = '\0';
+	
+#if FRAME_TRACE
+	// Kept as bytes, shifting them into a 32 bit number would take longer than the gap Mega leaves
+	for (uint8_t b = 0; b < TRACE_TIME_BYTES; b++)
+	{
+		if (wait_frame_byte() != SPIN_OK)
+		{
+			drop_cut_frame();
+			return;
+		}
+		trace_time[b] = SPDR;
+		crc = _crc8_ccitt_update(crc, trace_time[b]);
 	}
+#endif
 	
-	printf("Data received: %s\n\r", spi_data_to_receive);
-	// Splitting the string using : so the command and payload can be separated
-	char *ptr_split = strtok(spi_data_to_receive, delimeter);
+	if (wait_frame_byte() != SPIN_OK)
+	{
+		drop_cut_frame();
+		return;
+	}
+#if FRAME_TRACE
+	g_energy_spi_bytes += i + 2 + TRACE_TIME_BYTES;
+#else
+	g_energy_spi_bytes += i + 2;
+#endif
+	if (SPDR != crc)
+	{
+		g_crc_errors++;
+		g_link_changed = 1;
+		if (own)
+		{
+			end_own_frame(REPLY_NAK);
+		}
+		return;
+	}
+#if FRAME_TRACE
+	rx_us = frame_clock_us();
+#endif
+	
+	// Frames to the other slaves on the bus are ignored without printing, Mega does not wait for them
+	if (!own && g_frame[0] != BROADCAST_ADDRESS)
+	{
+		return;
+	}
+	if (own)
+	{
+		reply = check_sequence(g_frame[1], &run);
+		SPDR = reply;
+	}
+	// The buzzer changes while Mega is still clocking the reply out
+	if (run)
+	{
+		run_actuator_commands(&g_frame[2]);
+	}
+	if (own)
+	{
+		wait_frame_end();
+		DDRB &= ~(1 << PB4);
+	}
+	if (!run)
+	{
+		return;
+	}
+	
+#if FRAME_TRACE
+	// The screen of the last frame was not shown before this one came
+	if (g_trace_stage != TRACE_NONE)
+	{
+		trace_print();
+	}
+	memcpy(&g_trace_master_us, trace_time, TRACE_TIME_BYTES);
+	g_trace_sequence = g_frame[1] & ~SEQUENCE_FLAG;
+	g_trace_rx_us = rx_us;
+	g_trace_stage = TRACE_RECEIVED;
+#endif
+	/*
+	The lines only go into the transmit buffer, a line that does not fit is left out rather than
+	waited for, Mega may send the next frame 60 ms after this one.
+	*/
+	if (USART_Room() >= DIAGNOSTIC_ROOM)
+	{
+		fmt_print("Data received: %s\n\r", &g_frame[2]);
+	}
+	else
+	{
+		g_lines_skipped++;
+	}
+	// Kept for a later frame when there is no room, like the stack report
+	if (g_link_changed && USART_Room() >= DIAGNOSTIC_ROOM)
+	{
+		fmt_print("Link: CRC errors %u, cut frames %u, duplicates %u, test frames %u\n\r", g_crc_errors, g_cut_frames,
+			g_duplicates, g_link_tests);
+		g_link_changed = 0;
+	}
+	// The deepest stack is usually reached while a frame is handled
+	if (USART_Room() >= DIAGNOSTIC_ROOM && mem_high_water_grown())
+	{
+		mem_print_report();
+	}
+#if PROFILER_ENABLE
+	if (profiler_samples() >= PROFILE_DUMP_SAMPLES)
+	{
+		profiler_dump();
+	}
+#endif
+	g_next_command = &g_frame[2];
+}
+
+// Timing and link counters, printed when Mega prints its statistics instead of after every frame
+static void
+print_stats(void)
+{
+	fmt_print("SS to first byte: last %u us, max %u us\n\r", g_wake_latency_us, g_wake_latency_max_us);
+	fmt_print("SS to buzzer: %u frames, last %u us, max %u us, over %u us: %u\n\r", g_siren_frames, g_siren_latency_us,
+		g_siren_latency_max_us, SIREN_LATENCY_BOUND_US, g_siren_over_bound);
+	fmt_print("Link: CRC errors %u, cut frames %u, duplicates %u, test frames %u\n\r", g_crc_errors, g_cut_frames,
+		g_duplicates, g_link_tests);
+	fmt_print("Lines left out while the serial output was full: %u\n\r", g_lines_skipped);
+	spin_print_timeouts();
+	mem_print_report();
+}
+
+/*
+Takes the next command of the last frame, returns 0 if all of them have been run.
+The display is only updated between frames, so the commands of a frame show up together.
+*/
+static uint8_t
+next_command(int *state, char *delimeter, char *payload)
+{
+	char *command = g_next_command;
+	char *end;
+	uint16_t temp_state = WAIT_COMMAND; // Kept if the command does not start with a number
+	
+	if (command == NULL)
+	{
+#if FRAME_TRACE
+		if (g_trace_stage == TRACE_RECEIVED)
+		{
+			g_trace_run_ticks = trace_ticks() - g_trace_ss_ticks;
+			g_trace_stage = TRACE_RUN;
+		}
+#endif
+		return 0;
+	}
+	end = strchr(command, COMMAND_SEPARATOR);
+	if (end != NULL)
+	{
+		*end = '\0';
+		g_next_command = end + 1;
+	}
+	else
+	{
+		g_next_command = NULL;
+	}
+	
+	// Splitting the string using > so the command and payload can be separated
+	char *ptr_split = strtok(command, delimeter);
+	if (ptr_split == NULL)
+	{
+		// Empty command
+		*state = WAIT_COMMAND;
+		return 1;
+	}
 	
 	// Converting command string to integer
-	sscanf(ptr_split, "%d", &temp_state);
+	fmt_parse_u16(ptr_split, &temp_state);
 	
 	// Saving the command to state
 	*state = temp_state;
@@ -130,21 +1040,34 @@ receive_command_from_mega(int *state, char *delimeter, char *payload)
 	// Getting the payload
 	ptr_split = strtok(NULL, delimeter);
 	
-	// Copying the payload if there was any
+	// Copying the payload, a command without one gets empty text, e.g. "3>" clears the first row
 	if(ptr_split != NULL) {
-		strcpy(payload, ptr_split);
+		strncpy(payload, ptr_split, CHAR_ARRAY_SIZE - 1);
+		payload[CHAR_ARRAY_SIZE - 1] = '\0';
 	}
+	else
+	{
+		payload[0] = '\0';
+	}
+	return 1;
 }
 
 
 
 int main(void)
 {
+	// After a watchdog reset the watchdog stays on with the shortest timeout, turning it off first
+	uint8_t reset_flags = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+	
 	// Pin 9 for buzzer
 	DDRB |= (1 << BUZZER_PIN);
 	
-	// Setting MISO as output
-	DDRB |= (1 << PB4);
+	/*
+	MISO is left as an input and only turned on for frames addressed to this Uno.
+	With a broadcast frame several slaves are selected at once, their outputs would drive against each other.
+	*/
 	
 	// Set the SPI on
 	SPCR |= (1 << SPE);
@@ -196,8 +1119,36 @@ int main(void)
 	lcd_init(LCD_DISP_ON);
 	lcd_clrscr();
 	
+	// Timer0 overflows every 16.4 ms (pre-scaler 1024), used for display timing
+	TCCR0A = 0;
+	TCCR0B = (1 << CS02) | (1 << CS00);
+	TIMSK0 |= (1 << TOIE0);
+	
+#if PROFILER_ENABLE
+	// Samples on compare B of Timer0
+	profiler_start();
+#endif
+	
+	// SS (PB2, PCINT2) wakes the Uno for the next frame
+	PCMSK0 |= (1 << PCINT2);
+	PCICR |= (1 << PCIE0);
+	
+	// Timer2 is the frame clock started by SS, its overflows extend it past 128 us
+	TIMSK2 |= (1 << TOIE2);
+	
+	if (reset_flags & (1 << WDRF))
+	{
+		fmt_print("Reset by the watchdog\n\r");
+	}
+	
+	// Last resort if a wait is stuck, see WATCHDOG_TIMEOUT
+	wdt_enable(WATCHDOG_TIMEOUT);
+	
     while (1) 
     {
+		wdt_reset();
+		mem_check_guard();
+		
 		/* 
 		The command to run is received from the mega.
 		The correct action is decided in the switch case 
@@ -205,50 +1156,86 @@ int main(void)
 		switch(state)
 		{
 			case WAIT_COMMAND:
-				receive_command_from_mega(&state, delimeter, payload);
+				// All the commands of a frame are run before the next frame is received
+				if (!next_command(&state, delimeter, payload))
+				{
+					receive_command_from_mega();
+				}
 				break;
 			
 			case BUZZER_ON:
-				// Turns the buzzer on
-				TCCR1B |= (1 << CS10);
+				// Normally already run by run_actuator_commands()
+				buzzer_set(1);
 				state = WAIT_COMMAND;
 				break;
 			
 			case BUZZER_OFF:
-				// Turns the buzzer off
-				TCCR1B &= ~(1 << CS10);
+				buzzer_set(0);
 				state = WAIT_COMMAND;
 				break;
 			
 			case DISPLAY_FIRST_ROW:
 				// Getting the next part aka the payload of command
-				lcd_gotoxy(0, 0);
-				lcd_puts(payload);
+				display_row(0, payload);
 				state = WAIT_COMMAND;
 				break;
 				
 			case DISPLAY_CLEAR:
-				lcd_clrscr();
+				display_clear();
 				state = WAIT_COMMAND;
 				break;
 			
 			case DISPLAY_SECOND_ROW:
-				lcd_gotoxy(0, 1);
-				lcd_puts(payload);
+				display_row(1, payload);
 				state = WAIT_COMMAND;
 				break;
 				
 			case POWER_OFF:
-				SMCR |= (1 << SM1);
-				_delay_ms(100);
-				// Enabling sleep mode
-				SMCR |= (1 << SE);
-				sleep_cpu();
-				// !Once here, there is no feature to wake the Uno other than the reset button!
+				/* 
+				Sleeping in Power-down until Mega pulls SS low again.
+				Waking up takes 16K clock cycles (1 ms), so the frame that wakes the Uno is dropped.
+				*/
+				buzzer_set(0);
+				lcd_command(LCD_DISP_OFF);
+				USART_Flush();
+				wdt_disable();
+				cli();
+				// The watchdog interrupt that counts the time wakes the Uno too, it goes back to sleep
+				while (PINB & (1 << PB2))
+				{
+					energy_watchdog_start(WDTO_1S);
+					SMCR = (1 << SM1) | (1 << SE);
+					sei();
+					sleep_cpu();
+					SMCR = 0;
+					cli();
+					if (!g_energy_watchdog_woke)
+					{
+						g_energy_off_wakes++;
+					}
+				}
+				sei();
+				wdt_enable(WATCHDOG_TIMEOUT);
+				
+				lcd_command(LCD_DISP_ON);
+				fmt_print("Woke up from power off\n\r");
+				state = WAIT_COMMAND;
+				break;
+			
+			case ENERGY_REPORT:
+				print_energy();
+				state = WAIT_COMMAND;
+				break;
+			
+			case STATS_REPORT:
+				print_stats();
+				state = WAIT_COMMAND;
 				break;
 				
 			default:
-				printf("Unknown state\n\r");
+				// An unknown code is reported once, then the next command is taken
+				fmt_print("Unknown state\n\r");
+				state = WAIT_COMMAND;
 				break;
 		}
 		
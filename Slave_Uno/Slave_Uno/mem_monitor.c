@@ -0,0 +1,108 @@
+/*
+ * mem_monitor.c
+ *
+ * Created: 19/10/2026 23:02:36
+ * Author : Group 07
+ *
+ * Stack painting and the high water mark of the stack.
+ */
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include "mem_monitor.h"
+#include "fmt.h"
+
+// From the linker script: end of .bss, where the heap would start, and the start of .data
+extern uint8_t __heap_start;
+extern uint8_t __data_start;
+
+#define GUARD_START (&__heap_start)
+#define STACK_BOTTOM (&__heap_start + MEM_GUARD_SIZE)
+#define STACK_TOP ((uint8_t *)(uintptr_t)RAMEND)
+
+static uint16_t g_reported_high_water = 0;
+
+/*
+Runs before the stack and the zero register are set up, so it is written in assembler and
+touches only r24, r25 and Z. Paints from __heap_start up to RAMEND.
+*/
+void mem_paint(void) __attribute__((naked, used, section(".init1")));
+
+void
+mem_paint(void)
+{
+	__asm volatile (
+		"	ldi r30, lo8(__heap_start)\n"
+		"	ldi r31, hi8(__heap_start)\n"
+		"	ldi r24, %[paint]\n"
+		"	ldi r25, hi8(%[top] + 1)\n"
+		"1:	st Z+, r24\n"
+		"	cpi r30, lo8(%[top] + 1)\n"
+		"	cpc r31, r25\n"
+		"	brne 1b\n"
+		:
+		: [paint] "M" (MEM_PAINT), [top] "i" (RAMEND)
+		: "memory"
+	);
+}
+
+uint16_t
+mem_stack_size(void)
+{
+	return STACK_TOP - STACK_BOTTOM + 1;
+}
+
+uint16_t
+mem_stack_high_water(void)
+{
+	const uint8_t *p = STACK_BOTTOM;
+	
+	// The lowest byte the stack has written is the first one that is not painted
+	while (p <= STACK_TOP && *p == MEM_PAINT)
+	{
+		p++;
+	}
+	return STACK_TOP - p + 1;
+}
+
+uint16_t
+mem_free_now(void)
+{
+	return (uint8_t *)(uintptr_t)SP - STACK_BOTTOM;
+}
+
+bool
+mem_high_water_grown(void)
+{
+	uint16_t high_water = mem_stack_high_water();
+	
+	if (high_water > g_reported_high_water)
+	{
+		g_reported_high_water = high_water;
+		return true;
+	}
+	return false;
+}
+
+void
+mem_check_guard(void)
+{
+	for (const uint8_t *p = GUARD_START; p < STACK_BOTTOM; p++)
+	{
+		if (*p != MEM_PAINT)
+		{
+			fmt_print("Stack ran into the data, resetting\n\r");
+			wdt_enable(WDTO_15MS);
+			while (1)
+			{
+			}
+		}
+	}
+}
+
+void
+mem_print_report(void)
+{
+	fmt_print("SRAM: data %u bytes, stack used at most %u of %u bytes, %u free now\n\r",
+		(uint16_t)(&__heap_start - &__data_start), mem_stack_high_water(), mem_stack_size(), mem_free_now());
+}
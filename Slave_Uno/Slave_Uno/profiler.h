@@ -0,0 +1,48 @@
+/*
+ * profiler.h
+ *
+ * Created: 19/10/2026 23:41:09
+ * Author : Group 07
+ */
+
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stdint.h>
+
+/*
+Statistical profiler, the same copy is in both projects.
+A timer interrupt takes the address the CPU was at from the stack and counts it in a small table.
+profiler_dump() prints the table, tools/profile.py turns it into a flat profile of functions.
+Samples taken while the CPU sleeps in idle are counted as idle. In the deeper sleep modes
+the timer stops, no samples are taken then.
+  Mega: Timer1, PROFILE_HZ samples a second, follows the CPU clock through the power manager
+  Uno:  Timer0 compare B, Timer0 keeps running for the display, OCR0B is moved on at each sample
+*/
+#define PROFILER_ENABLE 0 // Set to 1 to build the profiler in, it needs a timer and the table in SRAM
+#define PROFILE_HZ 1000 // At most about 1000 on the Uno, its timer counts at 15.6 kHz
+
+#if defined(__AVR_ATmega2560__)
+#define PROFILE_SLOTS 128 // Different addresses kept, has to be a power of two
+#define PROFILE_PC_SHIFT 1 // Program counter (words) shifted right before it is counted, 17 bits do not fit otherwise
+#else
+#define PROFILE_SLOTS 32
+#define PROFILE_PC_SHIFT 0
+#endif
+
+#if PROFILER_ENABLE
+// Clears the table and starts sampling
+void profiler_start(void);
+
+/*
+Prints the table between "PROFILE begin" and "PROFILE end" and clears it.
+Each row is the address in bytes divided by 2 << PROFILE_PC_SHIFT, in hex, and the samples.
+*/
+void profiler_dump(void);
+
+// Samples since the last dump
+uint16_t profiler_samples(void);
+#endif
+
+#endif /* PROFILER_H_ */
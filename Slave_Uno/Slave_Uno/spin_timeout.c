@@ -0,0 +1,40 @@
+/*
+ * spin_timeout.c
+ *
+ * Created: 19/10/2026 13:20:17
+ * Author : Group 07
+ *
+ * Counters for the waits that gave up on the hardware.
+ */
+
+#include <avr/pgmspace.h>
+#include "spin_timeout.h"
+#include "fmt.h"
+
+static uint16_t g_timeouts[SPIN_SITE_COUNT];
+
+static const char g_site_names[SPIN_SITE_COUNT][10] PROGMEM =
+{
+	"SPI", "Frame end", "UART"
+};
+
+void
+spin_timeout(uint8_t site)
+{
+	g_timeouts[site]++;
+}
+
+uint16_t
+spin_timeouts(uint8_t site)
+{
+	return g_timeouts[site];
+}
+
+void
+spin_print_timeouts(void)
+{
+	for (uint8_t site = 0; site < SPIN_SITE_COUNT; site++)
+	{
+		fmt_printf_P(PSTR("%S timeouts: %u\n\r"), g_site_names[site], g_timeouts[site]);
+	}
+}
@@ -0,0 +1,41 @@
+/*
+ * spin_timeout.h
+ *
+ * Created: 19/10/2026 13:20:17
+ * Author : Group 07
+ */
+
+
+#ifndef SPIN_TIMEOUT_H_
+#define SPIN_TIMEOUT_H_
+
+#include <stdint.h>
+
+/*Return values of the functions waiting for the hardware*/
+#define SPIN_OK 0
+#define SPIN_TIMEOUT 1
+
+/*
+Places that wait for the hardware, each has its own timeout counter.
+A wait polls its flag every 1 us, so it ends after at most about 1.5 times its limit.
+The LCD busy flag wait is counted by the LCD library, see lcd_busy_timeouts().
+*/
+#define SPIN_SITE_SPI 0 // Next byte of a frame from Mega
+#define SPIN_SITE_FRAME_END 1 // SS going high after a dropped frame
+#define SPIN_SITE_UART 2 // Transmit buffer of USART0 to be empty
+#define SPIN_SITE_COUNT 3
+
+/*Limits in us, a few times the normal time*/
+#define SPIN_LIMIT_SPI_US 1000 // Mega sends a byte about every 30 us
+#define SPIN_LIMIT_FRAME_END_US 5000 // A whole frame takes about 1.2 ms
+#define SPIN_LIMIT_UART_US 3000 // One character at 9600 baud 8N2 takes 1.15 ms
+
+// Counts a timeout at the site
+void spin_timeout(uint8_t site);
+
+uint16_t spin_timeouts(uint8_t site);
+
+// Prints the timeout counters of all the sites
+void spin_print_timeouts(void);
+
+#endif /* SPIN_TIMEOUT_H_ */
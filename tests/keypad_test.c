@@ -0,0 +1,267 @@
+/*
+ * keypad_test.c
+ *
+ * Created: 19/10/2026 10:14:02
+ * Author : Group 07
+ *
+ * Runs the vertical counter debouncer of keypad.c on the host. Bouncing waveforms are fed
+ * through a simulated matrix and the press and release edges are checked, for each of the
+ * 16 keys alone and for all of them bouncing at once against a debouncer kept per key.
+ * The port accesses and waits of a scan tick are counted and held against a cycle budget.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "keypad.h"
+
+#define KEYS C_KeypadKeys_U8
+#define STABLE_TICKS 4 // Samples in the new state before the debounced state follows
+#define RANDOM_TICKS 20000
+
+/*
+Cycle budget of a scan tick at 16 MHz, 5 % of the scan period.
+The host has no AVR cycle counter, so the waits and port accesses are counted and the code
+around them is an estimate from keypad.c: the ISR saving and restoring the registers it uses,
+and the 16-bit vertical counter equations, about 2 cycles an 8-bit operation.
+*/
+#define CYCLES_PER_US 16
+#define TICK_BUDGET_CYCLES (CYCLES_PER_US * 1000 * C_KeypadScanTickMs_U8 / 20)
+#define ISR_CYCLES 60
+#define PORT_ACCESS_CYCLES 12 // The access with the loop, shift and OR around it
+#define DEBOUNCE_CYCLES 60
+
+volatile uint8_t DDRK;
+volatile uint8_t SREG;
+double stub_delay_us;
+
+static uint8_t g_portk;
+static unsigned g_port_accesses; // Row selects and column reads
+static uint16_t g_pressed; // Keys closed on the simulated keypad, bit n = key n
+static unsigned g_failures = 0;
+
+volatile uint8_t *
+stub_portk(void)
+{
+	g_port_accesses++;
+	return &g_portk;
+}
+
+// Columns of the row pulled low by the scan, a closed key pulls its column low
+uint8_t
+stub_read_pink(void)
+{
+	g_port_accesses++;
+	for (uint8_t row = 0; row < 4; row++)
+	{
+		if (!(g_portk & (0x10 << row)))
+		{
+			return 0xF0 | (~(g_pressed >> (row * 4)) & 0x0F);
+		}
+	}
+	return 0xFF;
+}
+
+static void
+check(int ok, const char *what, uint16_t keys, unsigned tick)
+{
+	if (!ok)
+	{
+		printf("FAIL keys 0x%04x tick %u: %s\n", keys, tick, what);
+		g_failures++;
+	}
+}
+
+// Debounced state, edges and counters of one key, written the plain way
+typedef struct
+{
+	uint8_t state;
+	uint8_t count;
+} reference_key_t;
+
+static uint8_t
+reference_tick(reference_key_t *key, uint8_t sample)
+{
+	if (sample == key->state)
+	{
+		key->count = 0;
+		return 0;
+	}
+	if (++key->count < STABLE_TICKS)
+	{
+		return 0;
+	}
+	key->state = sample;
+	key->count = 0;
+	return 1;
+}
+
+// Brings the debouncer back to all keys released with its counters reset
+static void
+settle(void)
+{
+	g_pressed = 0;
+	for (uint8_t i = 0; i < 2 * STABLE_TICKS; i++)
+	{
+		KEYPAD_ScanTick();
+	}
+	KEYPAD_GetPressEdges();
+	KEYPAD_GetReleaseEdges();
+}
+
+/*
+Plays a waveform on one key, '1' closed and '0' open for one tick each.
+The press edge has to come exactly on press_tick and the release edge on release_tick (-1: none).
+*/
+static void
+replay(uint8_t key, const char *wave, int press_tick, int release_tick)
+{
+	uint16_t bit = 1u << key;
+	uint16_t press, release;
+	
+	settle();
+	for (int tick = 0; wave[tick] != '\0'; tick++)
+	{
+		g_pressed = (wave[tick] == '1') ? bit : 0;
+		KEYPAD_ScanTick();
+		press = KEYPAD_GetPressEdges();
+		release = KEYPAD_GetReleaseEdges();
+		check(press == ((tick == press_tick) ? bit : 0), "press edge", bit, tick);
+		check(release == ((tick == release_tick) ? bit : 0), "release edge", bit, tick);
+	}
+}
+
+static void
+test_single_keys(void)
+{
+	for (uint8_t key = 0; key < KEYS; key++)
+	{
+		// Clean press and release
+		replay(key, "1111111100000000", 3, 11);
+		// Contact bounce of a few ms on both edges, 2 ms a sample
+		replay(key, "1011010011111111111101001011000000", 11, 31);
+		// Glitches up to 3 ticks long are filtered out
+		replay(key, "0100110001110000", -1, -1);
+		replay(key, "11111111101100111011111", 3, -1);
+	}
+}
+
+// Every key bounces on its own pseudo random waveform, the result has to match the plain debouncer
+static void
+test_all_keys_random(void)
+{
+	reference_key_t reference[KEYS];
+	uint32_t seed = 12345;
+	uint16_t press, release, expect_press, expect_release, expect_state;
+	
+	settle();
+	memset(reference, 0, sizeof(reference));
+	for (unsigned tick = 0; tick < RANDOM_TICKS; tick++)
+	{
+		// A key changes with a probability of 1/8 each tick, long and short runs both come up
+		for (uint8_t key = 0; key < KEYS; key++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			if (((seed >> 16) & 7) == 0)
+			{
+				g_pressed ^= 1u << key;
+			}
+		}
+		KEYPAD_ScanTick();
+		
+		expect_press = 0;
+		expect_release = 0;
+		expect_state = 0;
+		for (uint8_t key = 0; key < KEYS; key++)
+		{
+			if (reference_tick(&reference[key], (g_pressed >> key) & 1))
+			{
+				if (reference[key].state)
+				{
+					expect_press |= 1u << key;
+				}
+				else
+				{
+					expect_release |= 1u << key;
+				}
+			}
+			expect_state |= (uint16_t)reference[key].state << key;
+		}
+		press = KEYPAD_GetPressEdges();
+		release = KEYPAD_GetReleaseEdges();
+		check(press == expect_press, "press edges differ from the reference", press ^ expect_press, tick);
+		check(release == expect_release, "release edges differ from the reference", release ^ expect_release, tick);
+		check(KEYPAD_GetKeyState() == expect_state, "debounced state differs from the reference",
+			KEYPAD_GetKeyState() ^ expect_state, tick);
+	}
+}
+
+// Edges are kept until they are fetched, so a busy main loop does not lose them
+static void
+test_edges_accumulate(void)
+{
+	settle();
+	g_pressed = (1u << 0) | (1u << 15);
+	for (uint8_t i = 0; i < STABLE_TICKS; i++)
+	{
+		KEYPAD_ScanTick();
+	}
+	g_pressed = 0;
+	for (uint8_t i = 0; i < STABLE_TICKS; i++)
+	{
+		KEYPAD_ScanTick();
+	}
+	check(KEYPAD_GetPressEdges() == ((1u << 0) | (1u << 15)), "accumulated press edges", 0, 0);
+	check(KEYPAD_GetReleaseEdges() == ((1u << 0) | (1u << 15)), "accumulated release edges", 0, 0);
+	check(KEYPAD_GetPressEdges() == 0, "press edges cleared by the fetch", 0, 0);
+}
+
+// A scan takes the same time whatever the keys do, and stays within the budget
+static void
+test_tick_budget(void)
+{
+	uint32_t seed = 54321;
+	unsigned accesses = 0;
+	double waits_us = 0;
+	unsigned cycles;
+	
+	settle();
+	for (unsigned tick = 0; tick < RANDOM_TICKS; tick++)
+	{
+		seed = seed * 1103515245u + 12345u;
+		g_pressed = (uint16_t)(seed >> 16);
+		g_port_accesses = 0;
+		stub_delay_us = 0;
+		KEYPAD_ScanTick();
+		if (tick == 0)
+		{
+			accesses = g_port_accesses;
+			waits_us = stub_delay_us;
+		}
+		check(g_port_accesses == accesses && stub_delay_us == waits_us, "scan work depends on the keys", g_pressed,
+			tick);
+	}
+	
+	cycles = (unsigned)(waits_us * CYCLES_PER_US) + accesses * PORT_ACCESS_CYCLES + ISR_CYCLES + DEBOUNCE_CYCLES;
+	printf("scan tick: %u port accesses, %.0f us waits, about %u cycles of %u (%.1f %% of the CPU)\n", accesses,
+		waits_us, cycles, TICK_BUDGET_CYCLES, cycles * 100.0 / (CYCLES_PER_US * 1000 * C_KeypadScanTickMs_U8));
+	check(cycles <= TICK_BUDGET_CYCLES, "scan tick over its cycle budget", 0, 0);
+}
+
+int
+main(void)
+{
+	KEYPAD_Init();
+	test_single_keys();
+	test_edges_accumulate();
+	test_all_keys_random();
+	test_tick_budget();
+	
+	if (g_failures != 0)
+	{
+		printf("keypad_test: %u failures\n", g_failures);
+		return 1;
+	}
+	printf("keypad_test: all passed\n");
+	return 0;
+}
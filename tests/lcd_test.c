@@ -0,0 +1,375 @@
+/*
+ * lcd_test.c
+ *
+ * Created: 20/10/2026 16:40:12
+ * Author : Group 07
+ *
+ * Runs lcd.c on the host against an HD44780 played by the test in 4-bit mode. The controller
+ * latches a nibble on each Enable pulse, answers busy flag reads with its address counter and
+ * keeps both 40 cell DDRAM lines and the display shift, so the test sees what the panel shows.
+ * The bus cycles of the screens the Mega sends are counted for the clear and rewrite of the
+ * original firmware and for the DDRAM pages, and the marquee is checked to keep the other row.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include "lcd.h"
+
+#define CELLS LCD_DDRAM_LINE_CELLS
+#define MARQUEE_STEPS 60 // More than a whole turn of the 40 DDRAM cells
+#define BUS_CYCLES 3 // A command or character, two busy flag reads and the write
+// Both rows rewritten with a positioning command each and 16 display shifts to page 1
+#define PAGED_MAX_CYCLES (BUS_CYCLES * (LCD_LINES * (LCD_DISP_LENGTH + 1) + LCD_DISP_LENGTH))
+
+volatile uint8_t stub_io[0x100];
+
+static char g_ddram[LCD_LINES][CELLS];
+static uint8_t g_address; // Address counter, DDRAM only
+static uint8_t g_cgram; // Writes go to CGRAM
+static uint8_t g_shift; // Cells the display is shifted to the left
+static uint8_t g_low_nibble; // The next Enable pulse moves the low nibble
+static uint8_t g_byte;
+static unsigned g_failures = 0;
+
+static void
+check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL %s\n", what);
+		g_failures++;
+	}
+}
+
+/*HD44780*/
+
+static void
+controller_command(uint8_t command)
+{
+	if (command & 0x80)
+	{
+		g_address = command & 0x7F;
+		g_cgram = 0;
+	}
+	else if (command & 0x40)
+	{
+		g_cgram = 1;
+	}
+	else if ((command & 0xF8) == 0x18)
+	{
+		// Display shift, bit 2 set shifts to the right
+		g_shift = (command & 0x04) ? (g_shift + CELLS - 1) % CELLS : (g_shift + 1) % CELLS;
+	}
+	else if (command == 0x01)
+	{
+		memset(g_ddram, ' ', sizeof(g_ddram));
+		g_address = 0;
+		g_shift = 0;
+		g_cgram = 0;
+	}
+	else if ((command & 0xFE) == 0x02)
+	{
+		g_address = 0;
+		g_shift = 0;
+		g_cgram = 0;
+	}
+}
+
+static void
+controller_data(uint8_t data)
+{
+	if (g_cgram)
+	{
+		return;
+	}
+	uint8_t line = g_address >= LCD_START_LINE2;
+	g_ddram[line][g_address - (line ? LCD_START_LINE2 : LCD_START_LINE1)] = data;
+	g_address++;
+	if (g_address == LCD_START_LINE1 + CELLS)
+	{
+		g_address = LCD_START_LINE2;
+	}
+	else if (g_address == LCD_START_LINE2 + CELLS)
+	{
+		g_address = LCD_START_LINE1;
+	}
+}
+
+// lcd.c waits with Enable high before it lets go or samples PIND, a pulse moves one nibble
+void
+stub_delay_us(double us)
+{
+	(void)us;
+	if (!(PORTD & (1 << LCD_E_PIN)))
+	{
+		return;
+	}
+	if (PORTD & (1 << LCD_RW_PIN))
+	{
+		// Busy flag is never set, DB7..DB4 carry the address counter
+		uint8_t nibble = g_low_nibble ? (g_address & 0x0F) : (g_address >> 4);
+		PIND = (PIND & ~(0x0F << LCD_DATA0_PIN)) | (nibble << LCD_DATA0_PIN);
+	}
+	else
+	{
+		uint8_t nibble = (PORTD >> LCD_DATA0_PIN) & 0x0F;
+		g_byte = g_low_nibble ? (g_byte | nibble) : (nibble << 4);
+		if (g_low_nibble)
+		{
+			if (PORTB & (1 << LCD_RS_PIN))
+			{
+				controller_data(g_byte);
+			}
+			else
+			{
+				controller_command(g_byte);
+			}
+		}
+	}
+	g_low_nibble = !g_low_nibble;
+}
+
+// What the panel shows on a line
+static void
+visible(uint8_t line, char *text)
+{
+	for (uint8_t x = 0; x < LCD_DISP_LENGTH; x++)
+	{
+		text[x] = g_ddram[line][(g_shift + x) % CELLS];
+	}
+	text[LCD_DISP_LENGTH] = '\0';
+}
+
+static int
+shows(uint8_t line, const char *text)
+{
+	char expected[LCD_DISP_LENGTH + 1];
+	char shown[LCD_DISP_LENGTH + 1];
+
+	snprintf(expected, sizeof(expected), "%-16s", text);
+	visible(line, shown);
+	return strcmp(expected, shown) == 0;
+}
+
+// A marquee after some steps, the text wraps around the 40 DDRAM cells
+static int
+shows_marquee(uint8_t line, const char *text, unsigned steps)
+{
+	char window[LCD_DISP_LENGTH + 1];
+	size_t length = strlen(text);
+
+	for (uint8_t x = 0; x < LCD_DISP_LENGTH; x++)
+	{
+		unsigned i = (steps + x) % CELLS;
+		window[x] = i < length ? text[i] : ' ';
+	}
+	window[LCD_DISP_LENGTH] = '\0';
+	return shows(line, window);
+}
+
+/*Screens sent by the Mega, NULL keeps the row*/
+
+typedef struct
+{
+	uint8_t clear;
+	const char *rows[LCD_LINES];
+} screen_t;
+
+static const screen_t g_screens[] =
+{
+	{ 1, { "I'm Waiting!!!", NULL } },
+	{ 1, { "Motion: Hall", "Give pin in 15s" } },
+	{ 1, { "Enter Password:", NULL } },
+	{ 0, { NULL, "*" } },
+	{ 0, { NULL, "**" } },
+	{ 0, { NULL, "***" } },
+	{ 0, { NULL, "****" } },
+	{ 1, { "Correct password", NULL } },
+	{ 1, { "Alarm disarmed", NULL } },
+	{ 1, { "Arm alarm?", "A OK, B shutdown" } },
+	{ 1, { "Rearming in:", NULL } },
+	{ 0, { NULL, "5" } },
+	{ 0, { NULL, "4" } },
+	{ 1, { "I'm Waiting!!!", NULL } },
+	{ 1, { "I'm Waiting!!!", NULL } },
+};
+
+#define SCREENS (sizeof(g_screens) / sizeof(g_screens[0]))
+
+// "4" cleared the panel and each row was written over what it showed
+static void
+show_rewrite(const screen_t *screen)
+{
+	if (screen->clear)
+	{
+		lcd_clrscr();
+	}
+	for (uint8_t row = 0; row < LCD_LINES; row++)
+	{
+		if (screen->rows[row])
+		{
+			lcd_gotoxy(0, row);
+			lcd_puts(screen->rows[row]);
+		}
+	}
+}
+
+// What display_clear() and display_row() of main.c do before the screen is flipped
+static void
+show_paged(const screen_t *screen)
+{
+	if (!screen->clear)
+	{
+		lcd_page_copy();
+	}
+	for (uint8_t row = 0; row < LCD_LINES; row++)
+	{
+		if (screen->clear || screen->rows[row])
+		{
+			lcd_page_puts(row, screen->rows[row] ? screen->rows[row] : "");
+		}
+	}
+	lcd_page_flip();
+}
+
+// Applies the screens one after the other, the cycles of each are kept
+static void
+run_screens(void (*show)(const screen_t *), unsigned *cycles, const char *what)
+{
+	const char *expected[LCD_LINES] = { "", "" };
+
+	lcd_clrscr();
+	for (unsigned i = 0; i < SCREENS; i++)
+	{
+		const screen_t *screen = &g_screens[i];
+		uint16_t start = lcd_bus_cycles();
+
+		show(screen);
+		cycles[i] = (uint16_t)(lcd_bus_cycles() - start);
+		for (uint8_t row = 0; row < LCD_LINES; row++)
+		{
+			if (screen->clear || screen->rows[row])
+			{
+				expected[row] = screen->rows[row] ? screen->rows[row] : "";
+			}
+		}
+		check(shows(0, expected[0]) && shows(1, expected[1]), what);
+	}
+}
+
+static void
+test_screens(void)
+{
+	unsigned rewrite[SCREENS];
+	unsigned paged[SCREENS];
+	unsigned rewrite_total = 0;
+	unsigned paged_total = 0;
+
+	run_screens(show_rewrite, rewrite, "rewritten screen shown");
+	run_screens(show_paged, paged, "paged screen shown");
+
+	printf("LCD bus cycles per screen, rewrite / pages:\n");
+	for (unsigned i = 0; i < SCREENS; i++)
+	{
+		printf("  %-16s %-16s %4u / %3u\n", g_screens[i].rows[0] ? g_screens[i].rows[0] : "",
+			g_screens[i].rows[1] ? g_screens[i].rows[1] : "", rewrite[i], paged[i]);
+		rewrite_total += rewrite[i];
+		paged_total += paged[i];
+		check(paged[i] <= PAGED_MAX_CYCLES, "paged screen within its bus cycle bound");
+	}
+	printf("  total %u / %u\n", rewrite_total, paged_total);
+	// The last screen is a resend of the one before
+	check(paged[SCREENS - 1] == 0, "screen already shown is not sent again");
+}
+
+static void
+test_marquee_keeps_row(void)
+{
+	static const char text[] = "Back door opened, give pin within 15 s";
+	static const screen_t arm = { 1, { "Arm alarm?", "A OK, B shutdown" } };
+	unsigned steps = 0;
+
+	lcd_clrscr();
+	show_paged(&arm);
+	lcd_marquee_puts(0, text);
+	check(lcd_marquee_active(), "marquee active");
+	check(shows_marquee(0, text, 0) && shows(1, "A OK, B shutdown"), "marquee starts beside the other row");
+	for (; steps < MARQUEE_STEPS; steps++)
+	{
+		lcd_marquee_step();
+		check(shows_marquee(0, text, steps + 1) && shows(1, "A OK, B shutdown"), "other row kept while scrolling");
+	}
+
+	// The next screen changes the other row, the marquee goes on
+	lcd_page_copy();
+	lcd_page_puts(1, "*");
+	lcd_page_flip();
+	check(lcd_marquee_active() && shows_marquee(0, text, steps) && shows(1, "*"), "marquee kept across a flip");
+	for (unsigned i = 0; i < 5; i++, steps++)
+	{
+		lcd_marquee_step();
+	}
+	check(shows_marquee(0, text, steps) && shows(1, "*"), "marquee scrolls on the flipped page");
+
+	// Replacing its row stops it
+	lcd_page_copy();
+	lcd_page_puts(0, "Enter Password:");
+	lcd_page_flip();
+	lcd_marquee_step();
+	check(!lcd_marquee_active() && shows(0, "Enter Password:") && shows(1, "*"), "marquee stopped by its row");
+}
+
+static void
+test_marquee_shift(void)
+{
+	static const char text[] = "Motion in the back yard, zone 4";
+	unsigned steps = 0;
+	uint16_t start;
+
+	// With the other row empty the display shift is used, one command a step
+	lcd_clrscr();
+	lcd_marquee_puts(1, text);
+	for (; steps < MARQUEE_STEPS; steps++)
+	{
+		start = lcd_bus_cycles();
+		lcd_marquee_step();
+		check(lcd_bus_cycles() - start == BUS_CYCLES, "shift step is one command");
+		check(shows(0, "") && shows_marquee(1, text, steps + 1), "shifted marquee shown");
+	}
+
+	// A row composed beside it undoes the shift, the marquee goes on from where it was
+	lcd_page_copy();
+	lcd_page_puts(0, "Give pin in 15s");
+	lcd_page_flip();
+	check(lcd_marquee_active() && shows(0, "Give pin in 15s") && shows_marquee(1, text, steps), "shift undone by a flip");
+	for (unsigned i = 0; i < MARQUEE_STEPS; i++, steps++)
+	{
+		lcd_marquee_step();
+		check(shows(0, "Give pin in 15s") && shows_marquee(1, text, steps + 1), "other row kept after the shift");
+	}
+
+	// A second marquee on the other row keeps this one's last window
+	lcd_marquee_puts(0, "Hall and back yard both open");
+	check(shows_marquee(0, "Hall and back yard both open", 0) && shows_marquee(1, text, steps), "second marquee");
+}
+
+int
+main(void)
+{
+	// lcd_init() is left out, it talks to the controller in 8-bit mode first
+	memset(g_ddram, ' ', sizeof(g_ddram));
+
+	test_screens();
+	test_marquee_keeps_row();
+	test_marquee_shift();
+
+	if (g_failures != 0)
+	{
+		printf("lcd_test: %u failures\n", g_failures);
+		return 1;
+	}
+	printf("lcd_test: all passed\n");
+	return 0;
+}
@@ -0,0 +1,13 @@
+/*
+ * interrupt.h
+ *
+ * Host stand-in for <avr/interrupt.h>, the test is single threaded.
+ */
+
+#ifndef STUB_AVR_INTERRUPT_H_
+#define STUB_AVR_INTERRUPT_H_
+
+#define cli()
+#define sei()
+
+#endif /* STUB_AVR_INTERRUPT_H_ */
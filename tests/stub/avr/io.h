@@ -0,0 +1,22 @@
+/*
+ * io.h
+ *
+ * Host stand-in for <avr/io.h>, only the registers keypad.c uses.
+ * The rows and columns are reached through functions, so the test can answer for the selected
+ * row and count the port accesses of a scan.
+ */
+
+#ifndef STUB_AVR_IO_H_
+#define STUB_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t DDRK;
+extern volatile uint8_t SREG;
+
+volatile uint8_t *stub_portk(void);
+uint8_t stub_read_pink(void);
+#define PORTK (*stub_portk())
+#define PINK stub_read_pink()
+
+#endif /* STUB_AVR_IO_H_ */
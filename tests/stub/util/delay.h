@@ -0,0 +1,16 @@
+/*
+ * delay.h
+ *
+ * Host stand-in for <util/delay.h>, the simulated matrix settles at once.
+ * The waits are only added up, they are part of the time a scan takes.
+ */
+
+#ifndef STUB_UTIL_DELAY_H_
+#define STUB_UTIL_DELAY_H_
+
+extern double stub_delay_us;
+
+#define _delay_us(us) ((void)(stub_delay_us += (us)))
+#define _delay_ms(ms) ((void)(stub_delay_us += (ms) * 1000.0))
+
+#endif /* STUB_UTIL_DELAY_H_ */
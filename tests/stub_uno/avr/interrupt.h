@@ -0,0 +1,15 @@
+/*
+ * interrupt.h
+ *
+ * Host stand-in for <avr/interrupt.h>. The test is single threaded, the handlers are plain
+ * functions it can call.
+ */
+
+#ifndef STUB_AVR_INTERRUPT_H_
+#define STUB_AVR_INTERRUPT_H_
+
+#define cli()
+#define sei()
+#define ISR(vector) void vector(void)
+
+#endif /* STUB_AVR_INTERRUPT_H_ */
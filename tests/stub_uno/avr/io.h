@@ -0,0 +1,130 @@
+/*
+ * io.h
+ *
+ * Host stand-in for <avr/io.h> of the ATmega328P. The registers are kept in stub_io at their
+ * data space addresses, so the DDR() and PIN() macros of lcd.c find the register next to the port.
+ * The SPI and PINB are read through functions, the test answers for the Mega on the other end
+ * and moves its clock on with each poll.
+ */
+
+#ifndef STUB_AVR_IO_H_
+#define STUB_AVR_IO_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t stub_io[0x100];
+
+volatile uint8_t *stub_pinb(void);
+volatile uint8_t *stub_spsr(void);
+volatile uint8_t *stub_spdr(void);
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_MEM16(address) (*(volatile uint16_t *)&stub_io[address])
+
+#define PINB (*stub_pinb())
+#define DDRB stub_io[0x24]
+#define PORTB stub_io[0x25]
+#define PINC stub_io[0x26]
+#define DDRC stub_io[0x27]
+#define PORTC stub_io[0x28]
+#define PIND stub_io[0x29]
+#define DDRD stub_io[0x2A]
+#define PORTD stub_io[0x2B]
+#define TIFR0 stub_io[0x35]
+#define TIFR1 stub_io[0x36]
+#define TIFR2 stub_io[0x37]
+#define TCCR0A stub_io[0x44]
+#define TCCR0B stub_io[0x45]
+#define TCNT0 stub_io[0x46]
+#define OCR0A stub_io[0x47]
+#define OCR0B stub_io[0x48]
+#define SPCR stub_io[0x4C]
+#define SPSR (*stub_spsr())
+#define SPDR (*stub_spdr())
+#define SMCR stub_io[0x53]
+#define MCUSR stub_io[0x54]
+#define MCUCR stub_io[0x55]
+#define SREG stub_io[0x5F]
+#define WDTCSR stub_io[0x60]
+#define PRR stub_io[0x64]
+#define PCICR stub_io[0x68]
+#define PCMSK0 stub_io[0x6B]
+#define TIMSK0 stub_io[0x6E]
+#define TIMSK1 stub_io[0x6F]
+#define TIMSK2 stub_io[0x70]
+#define TCCR1A stub_io[0x80]
+#define TCCR1B stub_io[0x81]
+#define TCNT1 _SFR_MEM16(0x84)
+#define OCR1A _SFR_MEM16(0x88)
+#define TCCR2A stub_io[0xB0]
+#define TCCR2B stub_io[0xB1]
+#define TCNT2 stub_io[0xB2]
+#define UCSR0A stub_io[0xC0]
+#define UCSR0B stub_io[0xC1]
+#define UCSR0C stub_io[0xC2]
+#define UBRR0L stub_io[0xC4]
+#define UBRR0H stub_io[0xC5]
+#define UDR0 stub_io[0xC6]
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PD0 0
+#define PD1 1
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define TOIE0 0
+#define OCIE0B 2
+#define TOV0 0
+#define WGM10 0
+#define COM1A0 6
+#define CS10 0
+#define WGM12 3
+#define WGM13 4
+#define OCIE1A 1
+#define CS21 1
+#define TOIE2 0
+#define TOV2 0
+
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+#define SPI2X 0
+#define WCOL 6
+#define SPIF 7
+
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define WDRF 3
+#define WDE 3
+#define WDCE 4
+#define WDIE 6
+#define PCIE0 0
+#define PCINT2 2
+
+#define MPCM0 0
+#define U2X0 1
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define UCSZ00 1
+#define USBS0 3
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+
+#endif /* STUB_AVR_IO_H_ */
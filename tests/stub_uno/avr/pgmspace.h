@@ -0,0 +1,23 @@
+/*
+ * pgmspace.h
+ *
+ * Host stand-in for <avr/pgmspace.h>, flash and SRAM are the same memory.
+ */
+
+#ifndef STUB_AVR_PGMSPACE_H_
+#define STUB_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_ptr(address) (*(void * const *)(address))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncpy_P strncpy
+
+#endif /* STUB_AVR_PGMSPACE_H_ */
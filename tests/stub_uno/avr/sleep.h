@@ -0,0 +1,13 @@
+/*
+ * sleep.h
+ *
+ * Host stand-in for <avr/sleep.h>, the test moves its clock on to the next thing that wakes the CPU.
+ */
+
+#ifndef STUB_AVR_SLEEP_H_
+#define STUB_AVR_SLEEP_H_
+
+void stub_sleep_cpu(void);
+#define sleep_cpu() stub_sleep_cpu()
+
+#endif /* STUB_AVR_SLEEP_H_ */
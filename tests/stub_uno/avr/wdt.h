@@ -0,0 +1,16 @@
+/*
+ * wdt.h
+ *
+ * Host stand-in for <avr/wdt.h>, the watchdog never runs out.
+ */
+
+#ifndef STUB_AVR_WDT_H_
+#define STUB_AVR_WDT_H_
+
+#define WDTO_15MS 0
+#define WDTO_1S 6
+#define wdt_reset()
+#define wdt_enable(timeout) ((void)(timeout))
+#define wdt_disable()
+
+#endif /* STUB_AVR_WDT_H_ */
@@ -0,0 +1,16 @@
+/*
+ * stdio.h
+ *
+ * The streams of avr-libc on top of the host <stdio.h>, the Uno output goes to the host stdout.
+ */
+
+#ifndef STUB_STDIO_H_
+#define STUB_STDIO_H_
+
+#include_next <stdio.h>
+
+#define _FDEV_SETUP_READ 1
+#define _FDEV_SETUP_WRITE 2
+#define FDEV_SETUP_STREAM(put, get, flags) { 0 }
+
+#endif /* STUB_STDIO_H_ */
@@ -0,0 +1,56 @@
+/*
+ * stdlib.h
+ *
+ * The number conversions of avr-libc on top of the host <stdlib.h>.
+ */
+
+#ifndef STUB_STDLIB_H_
+#define STUB_STDLIB_H_
+
+#include_next <stdlib.h>
+#include <stdint.h>
+
+static inline char *
+ultoa(unsigned long value, char *text, int radix)
+{
+	char digits[33];
+	uint8_t length = 0;
+	
+	do
+	{
+		digits[length++] = "0123456789abcdef"[value % radix];
+		value /= radix;
+	} while (value != 0);
+	for (uint8_t i = 0; i < length; i++)
+	{
+		text[i] = digits[length - 1 - i];
+	}
+	text[length] = '\0';
+	return text;
+}
+
+static inline char *
+utoa(unsigned int value, char *text, int radix)
+{
+	return ultoa(value, text, radix);
+}
+
+static inline char *
+ltoa(long value, char *text, int radix)
+{
+	if (value < 0)
+	{
+		text[0] = '-';
+		ultoa(-(unsigned long)value, &text[1], radix);
+		return text;
+	}
+	return ultoa(value, text, radix);
+}
+
+static inline char *
+itoa(int value, char *text, int radix)
+{
+	return ltoa(value, text, radix);
+}
+
+#endif /* STUB_STDLIB_H_ */
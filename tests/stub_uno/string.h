@@ -0,0 +1,23 @@
+/*
+ * string.h
+ *
+ * strupr() of avr-libc on top of the host <string.h>.
+ */
+
+#ifndef STUB_STRING_H_
+#define STUB_STRING_H_
+
+#include_next <string.h>
+#include <ctype.h>
+
+static inline char *
+strupr(char *text)
+{
+	for (char *c = text; *c != '\0'; c++)
+	{
+		*c = toupper((unsigned char)*c);
+	}
+	return text;
+}
+
+#endif /* STUB_STRING_H_ */
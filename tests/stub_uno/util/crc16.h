@@ -0,0 +1,23 @@
+/*
+ * crc16.h
+ *
+ * Host stand-in for <util/crc16.h>, the CRC-8 of avr-libc (polynomial 0x07).
+ */
+
+#ifndef STUB_UTIL_CRC16_H_
+#define STUB_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+static inline uint8_t
+_crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+	crc ^= data;
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+#endif /* STUB_UTIL_CRC16_H_ */
@@ -0,0 +1,14 @@
+/*
+ * delay.h
+ *
+ * Host stand-in for <util/delay.h>, a wait moves the clock of the test on.
+ */
+
+#ifndef STUB_UTIL_DELAY_H_
+#define STUB_UTIL_DELAY_H_
+
+void stub_delay_us(double us);
+#define _delay_us(us) stub_delay_us(us)
+#define _delay_ms(ms) stub_delay_us((ms) * 1000.0)
+
+#endif /* STUB_UTIL_DELAY_H_ */
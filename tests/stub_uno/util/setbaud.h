@@ -0,0 +1,12 @@
+/*
+ * setbaud.h
+ *
+ * Host stand-in for <util/setbaud.h>, the Uno sets its baud rate itself.
+ */
+
+#ifndef STUB_UTIL_SETBAUD_H_
+#define STUB_UTIL_SETBAUD_H_
+
+#define USE_2X 0
+
+#endif /* STUB_UTIL_SETBAUD_H_ */
@@ -0,0 +1,393 @@
+/*
+ * uno_link_test.c
+ *
+ * Created: 20/10/2026 14:02:51
+ * Author : Group 07
+ *
+ * Runs the frame receiver of the Uno on the host against a Mega played by the test. The Mega
+ * side sends its bytes at the times spi_bus.c does, the SPI of the Uno is simulated with its
+ * shift register, the receive buffer and SPIF, and MISO is only driven while DDRB has PB4 set.
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define main uno_main
+#include "main.c"
+#undef main
+
+/*Timing of the Mega, as in spi_bus.c*/
+#define SLAVE_WAKE_US 10
+#define BYTE_GAP_US 6
+#define REPLY_WAIT_US 20
+#define RETRY_GAP_US 50
+#define TEST_FRAME_BYTES 128
+#define TEST_SETUP_US 100
+#define TEST_FRAME_GAP_US 200
+#define TEST_FRAMES (2048 / TEST_FRAME_BYTES)
+
+#define POLL_NS 125 // A register poll of the Uno, 2 clock cycles
+#define IDLE_END_NS 10000000ull // The Uno is left waiting this long after the last event
+#define MAX_EVENTS 8192
+
+#define EVENT_SS_LOW 0
+#define EVENT_SS_HIGH 1
+#define EVENT_BYTE 2
+
+typedef struct
+{
+	uint64_t ns;
+	uint8_t type;
+	uint8_t mosi;
+	uint8_t miso; // Filled in when the byte has been clocked
+} event_t;
+
+volatile uint8_t stub_io[0x100];
+
+static event_t g_events[MAX_EVENTS];
+static unsigned g_event_count;
+static unsigned g_next_event;
+static uint64_t g_now_ns;
+static uint64_t g_script_ns; // Where the Mega is with its script
+
+static uint8_t g_ss_high = 1;
+static uint8_t g_shift; // Shift register, goes out on MISO with the next byte
+static uint8_t g_received; // Receive buffer
+static uint8_t g_spif;
+static uint8_t g_spif_seen; // SPSR was read with SPIF set, accessing SPDR clears it
+static uint8_t g_spsr_value;
+static uint8_t g_spdr_value; // What the Uno reads from SPDR, a different value there later is a write
+static uint8_t g_pinb_value;
+
+static jmp_buf g_done;
+static char g_ran[16][FRAME_SIZE]; // Frames the Uno has run, commands only
+static unsigned g_ran_count;
+static unsigned g_failures = 0;
+
+static void
+check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL %s\n", what);
+		g_failures++;
+	}
+}
+
+/*Mega*/
+
+static unsigned
+script(uint8_t type, uint8_t mosi, double after_us)
+{
+	g_script_ns += (uint64_t)(after_us * 1000.0);
+	g_events[g_event_count].ns = g_script_ns;
+	g_events[g_event_count].type = type;
+	g_events[g_event_count].mosi = mosi;
+	return g_event_count++;
+}
+
+// A byte followed by a gap, it is in the receive buffer of the Uno after the 8 clocks
+static unsigned
+script_byte_gap(uint8_t byte, double byte_us, double gap_us)
+{
+	unsigned index = script(EVENT_BYTE, byte, byte_us);
+	
+	g_script_ns += (uint64_t)(gap_us * 1000.0);
+	return index;
+}
+
+// One exchange()
+static unsigned
+script_byte(uint8_t byte, double byte_us)
+{
+	return script_byte_gap(byte, byte_us, BYTE_GAP_US);
+}
+
+/*
+A self-test frame of test_clock(), returns the index of its first pattern byte.
+The bytes are streamed, the SPI waits gap_us after each of them and USART1 sends them back to back.
+*/
+static unsigned
+script_test_frame(double byte_us, double gap_us)
+{
+	uint8_t pattern = 1;
+	unsigned first;
+	
+	script(EVENT_SS_LOW, 0, 0);
+	g_script_ns += SLAVE_WAKE_US * 1000;
+	script_byte_gap(SLAVE_ADDRESS, byte_us, gap_us);
+	script_byte_gap(TEST_MARKER, byte_us, gap_us);
+	g_script_ns += TEST_SETUP_US * 1000;
+	first = g_event_count;
+	for (unsigned i = 0; i < TEST_FRAME_BYTES; i++)
+	{
+		script_byte_gap((i == 0) ? 0 : pattern, byte_us, gap_us);
+		if (i != 0)
+		{
+			pattern = (pattern & 1) ? (pattern >> 1) ^ 0xB8 : (pattern >> 1);
+		}
+	}
+	script(EVENT_SS_HIGH, 0, 0);
+	g_script_ns += TEST_FRAME_GAP_US * 1000;
+	return first;
+}
+
+// A frame of transfer_frame(), returns the index of the reply byte
+static unsigned
+script_frame(uint8_t sequence, const char *commands, uint8_t corrupt, double byte_us)
+{
+	uint8_t crc = 0;
+	uint8_t byte;
+	unsigned reply;
+	
+	script(EVENT_SS_LOW, 0, 0);
+	g_script_ns += SLAVE_WAKE_US * 1000;
+	for (unsigned i = 0; i < strlen(commands) + 3; i++)
+	{
+		byte = (i == 0) ? SLAVE_ADDRESS : (i == 1) ? sequence : (uint8_t)commands[i - 2];
+		crc = _crc8_ccitt_update(crc, byte);
+		script_byte(byte, byte_us);
+	}
+	script_byte(crc ^ corrupt, byte_us);
+	g_script_ns += REPLY_WAIT_US * 1000;
+	reply = script_byte(0xFF, byte_us);
+	script(EVENT_SS_HIGH, 0, 0);
+	return reply;
+}
+
+/*SPI of the Uno*/
+
+// SPDR was written since it was last read, the value goes out with the next byte
+static void
+spi_take_write(void)
+{
+	if (stub_io[0x4E] != g_spdr_value)
+	{
+		g_shift = stub_io[0x4E];
+		g_spdr_value = stub_io[0x4E];
+	}
+}
+
+static void
+advance_ns(uint64_t ns)
+{
+	event_t *event;
+	
+	spi_take_write();
+	g_now_ns += ns;
+	for (; g_next_event < g_event_count && g_events[g_next_event].ns <= g_now_ns; g_next_event++)
+	{
+		event = &g_events[g_next_event];
+		if (event->type == EVENT_SS_LOW || event->type == EVENT_SS_HIGH)
+		{
+			g_ss_high = (event->type == EVENT_SS_HIGH);
+			continue;
+		}
+		event->miso = (DDRB & (1 << PB4)) ? g_shift : 0xFF;
+		g_shift = event->mosi;
+		g_received = event->mosi;
+		g_spif = 1;
+		g_spif_seen = 0;
+	}
+	if (g_next_event == g_event_count && g_now_ns > g_script_ns + IDLE_END_NS)
+	{
+		longjmp(g_done, 1);
+	}
+}
+
+volatile uint8_t *
+stub_pinb(void)
+{
+	advance_ns(POLL_NS);
+	g_pinb_value = g_ss_high ? (1 << PB2) : 0;
+	return &g_pinb_value;
+}
+
+volatile uint8_t *
+stub_spsr(void)
+{
+	advance_ns(POLL_NS);
+	g_spsr_value = g_spif ? (1 << SPIF) : 0;
+	g_spif_seen = g_spif;
+	return &g_spsr_value;
+}
+
+volatile uint8_t *
+stub_spdr(void)
+{
+	spi_take_write();
+	if (g_spif_seen)
+	{
+		g_spif = 0;
+		g_spif_seen = 0;
+	}
+	stub_io[0x4E] = g_received;
+	g_spdr_value = g_received;
+	return &stub_io[0x4E];
+}
+
+void
+stub_delay_us(double us)
+{
+	advance_ns((uint64_t)(us * 1000.0));
+}
+
+// SS going low or the timers wake the Uno, the next byte cannot come before SS
+void
+stub_sleep_cpu(void)
+{
+	if (g_next_event == g_event_count)
+	{
+		longjmp(g_done, 1);
+	}
+	advance_ns(g_events[g_next_event].ns > g_now_ns ? g_events[g_next_event].ns - g_now_ns : 0);
+}
+
+/*Modules of the Uno that are not under test*/
+
+void lcd_init(uint8_t attributes) { (void)attributes; }
+void lcd_clrscr(void) { }
+void lcd_command(uint8_t command) { (void)command; }
+void lcd_page_puts(uint8_t y, const char *s) { (void)y; (void)s; }
+void lcd_page_copy(void) { }
+void lcd_page_flip(void) { }
+void lcd_marquee_puts(uint8_t y, const char *s) { (void)y; (void)s; }
+void lcd_marquee_step(void) { }
+uint8_t lcd_marquee_active(void) { return 0; }
+uint16_t lcd_bus_cycles(void) { return 0; }
+uint16_t lcd_busy_timeouts(void) { return 0; }
+uint16_t lcd_glyph_uploads(void) { return 0; }
+uint16_t mem_stack_size(void) { return 0; }
+uint16_t mem_stack_high_water(void) { return 0; }
+uint16_t mem_free_now(void) { return 0; }
+bool mem_high_water_grown(void) { return false; }
+void mem_check_guard(void) { }
+void mem_print_report(void) { }
+
+/*Runs the frame receiver of the Uno until the Mega has nothing more to send*/
+static void
+run_uno(void)
+{
+	FILE *console = stdout;
+	
+	memset(g_ran, 0, sizeof(g_ran));
+	g_ran_count = 0;
+	// The lines the Uno prints are not checked
+	stdout = fopen("/dev/null", "w");
+	if (setjmp(g_done) != 0)
+	{
+		fclose(stdout);
+		stdout = console;
+		return;
+	}
+	while (1)
+	{
+		receive_command_from_mega();
+		if (g_next_command != NULL)
+		{
+			strcpy(g_ran[g_ran_count++ % 16], g_next_command);
+			g_next_command = NULL;
+		}
+	}
+}
+
+static void
+reset_link(void)
+{
+	g_event_count = 0;
+	g_next_event = 0;
+	g_script_ns = g_now_ns + 1000000;
+	g_crc_errors = 0;
+	g_cut_frames = 0;
+	g_duplicates = 0;
+	g_link_tests = 0;
+}
+
+/*
+The self-test of the Mega sends its test frames 200 us apart and needs every echo to match.
+Each one ends with a pattern byte the Uno did not read, that must not start the next frame.
+*/
+static void
+test_self_test(double byte_us, double gap_us)
+{
+	unsigned first[TEST_FRAMES];
+	unsigned errors = 0;
+	uint8_t previous;
+	
+	reset_link();
+	for (unsigned frame = 0; frame < TEST_FRAMES; frame++)
+	{
+		first[frame] = script_test_frame(byte_us, gap_us);
+	}
+	run_uno();
+	
+	for (unsigned frame = 0; frame < TEST_FRAMES; frame++)
+	{
+		previous = TEST_MARKER;
+		for (unsigned i = 0; i < TEST_FRAME_BYTES; i++)
+		{
+			if (g_events[first[frame] + i].miso != previous)
+			{
+				errors++;
+			}
+			previous = g_events[first[frame] + i].mosi;
+		}
+	}
+	check(errors == 0, "self-test echo errors");
+	check(g_link_tests == TEST_FRAMES, "self-test frames counted by the Uno");
+	check(g_crc_errors == 0 && g_cut_frames == 0, "self-test frames taken for broken frames");
+	printf("self-test %.1f us a byte, %.0f us gap: %u echo errors, %u test frames seen\n", byte_us, gap_us, errors,
+		g_link_tests);
+}
+
+/*
+A frame that the Uno answers with NAK is sent again RETRY_GAP_US later. The resend has to be
+acknowledged and run once, the reply bytes must not look like the start of a frame.
+*/
+static void
+test_retransmit(double byte_us)
+{
+	unsigned first, nak, resend, next;
+	
+	reset_link();
+	g_last_sequence = NO_SEQUENCE;
+	first = script_frame(SEQUENCE_FLAG | 0, "3>Armed", 0, byte_us);
+	g_script_ns += 60000000; // Settle time of the panel
+	nak = script_frame(SEQUENCE_FLAG | 1, "3>Door open", 0x5A, byte_us);
+	g_script_ns += RETRY_GAP_US * 1000;
+	resend = script_frame(SEQUENCE_FLAG | 1, "3>Door open", 0, byte_us);
+	g_script_ns += 60000000;
+	next = script_frame(SEQUENCE_FLAG | 2, "5>Hall armed", 0, byte_us);
+	run_uno();
+	
+	check(g_events[first].miso == REPLY_RESET, "first frame answered with RESET");
+	check(g_events[nak].miso == REPLY_NAK, "corrupted frame answered with NAK");
+	check(g_events[resend].miso == REPLY_ACK, "resent frame acknowledged");
+	check(g_events[next].miso == REPLY_ACK, "next frame acknowledged");
+	check(g_ran_count == 3 && strcmp(g_ran[1], "3>Door open") == 0 && strcmp(g_ran[2], "5>Hall armed") == 0,
+		"resent frame run once");
+	check(g_crc_errors == 1 && g_cut_frames == 0 && g_duplicates == 0, "link counters");
+	printf("retransmit %.1f us a byte: replies %02x %02x %02x %02x, CRC errors %u, cut frames %u\n", byte_us,
+		g_events[first].miso, g_events[nak].miso, g_events[resend].miso, g_events[next].miso, g_crc_errors, g_cut_frames);
+}
+
+int
+main(void)
+{
+	// Mega starts the frames at SS, SPIF is clear
+	test_self_test(1.0, BYTE_GAP_US); // SPI fosc/2
+	test_self_test(8.0, BYTE_GAP_US); // SPI fosc/16
+	test_self_test(4.0, 0); // USART1 fosc/8, the fastest clock it streams at
+	test_retransmit(1.0);
+	test_retransmit(8.0);
+	
+	if (g_failures != 0)
+	{
+		printf("uno_link_test: %u failures\n", g_failures);
+		return 1;
+	}
+	printf("uno_link_test: all passed\n");
+	return 0;
+}
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""
+bridge_bench.py
+
+Streams status lines to the panel LCD through the bridge mode of the Mega and measures
+the frames per second and the latency from writing a line to its "ok" from the Mega.
+
+    python3 tools/bridge_bench.py /dev/ttyACM0 --frames 200 --window 2
+
+Needs pyserial. XON/XOFF from the Mega is handled by the serial driver (xonxoff=True).
+"""
+
+import argparse
+import re
+import statistics
+import sys
+import threading
+import time
+
+import serial
+
+BAUD = 9600
+ACK = re.compile(r"^(ok|err) (\d+)")
+
+
+def frame_text(n):
+    # One frame: clear, then both rows. Fits in the 61 characters of a frame.
+    return "4;3>Status %05u;5>t=%.1f s" % (n, time.monotonic() % 10000)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("port")
+    parser.add_argument("--baud", type=int, default=BAUD)
+    parser.add_argument("--frames", type=int, default=100)
+    parser.add_argument("--window", type=int, default=2,
+                        help="lines sent before their ok, 2 keeps one in the ring while one goes out")
+    args = parser.parse_args()
+
+    link = serial.Serial(args.port, args.baud, stopbits=serial.STOPBITS_TWO, xonxoff=True, timeout=0.1)
+    sent = {}
+    latencies = []
+    errors = [0]
+    answered = threading.Semaphore(args.window)
+    done = threading.Event()
+    first = [None]
+
+    def reader():
+        buffer = b""
+        while not done.is_set():
+            buffer += link.read(64)
+            while b"\n" in buffer:
+                line, buffer = buffer.split(b"\n", 1)
+                text = line.decode("ascii", "replace").strip()
+                match = ACK.match(text)
+                if not match:
+                    continue
+                # The Mega numbers the lines since it started, the first answer gives the offset
+                number = int(match.group(2))
+                if first[0] is None:
+                    first[0] = number
+                index = number - first[0]
+                if index in sent:
+                    latencies.append(time.monotonic() - sent.pop(index))
+                if match.group(1) == "err":
+                    errors[0] += 1
+                answered.release()
+
+    # A newline first, in power-down its start bit only wakes the Mega
+    link.write(b"\n")
+    time.sleep(0.05)
+    link.write(b"!bridge\n")
+    time.sleep(0.2)
+    link.reset_input_buffer()
+
+    thread = threading.Thread(target=reader, daemon=True)
+    thread.start()
+
+    start = time.monotonic()
+    for n in range(args.frames):
+        answered.acquire()
+        sent[n] = time.monotonic()
+        link.write((frame_text(n) + "\n").encode("ascii"))
+    # Waiting for the last answers
+    for _ in range(args.window):
+        answered.acquire(timeout=2)
+    elapsed = time.monotonic() - start
+    done.set()
+    thread.join()
+
+    link.write(b"!local\n")
+    link.close()
+
+    if not latencies:
+        print("No answers from the Mega, is it running and on %s?" % args.port)
+        return 1
+    line_bytes = len(frame_text(0)) + 1
+    latencies_ms = sorted(l * 1000 for l in latencies)
+    print("Frames: %u sent, %u answered, %u err, %u lost" % (
+        args.frames, len(latencies), errors[0], args.frames - len(latencies)))
+    print("Throughput: %.1f frames/s, UART limit for %u byte lines: %.1f frames/s" % (
+        len(latencies) / elapsed, line_bytes, args.baud / 11.0 / line_bytes))
+    print("Latency ms: min %.1f, median %.1f, p95 %.1f, max %.1f, mean %.1f" % (
+        latencies_ms[0], statistics.median(latencies_ms),
+        latencies_ms[int(0.95 * (len(latencies_ms) - 1))], latencies_ms[-1], statistics.mean(latencies_ms)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
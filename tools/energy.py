@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+"""
+energy.py
+
+Estimates the charge the Mega and the Uno draw from the time they spent in each power mode and
+the work of their peripherals, printed by "!energy" on the Mega console as "ENERGY" lines.
+
+    python3 tools/energy.py mega.log uno.log
+    python3 tools/energy.py mega.log uno.log --baseline old_mega.log old_uno.log
+
+The logs are the serial output of the boards, the Mega prints its line on its own port and the Uno
+on its own. The counters run from the start, so with two "!energy" in a log the difference of the
+first and the last line is used, e.g. for one hour of the alarm armed.
+The currents are typical values from the datasheets at 5 V and 16 MHz, not measured on these boards.
+Edit CURRENTS_UA to match a measurement. The USB chips and the regulators of the boards are not included.
+The time in power-down and standby is counted with the watchdog, which is about 10 % off.
+"""
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r"ENERGY (mega|uno) (.*?)\s*$")
+FIELD = re.compile(r"(\w+)=(\d+)")
+UART_BITS = 11  # 9600 baud, 8N2
+UART_BAUD = 9600
+HOURS_PER_DAY = 24
+
+# Typical supply currents in uA
+CURRENTS_UA = {
+    # ATmega2560, the same values as power_manager.h
+    "mega active 16 MHz": 20000,
+    "mega active 4 MHz": 6000,
+    "mega idle 16 MHz": 7500,
+    "mega idle 4 MHz": 2000,
+    "mega power-down": 10,  # With the watchdog running to count the time
+    "mega SPI": 200,  # On top of the CPU, while a frame is clocked out
+    "mega USART": 150,  # While a character is received or sent
+    # ATmega328P
+    "uno active": 10000,
+    "uno idle": 2700,
+    "uno standby": 200,  # The 16 MHz crystal keeps running
+    "uno power-down": 6,
+    "uno SPI": 200,
+    "uno USART": 150,
+    # Panel
+    "lcd logic": 1500,  # HD44780 controller, drawn all the time
+    "lcd backlight": 0,  # Depends on the module and its resistor, see --backlight-ma
+    "buzzer": 20000,
+}
+
+
+def read_lines(path):
+    """First and last counters of each board in a log."""
+    found = {}
+    with open(path, encoding="ascii", errors="replace") as log:
+        for line in log:
+            match = LINE.search(line)
+            if match:
+                counters = {name: int(value) for name, value in FIELD.findall(match.group(2))}
+                first, _ = found.get(match.group(1), (counters, None))
+                found[match.group(1)] = (first, counters)
+    return found
+
+
+def interval(first, last):
+    """Counters of the window between two lines, or since the start if they are the same line."""
+    if first is last:
+        return dict(last)
+    window = {}
+    for name, value in last.items():
+        if name.endswith("_period_ms") or name in ("tick_ms", "tick_us"):
+            window[name] = value
+        else:
+            window[name] = value - first.get(name, 0)
+    return window
+
+
+def deep_sleep_s(counters, name):
+    """Seconds in a watchdog counted sleep, a sleep ended by a frame or a key adds half a period."""
+    return (counters[name + "_ms"] + counters[name + "_wakes"] * counters[name + "_period_ms"] / 2.0) / 1000.0
+
+
+def mega_parts(c):
+    """(component, seconds, uA) of the Mega, the seconds of the modes add up to the time covered."""
+    tick = c["tick_ms"] / 1000.0
+    return [
+        ("mega active 16 MHz", c["active16"] * tick),
+        ("mega active 4 MHz", c["active4"] * tick),
+        ("mega idle 16 MHz", c["idle16"] * tick),
+        ("mega idle 4 MHz", c["idle4"] * tick),
+        ("mega power-down", deep_sleep_s(c, "down")),
+    ], [
+        ("mega SPI", c["spi_us"] / 1e6),
+        ("mega USART", (c["uart_rx"] + c["uart_tx"]) * UART_BITS / UART_BAUD),
+    ]
+
+
+def uno_parts(c):
+    tick = c["tick_us"] / 1e6
+    modes = [
+        ("uno active", c["active"] * tick),
+        ("uno idle", c["idle"] * tick),
+        ("uno standby", deep_sleep_s(c, "standby")),
+        ("uno power-down", deep_sleep_s(c, "off")),
+    ]
+    total = sum(seconds for _, seconds in modes)
+    return modes, [
+        # 8 SPI clocks a byte at 1 MHz
+        ("uno SPI", c["spi_bytes"] * 8 / 1e6),
+        ("uno USART", c["uart_tx"] * UART_BITS / UART_BAUD),
+        ("lcd logic", total),
+        ("lcd backlight", total),
+        ("buzzer", c["buzzer"] * tick),
+    ]
+
+
+def estimate(logs):
+    """Rows of (board, component, seconds, uAs), the seconds each board covered and its counters."""
+    boards = {}
+    for path in logs:
+        boards.update(read_lines(path))
+    if not boards:
+        sys.exit("No ENERGY lines in %s" % ", ".join(logs))
+    rows = []
+    covered = {}
+    counted = {}
+    for board, parts in (("mega", mega_parts), ("uno", uno_parts)):
+        if board not in boards:
+            continue
+        counters = counted[board] = interval(*boards[board])
+        modes, extras = parts(counters)
+        covered[board] = sum(seconds for _, seconds in modes)
+        for name, seconds in modes + extras:
+            rows.append((board, name, seconds, seconds * CURRENTS_UA[name]))
+    return rows, covered, counted
+
+
+def average_ma(rows, covered):
+    """Sum of the average currents of the boards, each over its own time."""
+    return sum(sum(uas for board, _, _, uas in rows if board == name) / seconds / 1000.0
+               for name, seconds in covered.items() if seconds > 0)
+
+
+def report(rows, covered, counted):
+    for board, seconds in covered.items():
+        print("%s: %.1f s covered" % (board, seconds))
+    if "uno" in counted:
+        # The controller draws about the same writing or not, the count only shows how busy the panel was
+        print("LCD bus cycles: %d" % counted["uno"]["lcd_cycles"])
+    print()
+    print("%-20s %10s %9s %10s %7s" % ("component", "time s", "uA", "avg uA", "share"))
+    total_ma = average_ma(rows, covered)
+    for board, name, seconds, uas in rows:
+        if seconds == 0:
+            continue
+        share_ua = uas / covered[board] if covered[board] > 0 else 0.0
+        print("%-20s %10.1f %9d %10.1f %6.1f%%" % (name, seconds, CURRENTS_UA[name], share_ua,
+                                                  100.0 * share_ua / 1000.0 / total_ma if total_ma else 0.0))
+    print()
+    print("Average %.3f mA, %.1f mAh a day" % (total_ma, total_ma * HOURS_PER_DAY))
+    return total_ma
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("logs", nargs="+", help="serial logs of the Mega and the Uno")
+    parser.add_argument("--baseline", nargs="+", help="logs of an earlier run to compare with")
+    parser.add_argument("--backlight-ma", type=float, help="current of the LCD backlight")
+    parser.add_argument("--battery-mah", type=float, help="capacity to work out the battery life for")
+    args = parser.parse_args()
+
+    if args.backlight_ma is not None:
+        CURRENTS_UA["lcd backlight"] = args.backlight_ma * 1000.0
+
+    rows, covered, counted = estimate(args.logs)
+    total_ma = report(rows, covered, counted)
+    if args.battery_mah and total_ma > 0:
+        print("%.0f mAh last %.1f days" % (args.battery_mah, args.battery_mah / total_ma / HOURS_PER_DAY))
+
+    if args.baseline:
+        base_rows, base_covered, _ = estimate(args.baseline)
+        base_ma = average_ma(base_rows, base_covered)
+        if base_ma > 0:
+            print("Baseline %.3f mA, change %+.3f mA (%+.1f %%)" % (base_ma, total_ma - base_ma,
+                                                                  100.0 * (total_ma - base_ma) / base_ma))
+
+
+if __name__ == "__main__":
+    main()
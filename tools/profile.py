@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""
+profile.py
+
+Turns the samples printed by the profiler of the firmware (profiler.c, PROFILER_ENABLE 1)
+into a flat profile of functions, using the symbols of the ELF the board runs.
+
+    python3 tools/profile.py Master_Mega/Master_Mega/Debug/Master_Mega.elf run.log
+    python3 tools/profile.py Master_Mega/Master_Mega/Debug/Master_Mega.elf /dev/ttyACM0 --send '!prof'
+
+The samples are read from a log of the serial output (a terminal capture or the output of
+simavr) or straight from a serial port. All the "PROFILE begin" ... "PROFILE end" blocks
+found are added up. Needs avr-nm, and pyserial only when reading a port.
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import re
+import stat
+import subprocess
+import sys
+import time
+
+BAUD = 9600
+# Anything can come before them on the line, simavr for example puts its own prefix there
+BEGIN = re.compile(r"PROFILE begin hz=(\d+) shift=(\d+) samples=(\d+) idle=(\d+) lost=(\d+)")
+ROW = re.compile(r"\b([0-9a-f]+) (\d+)\s*$")
+END = re.compile(r"PROFILE end")
+
+
+class Profile:
+    def __init__(self):
+        self.hz = 0
+        self.samples = 0
+        self.idle = 0
+        self.lost = 0
+        self.blocks = 0
+        self.by_address = collections.Counter()
+
+    def read(self, lines):
+        shift = None
+        for line in lines:
+            match = BEGIN.search(line)
+            if match:
+                self.hz = int(match.group(1))
+                shift = int(match.group(2))
+                self.samples += int(match.group(3))
+                self.idle += int(match.group(4))
+                self.lost += int(match.group(5))
+                continue
+            if shift is None:
+                continue
+            if END.search(line):
+                self.blocks += 1
+                shift = None
+                continue
+            match = ROW.search(line)
+            if match:
+                # The firmware counts word addresses shifted right, ELF symbols are in bytes
+                address = int(match.group(1), 16) << (shift + 1)
+                self.by_address[address] += int(match.group(2))
+
+
+def read_symbols(nm, elf):
+    """Functions in flash sorted by address: (start, end, name)."""
+    output = subprocess.run([nm, "--defined-only", "--numeric-sort", "--print-size", elf],
+                            check=True, capture_output=True, text=True).stdout
+    symbols = []
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[2] in "TtWw":
+            start = int(fields[0], 16)
+            symbols.append((start, start + int(fields[1], 16), fields[3]))
+        elif len(fields) == 3 and fields[1] in "TtWw":
+            # No size, e.g. the vectors and the labels of avr-libc written in assembler
+            symbols.append((int(fields[0], 16), None, fields[2]))
+    # A symbol without size ends where the next one starts
+    for i, (start, end, name) in enumerate(symbols):
+        if end is None:
+            following = symbols[i + 1][0] if i + 1 < len(symbols) else start + 2
+            symbols[i] = (start, following, name)
+    return symbols
+
+
+def function_at(symbols, starts, address):
+    index = bisect.bisect_right(starts, address) - 1
+    if index >= 0:
+        start, end, name = symbols[index]
+        if address < end:
+            return name
+    return "0x%05x" % address
+
+
+def lines_from_port(port, baud, send, timeout):
+    import serial
+
+    link = serial.Serial(port, baud, timeout=0.1)
+    if send:
+        # A newline first, in power-down its start bit only wakes the Mega
+        link.write(b"\n")
+        time.sleep(0.05)
+        link.write(send.encode("ascii") + b"\n")
+    buffer = b""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        buffer += link.read(64)
+        while b"\n" in buffer:
+            line, buffer = buffer.split(b"\n", 1)
+            text = line.decode("ascii", "replace")
+            yield text
+            if END.search(text):
+                return
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("elf")
+    parser.add_argument("source", help="log file, or a serial port to wait on for one block")
+    parser.add_argument("--baud", type=int, default=BAUD)
+    parser.add_argument("--send", help="line written to the port first, '!prof' on the Mega")
+    parser.add_argument("--timeout", type=float, default=30.0, help="seconds to wait on the port")
+    parser.add_argument("--nm", default="avr-nm")
+    parser.add_argument("--top", type=int, default=25, help="functions printed")
+    args = parser.parse_args()
+
+    profile = Profile()
+    if stat.S_ISCHR(os.stat(args.source).st_mode):
+        profile.read(lines_from_port(args.source, args.baud, args.send, args.timeout))
+    else:
+        with open(args.source, encoding="ascii", errors="replace") as log:
+            profile.read(log)
+    if profile.blocks == 0 or profile.samples == 0:
+        sys.exit("No complete PROFILE block with samples in %s" % args.source)
+
+    symbols = read_symbols(args.nm, args.elf)
+    starts = [start for start, _, _ in symbols]
+    by_function = collections.Counter()
+    for address, count in profile.by_address.items():
+        by_function[function_at(symbols, starts, address)] += count
+    if profile.lost:
+        by_function["<table full>"] += profile.lost
+
+    busy = profile.samples - profile.idle
+    print("%d samples in %d blocks at %d Hz, %.1f s awake" % (profile.samples, profile.blocks, profile.hz,
+                                                              profile.samples / profile.hz))
+    print("CPU busy %.1f %%, idle sleep %.1f %% (deeper sleep modes stop the timer and are not sampled)"
+          % (100.0 * busy / profile.samples, 100.0 * profile.idle / profile.samples))
+    print()
+    print("%7s %8s  %s" % ("%", "samples", "function"))
+    for name, count in by_function.most_common(args.top):
+        print("%7.2f %8d  %s" % (100.0 * count / profile.samples, count, name))
+
+
+if __name__ == "__main__":
+    main()
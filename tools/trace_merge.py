@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""
+trace_merge.py
+
+Puts the frame traces of the Mega and the Uno (SPI_BUS_TRACE and FRAME_TRACE set to 1) on one
+timeline. Prints the time each frame spent in every stage and writes a Chrome trace JSON that
+chrome://tracing or https://ui.perfetto.dev opens.
+
+    python3 tools/trace_merge.py mega.log uno.log -o trace.json
+
+mega.log has the "TRACE mega" lines printed by "!trace" on the Mega console, uno.log the serial
+output of the Uno. A frame carries the micros() of the Mega when SS went low and the Uno counts its
+stages from that SS, so the two are matched by that time and the sequence number.
+The Uno stages after the receive are counted on its own clock, which may be off by about 0.5 %
+(ceramic resonator), and have a resolution of 64 us.
+"""
+
+import argparse
+import json
+import re
+import statistics
+import sys
+
+MEGA = re.compile(r"TRACE mega dev=(\d+) seq=(\d+) cause=(\d+) queued=(\d+) ss=(\d+) end=(\d+) "
+                  r"tries=(\d+) status=(\d+)")
+UNO = re.compile(r"TRACE uno seq=(\d+) t=(\d+) rx=(\d+) run=(\d+)(?: lcd=(\d+))?")
+DATA = re.compile(r"Data received: (.*?)\s*$")
+BROADCAST = 255
+WRAP = 1 << 32  # micros() of the Mega goes round after 71 minutes
+
+STAGES = ["event to queue", "queue wait", "transfer", "receive", "commands", "lcd", "total"]
+
+
+def since(later, earlier):
+    return (later - earlier) % WRAP
+
+
+def read_mega(path):
+    frames = []
+    with open(path, encoding="ascii", errors="replace") as log:
+        for line in log:
+            match = MEGA.search(line)
+            if match:
+                values = [int(value) for value in match.groups()]
+                frames.append(dict(zip(["dev", "seq", "cause", "queued", "ss", "end", "tries", "status"], values)))
+    return frames
+
+
+def read_uno(path):
+    frames = []
+    commands = ""
+    with open(path, encoding="ascii", errors="replace") as log:
+        for line in log:
+            match = DATA.search(line)
+            if match:
+                # The trace of a frame comes after its own "Data received" line and before the next one
+                commands = match.group(1)
+                continue
+            match = UNO.search(line)
+            if match:
+                seq, t, rx, run, lcd = match.groups()
+                frames.append({"seq": int(seq), "t": int(t), "rx": int(rx), "run": int(run),
+                               "lcd": int(lcd) if lcd is not None else None, "commands": commands})
+    return frames
+
+
+def stages(mega, uno):
+    """Microseconds of each stage of one frame, None where the stage is not known."""
+    result = dict.fromkeys(STAGES)
+    if mega is not None:
+        if mega["cause"]:
+            result["event to queue"] = since(mega["queued"], mega["cause"])
+        result["queue wait"] = since(mega["ss"], mega["queued"])
+        result["transfer"] = since(mega["end"], mega["ss"])
+    if uno is not None:
+        result["receive"] = uno["rx"]
+        result["commands"] = uno["run"] - uno["rx"]
+        if uno["lcd"] is not None:
+            result["lcd"] = uno["lcd"] - uno["run"]
+            if mega is not None and mega["cause"]:
+                result["total"] = since(mega["ss"], mega["cause"]) + uno["lcd"]
+    return result
+
+
+def chrome_events(matched, origin):
+    events = [
+        {"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "Mega"}},
+        {"name": "process_name", "ph": "M", "pid": 2, "args": {"name": "Uno"}},
+    ]
+
+    def span(pid, tid, name, start, duration, args):
+        events.append({"name": name, "cat": "frame", "ph": "X", "pid": pid, "tid": tid,
+                       "ts": start, "dur": max(duration, 0), "args": args})
+
+    for mega, uno in matched:
+        ss = since(mega["ss"], origin) if mega else since(uno["t"], origin)
+        args = {"seq": (mega or uno)["seq"]}
+        if uno is not None:
+            args["commands"] = uno["commands"]
+        if mega is not None:
+            args.update(device=mega["dev"], tries=mega["tries"], status=mega["status"])
+            queued = since(mega["queued"], origin)
+            if mega["cause"]:
+                cause = since(mega["cause"], origin)
+                span(1, 1, "event to queue", cause, queued - cause, args)
+            span(1, 1, "queue wait", queued, ss - queued, args)
+            span(1, 2, "transfer", ss, since(mega["end"], mega["ss"]), args)
+        if uno is not None:
+            span(2, 1, "receive", ss, uno["rx"], args)
+            span(2, 1, "commands", ss + uno["rx"], uno["run"] - uno["rx"], args)
+            if uno["lcd"] is not None:
+                span(2, 2, "lcd", ss + uno["run"], uno["lcd"] - uno["run"], args)
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("mega_log")
+    parser.add_argument("uno_log")
+    parser.add_argument("-o", "--output", help="Chrome trace JSON to write")
+    args = parser.parse_args()
+
+    mega_frames = read_mega(args.mega_log)
+    uno_frames = read_uno(args.uno_log)
+    if not mega_frames and not uno_frames:
+        sys.exit("No TRACE lines found")
+
+    # The Uno only sees the frames addressed to it and the broadcasts
+    by_time = {(frame["ss"], frame["seq"]): frame for frame in mega_frames}
+    matched = []
+    for uno in uno_frames:
+        matched.append((by_time.pop((uno["t"], uno["seq"]), None), uno))
+    matched.extend((mega, None) for mega in by_time.values())
+    origin = min(mega["cause"] or mega["ss"] for mega in mega_frames) if mega_frames \
+        else min(uno["t"] for uno in uno_frames)
+    matched.sort(key=lambda pair: since(pair[0]["ss"] if pair[0] else pair[1]["t"], origin))
+
+    print("%4s %4s " % ("seq", "dev") + " ".join("%14s" % name for name in STAGES) + "  commands")
+    collected = {name: [] for name in STAGES}
+    for mega, uno in matched:
+        breakdown = stages(mega, uno)
+        cells = []
+        for name in STAGES:
+            value = breakdown[name]
+            if value is not None:
+                collected[name].append(value)
+            cells.append("%14s" % ("-" if value is None else value))
+        seq = (mega or uno)["seq"]
+        dev = "-" if mega is None else ("all" if mega["dev"] == BROADCAST else mega["dev"])
+        print("%4s %4s " % (seq, dev) + " ".join(cells) + "  " + (uno["commands"] if uno else ""))
+
+    print()
+    print("%-15s %6s %10s %10s %10s %10s  (us)" % ("stage", "frames", "min", "median", "p95", "max"))
+    for name in STAGES:
+        values = sorted(collected[name])
+        if values:
+            p95 = values[min(len(values) - 1, int(round(0.95 * (len(values) - 1))))]
+            print("%-15s %6d %10d %10d %10d %10d" % (name, len(values), values[0], statistics.median(values),
+                                                    p95, values[-1]))
+    unmatched = sum(1 for mega, uno in matched if mega is None or uno is None)
+    if unmatched:
+        print("\n%d frames only on one board: the Mega keeps its last SPI_TRACE_SIZE frames, "
+              "the Uno does not see the frames to the other slaves" % unmatched)
+
+    if args.output:
+        with open(args.output, "w") as output:
+            json.dump({"traceEvents": chrome_events(matched, origin), "displayTimeUnit": "ms"}, output, indent=1)
+        print("Wrote %s" % args.output)
+
+
+if __name__ == "__main__":
+    main()